@@ -0,0 +1,1312 @@
+#include "batch.h"
+#include "job.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Layout of the queue directory. Job n is manifest line n, and its markers
+// live in a subdirectory per thousand lines (<g> = n / 1000) so that long
+// manifests do not produce huge directories:
+//   reclamos/<g>/<n>  claim on job n, holding the claimer's token
+//   hechos/<g>/<n>    job n finished
+//   fallidos/<g>/<n>  job n failed, with the reason
+//   plazos/<g>/<n>    when job n was submitted, origin of its -plazo
+//   nodos/<id>        progress reported by worker <id>
+//   diario/<id>       journal of the outputs written by worker <id>
+//   identicos/<hh>/<k> claim on computing result <k> (see identicalKey),
+//                     and <k>.hecho, the outputs it produced
+static const char *CLAIMS_DIR = "reclamos";
+static const char *DONE_DIR = "hechos";
+static const char *FAILED_DIR = "fallidos";
+static const char *SUBMITTED_DIR = "plazos";
+static const char *NODES_DIR = "nodos";
+static const char *JOURNAL_DIR = "diario";
+static const char *IDENTICAL_DIR = "identicos";
+static const int JOBS_PER_DIR = 1000;
+
+// One job of the manifest.
+struct ManifestJob {
+  int line;          // Line number, which identifies the job in the queue
+  string text;       // The job's flags
+  int priority;      // From -prioridad
+  double deadline;   // From -plazo, in seconds after submission; 0 for none
+  time_t submitted;  // Origin of the deadline, shared by every worker
+};
+
+// What one worker has done so far, as published in nodos/<id>.
+struct NodeProgress {
+  int completed = 0;
+  int failed = 0;
+  int recovered = 0;   // Expired claims of other workers taken over
+  int currentLine = 0; // Job being run, 0 when idle
+  time_t started = 0;
+};
+
+// One output file of a finished job, as recorded in the journal.
+struct OutputRecord {
+  string path;
+  long long size = 0;
+  uint64_t hash = 0; // FNV-1a of the whole file
+};
+
+enum ClaimResult {
+  CLAIM_TAKEN,     // The job was free
+  CLAIM_RECOVERED, // The job's previous claim had expired
+  CLAIM_HELD,      // A live worker holds the job
+  CLAIM_ERROR,     // The queue directory cannot be written
+};
+
+/**
+ * @brief Creates a directory and any missing parents, like `mkdir -p`.
+ */
+static bool makeDirectories(const string &path) {
+  size_t slash = 0;
+  do {
+    slash = path.find('/', slash + 1);
+    const string prefix = path.substr(0, slash);
+    if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+  } while (slash != string::npos);
+  return true;
+}
+
+/**
+ * @brief Path of job `line`'s marker of the given kind, optionally creating
+ * its directory.
+ */
+static string markerPath(const string &queueDir, const char *kind, int line,
+                         bool create) {
+  const string dir = queueDir + "/" + kind + "/" +
+                     to_string(line / JOBS_PER_DIR);
+  if (create) {
+    makeDirectories(dir);
+  }
+  return dir + "/" + to_string(line);
+}
+
+static bool fileExists(const string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0;
+}
+
+static bool readFileText(const string &path, string &text) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    return false;
+  }
+  stringstream content;
+  content << file.rdbuf();
+  text = content.str();
+  return true;
+}
+
+/**
+ * @brief Writes a whole file under a temporary name and renames it into
+ * place, so readers on any node see either nothing or the full content.
+ *
+ * @param tag Suffix of the temporary name, unique to the writer.
+ */
+static bool writeFileAtomically(const string &path, const string &content,
+                                const string &tag) {
+  const string temporary = path + ".tmp." + tag;
+  {
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file << content;
+    if (!file.flush()) {
+      unlink(temporary.c_str());
+      return false;
+    }
+  }
+  if (rename(temporary.c_str(), path.c_str()) != 0) {
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Reads the manifest: one job per line, with the same flags as the
+ * command line. Blank lines and lines starting with '#' are skipped.
+ *
+ * Only the scheduling flags are read here; a line with invalid flags gets
+ * the default priority and fails when it runs.
+ *
+ * @param completeOnly Skip a last line without a newline, which may still
+ * be being appended.
+ */
+static bool loadManifest(const string &path, vector<ManifestJob> &jobs,
+                         bool completeOnly = false) {
+  ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  string text;
+  for (int line = 1; getline(file, text); ++line) {
+    if (completeOnly && file.eof()) {
+      break;
+    }
+    const size_t first = text.find_first_not_of(" \t\r");
+    if (first == string::npos || text[first] == '#') {
+      continue;
+    }
+    ManifestJob job = {line, text, 0, 0, 0};
+    vector<string> args;
+    JobRequest request;
+    if (splitJobLine(text, args)) {
+      try {
+        for (size_t i = 0; i < args.size(); ++i) {
+          parseJobFlag(args, i, request);
+        }
+        job.priority = request.priority;
+        job.deadline = request.deadline;
+      } catch (const exception &) {
+      }
+    }
+    jobs.push_back(job);
+  }
+  return true;
+}
+
+/**
+ * @brief Gives a job with a deadline the submission time every worker
+ * measures it from.
+ *
+ * The first worker to read the line publishes `seen`, the manifest's
+ * modification time when it read it, by linking a complete file to
+ * plazos/<g>/<n>, which only one worker can do. The others read that file,
+ * so a job appended while the batch runs is timed from when it was
+ * appended, whichever worker reads it and whenever that worker started.
+ *
+ * @param tag Suffix of the temporary name, unique to the worker.
+ */
+static void recordSubmission(const string &queueDir, ManifestJob &job,
+                             time_t seen, const string &tag) {
+  job.submitted = seen;
+  if (job.deadline <= 0) {
+    return;
+  }
+  const string path = markerPath(queueDir, SUBMITTED_DIR, job.line, true);
+  const string temporary = path + ".tmp." + tag;
+  {
+    ofstream file(temporary, ios::trunc);
+    file << seen << "\n";
+  }
+  const bool first = link(temporary.c_str(), path.c_str()) == 0;
+  unlink(temporary.c_str());
+  string text;
+  if (!first && readFileText(path, text) && !text.empty()) {
+    job.submitted = static_cast<time_t>(atoll(text.c_str()));
+  }
+}
+
+/**
+ * @brief Fills in the default queue directory and worker name.
+ */
+static BatchConfig resolveConfig(const BatchConfig &config) {
+  BatchConfig resolved = config;
+  if (resolved.queueDir.empty()) {
+    resolved.queueDir = resolved.manifestPath + ".cola";
+  }
+  if (resolved.nodeId.empty()) {
+    char host[256] = {};
+    gethostname(host, sizeof(host) - 1);
+    resolved.nodeId = string(host) + "-" + to_string(getpid());
+  }
+  // The name is used as a file name in nodos/
+  replace(resolved.nodeId.begin(), resolved.nodeId.end(), '/', '_');
+  if (resolved.leaseSeconds < 1) {
+    resolved.leaseSeconds = 1;
+  }
+  return resolved;
+}
+
+/**
+ * @brief Tries to claim one job.
+ *
+ * The claim is a file created with O_CREAT | O_EXCL, which succeeds for
+ * exactly one worker, also over NFS (v3 and later). It holds the claimer's
+ * token and its modification time is the lease: a claim not touched for
+ * `leaseSeconds` belongs to a dead worker. Such a claim is renamed to a
+ * name private to this worker first, and since only one rename of the same
+ * file can succeed, only one of several workers racing for it goes on to
+ * create the new claim. If the file moved turns out to be a fresh claim made
+ * in between, it is linked back.
+ *
+ * @param path Claim file of the job.
+ * @param token This claim's token, unique across workers and jobs.
+ * @param leaseSeconds Age after which a claim is considered abandoned.
+ * @param previousOwner Receives the token of a recovered claim.
+ */
+static ClaimResult claimJob(const string &path, const string &token,
+                            int leaseSeconds, string &previousOwner) {
+  bool recovered = false;
+  for (int attempt = 0; attempt < 3; ++attempt) {
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd >= 0) {
+      const bool written =
+          write(fd, token.data(), token.size()) ==
+          static_cast<ssize_t>(token.size());
+      if (close(fd) != 0 || !written) {
+        unlink(path.c_str());
+        return CLAIM_ERROR;
+      }
+      return recovered ? CLAIM_RECOVERED : CLAIM_TAKEN;
+    }
+    if (errno != EEXIST) {
+      return CLAIM_ERROR;
+    }
+
+    struct stat info;
+    string owner;
+    if (stat(path.c_str(), &info) != 0 || !readFileText(path, owner)) {
+      continue; // Released in the meantime
+    }
+    if (time(nullptr) - info.st_mtime <= leaseSeconds) {
+      return CLAIM_HELD;
+    }
+    const string aside = path + ".caducado." + token;
+    if (rename(path.c_str(), aside.c_str()) != 0) {
+      continue; // Another worker moved it first
+    }
+    string moved;
+    readFileText(aside, moved);
+    if (moved != owner) {
+      // A fresh claim was moved: put it back. If a third worker has claimed
+      // the path meanwhile, the moved claim is left aside rather than
+      // deleted; its owner's heartbeat sees the other token there and
+      // reports the claim as lost
+      if (link(aside.c_str(), path.c_str()) == 0) {
+        unlink(aside.c_str());
+      }
+      return CLAIM_HELD;
+    }
+    unlink(aside.c_str());
+    previousOwner = owner;
+    recovered = true;
+  }
+  return CLAIM_HELD;
+}
+
+/**
+ * @brief Removes a claim, unless another worker has taken it over.
+ */
+static void releaseClaim(const string &path, const string &token) {
+  string owner;
+  if (readFileText(path, owner) && owner == token) {
+    unlink(path.c_str());
+  }
+}
+
+// Renews a claim while its job runs, by touching the claim file a few times
+// per lease period from a background thread.
+class LeaseHeartbeat {
+public:
+  LeaseHeartbeat(const string &path, const string &token, int leaseSeconds)
+      : path(path), token(token),
+        interval(max(1, leaseSeconds / 3)), stopping(false), lost(false),
+        worker(&LeaseHeartbeat::run, this) {}
+
+  ~LeaseHeartbeat() {
+    {
+      lock_guard<mutex> lock(guard);
+      stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+  }
+
+  // Whether another worker took the claim over (the lease ran out)
+  bool wasLost() {
+    lock_guard<mutex> lock(guard);
+    return lost;
+  }
+
+private:
+  void run() {
+    unique_lock<mutex> lock(guard);
+    while (!wake.wait_for(lock, chrono::seconds(interval),
+                          [this]() { return stopping; })) {
+      string owner;
+      if (!readFileText(path, owner) || owner != token) {
+        lost = true;
+        return;
+      }
+      // A null time sets the server's clock on network file systems
+      utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    }
+  }
+
+  string path, token;
+  int interval;
+  bool stopping, lost;
+  mutex guard;
+  condition_variable wake;
+  thread worker; // Last, so it starts once the rest is initialised
+};
+
+/**
+ * @brief Publishes this worker's progress in nodos/<id>.
+ */
+static void reportProgress(const BatchConfig &config,
+                           const NodeProgress &progress) {
+  ostringstream text;
+  text << "nodo " << config.nodeId << "\n"
+       << "completados " << progress.completed << "\n"
+       << "fallidos " << progress.failed << "\n"
+       << "recuperados " << progress.recovered << "\n"
+       << "trabajo " << progress.currentLine << "\n"
+       << "inicio " << progress.started << "\n"
+       << "actualizado " << time(nullptr) << "\n";
+  writeFileAtomically(config.queueDir + "/" + NODES_DIR + "/" + config.nodeId,
+                      text.str(), to_string(getpid()));
+}
+
+/**
+ * @brief Calls `visit` with the path of every marker of one kind.
+ */
+static void forEachMarker(const string &queueDir, const char *kind,
+                          const function<void(const string &)> &visit) {
+  const string root = queueDir + "/" + kind;
+  DIR *groups = opendir(root.c_str());
+  if (!groups) {
+    return;
+  }
+  while (dirent *group = readdir(groups)) {
+    if (group->d_name[0] == '.') {
+      continue;
+    }
+    const string groupPath = root + "/" + group->d_name;
+    DIR *markers = opendir(groupPath.c_str());
+    if (!markers) {
+      continue;
+    }
+    while (dirent *marker = readdir(markers)) {
+      // Markers are bare line numbers; skip temporary and moved-aside files
+      if (strchr(marker->d_name, '.') == nullptr) {
+        visit(groupPath + "/" + marker->d_name);
+      }
+    }
+    closedir(markers);
+  }
+  closedir(groups);
+}
+
+/**
+ * @brief Temporary name under which a job writes an output: hidden, in the
+ * same directory (so the final rename stays atomic) and with the same
+ * extension (which picks the format).
+ *
+ * @param tag Token of the claim, unique to this run of the job.
+ */
+static string stagingPath(const string &outputPath, string tag) {
+  // ladderPath splits at the last dot, so the tag must not have one
+  replace(tag.begin(), tag.end(), '.', '-');
+  const size_t slash = outputPath.find_last_of('/');
+  const size_t nameStart = slash == string::npos ? 0 : slash + 1;
+  size_t dot = outputPath.find_last_of('.');
+  if (dot == string::npos || dot <= nameStart) {
+    dot = outputPath.size();
+  }
+  return outputPath.substr(0, nameStart) + "." +
+         outputPath.substr(nameStart, dot - nameStart) + ".parcial-" + tag +
+         outputPath.substr(dot);
+}
+
+/**
+ * @brief Measures and hashes (64-bit FNV-1a) a whole file.
+ */
+static bool hashFile(const string &path, OutputRecord &record) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    return false;
+  }
+  uint64_t hash = 14695981039346656037ULL;
+  long long size = 0;
+  vector<char> buffer(1 << 20);
+  while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+    const streamsize count = file.gcount();
+    for (streamsize i = 0; i < count; ++i) {
+      hash = (hash ^ static_cast<unsigned char>(buffer[i])) *
+             1099511628211ULL;
+    }
+    size += count;
+  }
+  record.path = path;
+  record.size = size;
+  record.hash = hash;
+  return true;
+}
+
+/**
+ * @brief Staged and final name of every file a job may write.
+ *
+ * @param request The job, with its final output path.
+ * @param staged The output path the job is run with.
+ */
+static vector<pair<string, string>> outputFiles(const JobRequest &request,
+                                                const string &staged) {
+  vector<pair<string, string>> files;
+  if (request.ladder.empty()) {
+    files.emplace_back(staged, request.outputPath);
+  }
+  for (int size : request.ladder) {
+    files.emplace_back(ladderPath(staged, size),
+                       ladderPath(request.outputPath, size));
+  }
+  return files;
+}
+
+/**
+ * @brief Renames a job's staged outputs to their final names.
+ *
+ * Every output is complete when it is renamed, so a file at the final name
+ * is never a partial write, even if the worker dies during the job.
+ *
+ * @param outputs Receives the size and hash of each final file.
+ * @return bool Whether at least one output was published; ladder levels
+ * not smaller than the source are not written.
+ */
+static bool publishOutputs(const vector<pair<string, string>> &files,
+                           vector<OutputRecord> &outputs) {
+  bool published = true;
+  for (const auto &file : files) {
+    if (!fileExists(file.first)) {
+      continue;
+    }
+    OutputRecord record;
+    if (rename(file.first.c_str(), file.second.c_str()) != 0 ||
+        !hashFile(file.second, record)) {
+      unlink(file.first.c_str());
+      published = false;
+      continue;
+    }
+    outputs.push_back(record);
+  }
+  return published && !outputs.empty();
+}
+
+/**
+ * @brief Appends one finished job to this worker's journal.
+ *
+ * Each output is one line, "<job> <size> <hash> <path>", and a job's lines
+ * go out in a single write that is synced before the done marker exists.
+ */
+static bool appendJournal(const string &journalPath, int line,
+                          const vector<OutputRecord> &outputs) {
+  ostringstream text;
+  for (const OutputRecord &output : outputs) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(output.hash));
+    text << line << " " << output.size << " " << hash << " " << output.path
+         << "\n";
+  }
+  const string entry = text.str();
+  const int fd =
+      open(journalPath.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const bool written =
+      write(fd, entry.data(), entry.size()) ==
+          static_cast<ssize_t>(entry.size()) &&
+      fsync(fd) == 0;
+  return close(fd) == 0 && written;
+}
+
+/**
+ * @brief Reads the journals of every worker. A torn last line, from a
+ * worker that died while appending, is ignored.
+ */
+static void loadJournals(const string &queueDir,
+                         map<int, vector<OutputRecord>> &journal) {
+  const string root = queueDir + "/" + JOURNAL_DIR;
+  DIR *journals = opendir(root.c_str());
+  if (!journals) {
+    return;
+  }
+  while (dirent *entry = readdir(journals)) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    ifstream file(root + "/" + entry->d_name);
+    string text;
+    while (getline(file, text)) {
+      if (file.eof()) {
+        break; // No newline: the line may be incomplete
+      }
+      istringstream fields(text);
+      int line = 0;
+      string hash;
+      OutputRecord record;
+      if (fields >> line >> record.size >> hash &&
+          getline(fields >> ws, record.path) && !record.path.empty()) {
+        record.hash = strtoull(hash.c_str(), nullptr, 16);
+        journal[line].push_back(record);
+      }
+    }
+  }
+  closedir(journals);
+}
+
+/**
+ * @brief Cheap check that a finished job's outputs are still in place:
+ * every file it journalled exists with one of the sizes recorded for it.
+ * Contents are not re-read; the hashes are there for audits.
+ */
+static bool verifyOutputs(const vector<OutputRecord> &records) {
+  set<string> paths, intact;
+  for (const OutputRecord &record : records) {
+    paths.insert(record.path);
+    struct stat info;
+    if (stat(record.path.c_str(), &info) == 0 &&
+        info.st_size == record.size) {
+      intact.insert(record.path);
+    }
+  }
+  return !paths.empty() && intact.size() == paths.size();
+}
+
+/**
+ * @brief Resumes a batch: keeps the done markers of earlier runs only when
+ * the journal confirms their outputs, so that lost or truncated outputs
+ * are produced again.
+ *
+ * Markers are listed before the journals are read. Since a job's journal
+ * entry is synced before its marker is written, every marker listed,
+ * including those of workers still running, has its entry in the journals.
+ */
+static void resumeQueue(const BatchConfig &config) {
+  vector<string> finished;
+  forEachMarker(config.queueDir, DONE_DIR,
+                [&](const string &path) { finished.push_back(path); });
+  if (finished.empty()) {
+    return;
+  }
+  map<int, vector<OutputRecord>> journal;
+  loadJournals(config.queueDir, journal);
+
+  size_t verified = 0, repeated = 0;
+  for (const string &path : finished) {
+    const int line = atoi(path.c_str() + path.find_last_of('/') + 1);
+    auto entry = journal.find(line);
+    if (entry != journal.end() && verifyOutputs(entry->second)) {
+      verified++;
+    } else if (unlink(path.c_str()) == 0) {
+      repeated++;
+    }
+  }
+  cout << "[INFO] Reanudación: " << verified
+       << " trabajos terminados verificados, " << repeated
+       << " se repetirán\n";
+}
+
+/**
+ * @brief Parses the flags of one manifest job.
+ *
+ * @param reason Receives why the line is not a valid job.
+ */
+static bool parseManifestJob(const ManifestJob &job, JobRequest &request,
+                             string &reason) {
+  vector<string> args;
+  if (!splitJobLine(job.text, args)) {
+    reason = "comillas sin cerrar";
+    return false;
+  }
+  size_t i = 0;
+  try {
+    for (; i < args.size(); ++i) {
+      if (!parseJobFlag(args, i, request)) {
+        reason = "opción desconocida " + args[i];
+        return false;
+      }
+    }
+  } catch (const exception &) {
+    reason = "valor inválido para " + args[i];
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Runs one manifest job, publishing its outputs through temporary
+ * files (see publishOutputs).
+ *
+ * @param tag Token of the claim, used to name the temporary files.
+ * @param abandoned Token of an expired claim on the job, whose temporary
+ * files are removed first; empty if none.
+ * @param outputs Receives the job's final output files.
+ * @param reason Receives why the job failed.
+ * @return bool Whether the job's outputs were written.
+ */
+static bool runManifestJob(const JobRequest &request, bool showOutput,
+                           const string &tag, const string &abandoned,
+                           vector<OutputRecord> &outputs, string &reason) {
+  if (!abandoned.empty()) {
+    const string leftover = stagingPath(request.outputPath, abandoned);
+    for (const auto &file : outputFiles(request, leftover)) {
+      unlink(file.first.c_str());
+    }
+  }
+  JobRequest staged = request;
+  staged.outputPath = stagingPath(request.outputPath, tag);
+  const vector<pair<string, string>> files =
+      outputFiles(request, staged.outputPath);
+  if (!runJob(staged, showOutput)) {
+    for (const auto &file : files) {
+      unlink(file.first.c_str()); // Possibly incomplete
+    }
+    reason = "no se pudo procesar " + request.inputPath;
+    return false;
+  }
+  if (!publishOutputs(files, outputs)) {
+    reason = "no se pudo escribir " + request.outputPath;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Key of the result a job computes: a hash (64-bit FNV-1a) of
+ * describeJob, the output format and the size and time of the input file,
+ * so that a rewritten input is not served from an older result.
+ *
+ * @return string 16 hex digits, or empty when the input cannot be read.
+ */
+static string identicalKey(const JobRequest &request) {
+  struct stat input;
+  if (stat(request.inputPath.c_str(), &input) != 0) {
+    return "";
+  }
+  const size_t slash = request.outputPath.find_last_of('/');
+  const size_t dot = request.outputPath.find_last_of('.');
+  ostringstream text;
+  text << describeJob(request) << "\n"
+       << (dot != string::npos && (slash == string::npos || dot > slash)
+               ? request.outputPath.substr(dot)
+               : "")
+       << "\n"
+       << input.st_size << " " << input.st_mtim.tv_sec << "."
+       << input.st_mtim.tv_nsec << "\n";
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : text.str()) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+  }
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx",
+           static_cast<unsigned long long>(hash));
+  return key;
+}
+
+/**
+ * @brief Serves a job from the outputs of an identical job, if one has
+ * finished and its files are intact.
+ *
+ * The result file lists "<index> <size> <path>" per output, index being its
+ * place in outputFiles. Each file is hard-linked (or copied, across file
+ * systems) to the job's staged name and renamed, like a computed output.
+ *
+ * @param resultPath The <k>.hecho file of the job's key.
+ * @param tag Token of the job's claim, used to name the temporary files.
+ * @param outputs Receives the job's final output files.
+ * @return bool Whether every output of the job was served.
+ */
+static bool reuseIdentical(const string &resultPath,
+                           const JobRequest &request, const string &tag,
+                           vector<OutputRecord> &outputs) {
+  string text;
+  if (!readFileText(resultPath, text)) {
+    return false;
+  }
+  const vector<pair<string, string>> files =
+      outputFiles(request, stagingPath(request.outputPath, tag));
+  vector<pair<size_t, OutputRecord>> sources;
+  istringstream lines(text);
+  size_t index;
+  OutputRecord source;
+  while (lines >> index >> source.size &&
+         getline(lines >> ws, source.path)) {
+    if (index >= files.size()) {
+      return false;
+    }
+    sources.emplace_back(index, source);
+  }
+  vector<OutputRecord> sizes;
+  for (const auto &entry : sources) {
+    sizes.push_back(entry.second);
+  }
+  if (sources.empty() || !verifyOutputs(sizes)) {
+    return false;
+  }
+
+  vector<OutputRecord> served;
+  for (const auto &entry : sources) {
+    const string &from = entry.second.path;
+    const string &staged = files[entry.first].first;
+    const string &target = files[entry.first].second;
+    bool placed = from == target;
+    if (!placed) {
+      unlink(staged.c_str());
+      placed = link(from.c_str(), staged.c_str()) == 0;
+      if (!placed) {
+        ifstream in(from, ios::binary);
+        ofstream out(staged, ios::binary | ios::trunc);
+        placed = in && out << in.rdbuf() && out.flush();
+      }
+      placed = placed && rename(staged.c_str(), target.c_str()) == 0;
+    }
+    OutputRecord record;
+    if (!placed || !hashFile(target, record)) {
+      unlink(staged.c_str());
+      return false;
+    }
+    served.push_back(record);
+  }
+  outputs.insert(outputs.end(), served.begin(), served.end());
+  return true;
+}
+
+/**
+ * @brief Records where the outputs of a computed job are, for the identical
+ * jobs waiting on it.
+ */
+static void recordIdentical(const string &resultPath,
+                            const JobRequest &request, const string &tag) {
+  const vector<pair<string, string>> files = outputFiles(request, "");
+  ostringstream text;
+  for (size_t index = 0; index < files.size(); ++index) {
+    struct stat info;
+    if (stat(files[index].second.c_str(), &info) == 0) {
+      text << index << " " << info.st_size << " " << files[index].second
+           << "\n";
+    }
+  }
+  writeFileAtomically(resultPath, text.str(), tag);
+}
+
+enum IdenticalResult {
+  IDENTICAL_REUSED, // An identical job had finished; its outputs were used
+  IDENTICAL_LEADER, // No identical job is running; this one computes
+  IDENTICAL_BUSY,   // An identical job is running on a live worker
+};
+
+/**
+ * @brief Joins the computation of a job's result: reuses it if it is done,
+ * waits for it if it is running, and otherwise claims it.
+ *
+ * The claim is a regular queue claim (claimJob) on identicos/<hh>/<k>, so a
+ * leader that dies loses it when its lease runs out, and the next identical
+ * job computes the result instead.
+ *
+ * @param keyPath Claim path of the job's key.
+ * @param token Token of the job's claim.
+ * @param outputs Receives the job's final output files, when reused.
+ */
+static IdenticalResult joinIdentical(const string &keyPath,
+                                     const JobRequest &request,
+                                     const string &token, int leaseSeconds,
+                                     vector<OutputRecord> &outputs) {
+  const string resultPath = keyPath + ".hecho";
+  if (reuseIdentical(resultPath, request, token, outputs)) {
+    return IDENTICAL_REUSED;
+  }
+  string previousOwner;
+  const ClaimResult claim =
+      claimJob(keyPath, token, leaseSeconds, previousOwner);
+  if (claim == CLAIM_HELD) {
+    return IDENTICAL_BUSY;
+  }
+  // The leader may have finished between the check and the claim
+  if (claim != CLAIM_ERROR &&
+      reuseIdentical(resultPath, request, token, outputs)) {
+    releaseClaim(keyPath, token);
+    return IDENTICAL_REUSED;
+  }
+  return IDENTICAL_LEADER; // Without the claim on errors: no coalescing
+}
+
+// Most urgent first: higher priority, then earlier deadline (none last).
+static bool moreUrgent(const ManifestJob &a, const ManifestJob &b) {
+  if (a.priority != b.priority) {
+    return a.priority > b.priority;
+  }
+  if ((a.deadline > 0) != (b.deadline > 0)) {
+    return a.deadline > 0;
+  }
+  return a.submitted + a.deadline < b.submitted + b.deadline;
+}
+
+// Everything one worker tracks, shared by its main loop and by the
+// preemption point it installs between warp tiles.
+struct WorkerState {
+  BatchConfig config;
+  vector<ManifestJob> jobs;
+  vector<size_t> order; // Job indices, most urgent first
+  vector<char> settled; // Known to have a marker
+  size_t pending = 0;   // Jobs not known to have a marker
+  size_t claims = 0;
+  size_t first = 0; // Rotation of the walk among equally urgent jobs
+  string tokenBase, journalPath;
+  off_t manifestSize = 0;       // To notice appended jobs
+  NodeProgress progress;
+  vector<int> running;          // Priorities of the jobs on this thread,
+                                // outermost first
+  chrono::steady_clock::time_point lastYield;
+};
+
+enum AttemptResult {
+  ATTEMPT_SETTLED, // The job has a marker now
+  ATTEMPT_HELD,    // Another live worker holds it
+  ATTEMPT_ERROR,   // The queue directory cannot be written
+};
+
+/**
+ * @brief Sorts the jobs by urgency. Jobs equally urgent keep the manifest
+ * order, rotated by the worker's starting point so that workers spread out.
+ */
+static void orderJobs(WorkerState &state) {
+  const size_t count = state.jobs.size();
+  state.order.resize(count);
+  for (size_t k = 0; k < count; ++k) {
+    state.order[k] = (state.first + k) % count;
+  }
+  stable_sort(state.order.begin(), state.order.end(),
+              [&state](size_t a, size_t b) {
+                return moreUrgent(state.jobs[a], state.jobs[b]);
+              });
+}
+
+/**
+ * @brief Picks up the jobs appended to the manifest since it was read.
+ *
+ * Lines are only ever appended, so the line numbers of the known jobs stay
+ * valid. A last line still without its newline is left for later.
+ */
+static void refreshManifest(WorkerState &state) {
+  struct stat info;
+  if (stat(state.config.manifestPath.c_str(), &info) != 0 ||
+      info.st_size == state.manifestSize) {
+    return;
+  }
+  vector<ManifestJob> jobs;
+  if (!loadManifest(state.config.manifestPath, jobs, true)) {
+    return;
+  }
+  state.manifestSize = info.st_size;
+  const int lastLine = state.jobs.empty() ? 0 : state.jobs.back().line;
+  size_t added = 0;
+  for (ManifestJob &job : jobs) {
+    if (job.line > lastLine) {
+      recordSubmission(state.config.queueDir, job, info.st_mtime,
+                       state.tokenBase);
+      state.jobs.push_back(job);
+      added++;
+    }
+  }
+  if (added > 0) {
+    state.settled.resize(state.jobs.size(), 0);
+    state.pending += added;
+    metricsSet(GAUGE_QUEUE_PENDING, static_cast<int64_t>(state.pending));
+    orderJobs(state);
+    cout << "[INFO] " << added << " trabajos nuevos en el manifiesto\n";
+  }
+}
+
+static void settleJob(WorkerState &state, size_t index) {
+  state.settled[index] = 1;
+  metricsSet(GAUGE_QUEUE_PENDING, static_cast<int64_t>(--state.pending));
+}
+
+/**
+ * @brief Claims and runs one job, unless it has a marker or a live claim.
+ *
+ * This is called from the main loop and, for more urgent jobs, from the
+ * preemption point of the job being run, in which case the two jobs are
+ * nested on the same thread and both claims are renewed.
+ */
+static AttemptResult attemptJob(WorkerState &state, size_t index) {
+  using namespace std::chrono;
+  const BatchConfig &config = state.config;
+  NodeProgress &progress = state.progress;
+
+  const ManifestJob job = state.jobs[index]; // jobs may grow meanwhile
+  const string donePath =
+      markerPath(config.queueDir, DONE_DIR, job.line, false);
+  const string failedPath =
+      markerPath(config.queueDir, FAILED_DIR, job.line, false);
+  if (fileExists(donePath) || fileExists(failedPath)) {
+    settleJob(state, index);
+    return ATTEMPT_SETTLED;
+  }
+
+  const string claimPath =
+      markerPath(config.queueDir, CLAIMS_DIR, job.line, true);
+  const string token = state.tokenBase + "." + to_string(++state.claims);
+  string previousOwner;
+  const ClaimResult claim =
+      claimJob(claimPath, token, config.leaseSeconds, previousOwner);
+  if (claim == CLAIM_ERROR) {
+    cerr << "[ERROR] No se pudo reclamar el trabajo " << job.line << " ("
+         << strerror(errno) << ")\n";
+    return ATTEMPT_ERROR;
+  }
+  if (claim == CLAIM_HELD) {
+    return ATTEMPT_HELD;
+  }
+  if (claim == CLAIM_RECOVERED) {
+    progress.recovered++;
+    cout << "[INFO] Concesión caducada de " << previousOwner
+         << " en el trabajo " << job.line << ", recuperada\n";
+  }
+  // Another worker may have finished it between the check and the claim
+  if (fileExists(donePath) || fileExists(failedPath)) {
+    releaseClaim(claimPath, token);
+    settleJob(state, index);
+    return ATTEMPT_SETTLED;
+  }
+
+  JobRequest request;
+  string reason;
+  vector<OutputRecord> outputs;
+  bool succeeded = parseManifestJob(job, request, reason);
+  // A follower would never write its preview, so those jobs run alone
+  const string key = succeeded && request.previewPath.empty()
+                         ? identicalKey(request)
+                         : "";
+  string keyPath;
+  IdenticalResult identical = IDENTICAL_LEADER;
+  if (!key.empty()) {
+    const string dir = config.queueDir + "/" + IDENTICAL_DIR + "/" +
+                       key.substr(0, 2);
+    makeDirectories(dir);
+    keyPath = dir + "/" + key;
+    identical = joinIdentical(keyPath, request, token, config.leaseSeconds,
+                              outputs);
+  }
+  if (identical == IDENTICAL_BUSY) {
+    // Retried on a later pass, once the running job has its result
+    releaseClaim(claimPath, token);
+    return ATTEMPT_HELD;
+  }
+
+  const int outerLine = progress.currentLine;
+  if (outerLine != 0) {
+    cout << "[" << config.nodeId << "] Trabajo " << outerLine
+         << " en pausa por el trabajo " << job.line << " (prioridad "
+         << job.priority << ")\n";
+  }
+  progress.currentLine = job.line;
+  state.running.push_back(job.priority);
+  metricsSet(GAUGE_QUEUE_ACTIVE, static_cast<int64_t>(state.running.size()));
+  reportProgress(config, progress);
+  auto start = steady_clock::now();
+  const bool reused = identical == IDENTICAL_REUSED;
+  bool lost = false;
+  if (succeeded && !reused) {
+    LeaseHeartbeat heartbeat(claimPath, token, config.leaseSeconds);
+    unique_ptr<LeaseHeartbeat> keyHeartbeat;
+    if (!keyPath.empty()) {
+      keyHeartbeat.reset(
+          new LeaseHeartbeat(keyPath, token, config.leaseSeconds));
+    }
+    succeeded = runManifestJob(request, config.showOutput, token,
+                               previousOwner, outputs, reason);
+    lost = heartbeat.wasLost();
+  }
+  if (!keyPath.empty() && !reused) {
+    if (succeeded) {
+      recordIdentical(keyPath + ".hecho", request, token);
+    }
+    // On failure the identical jobs compute the result themselves
+    releaseClaim(keyPath, token);
+  }
+  if (reused) {
+    metricsAdd(COUNTER_COALESCED);
+  }
+  if (succeeded && !appendJournal(state.journalPath, job.line, outputs)) {
+    // Without an entry a restart would redo the job anyway
+    cerr << "[ERROR] No se pudo escribir el diario " << state.journalPath
+         << "\n";
+  }
+  const long long elapsed =
+      duration_cast<milliseconds>(steady_clock::now() - start).count();
+
+  ostringstream marker;
+  marker << config.nodeId << " " << elapsed << " ms\n";
+  if (!succeeded) {
+    marker << reason << "\n";
+  }
+  makeDirectories(donePath.substr(0, donePath.find_last_of('/')));
+  makeDirectories(failedPath.substr(0, failedPath.find_last_of('/')));
+  writeFileAtomically(succeeded ? donePath : failedPath, marker.str(),
+                      token);
+  releaseClaim(claimPath, token);
+  settleJob(state, index);
+
+  const long long late =
+      job.deadline > 0
+          ? static_cast<long long>(time(nullptr) - job.submitted -
+                                   job.deadline)
+          : 0;
+  if (late > 0) {
+    metricsAdd(COUNTER_DEADLINE_MISSES);
+  }
+  (succeeded ? progress.completed : progress.failed)++;
+  progress.currentLine = outerLine;
+  state.running.pop_back();
+  metricsSet(GAUGE_QUEUE_ACTIVE, static_cast<int64_t>(state.running.size()));
+  reportProgress(config, progress);
+  cout << "[" << config.nodeId << "] Trabajo " << job.line << ": "
+       << (succeeded ? "correcto" : "fallido (" + reason + ")") << " en "
+       << elapsed << " ms" << (lost ? " (concesión perdida)" : "")
+       << (reused ? " (resultado de un trabajo idéntico)" : "");
+  if (late > 0) {
+    cout << " (plazo superado en " << late << " s)";
+  }
+  cout << "\n";
+  return ATTEMPT_SETTLED;
+}
+
+/**
+ * @brief Preemption point between the warp tiles of the running job.
+ *
+ * A few times per second, it looks for unclaimed jobs of strictly higher
+ * priority, including jobs just appended to the manifest, and runs them
+ * before the current image goes on. A job it runs can be preempted in turn
+ * by an even more urgent one.
+ */
+static void yieldToUrgentJobs(WorkerState &state) {
+  const auto now = chrono::steady_clock::now();
+  if (state.running.empty() ||
+      now - state.lastYield < chrono::milliseconds(200)) {
+    return;
+  }
+  state.lastYield = now;
+  refreshManifest(state);
+  const int current = state.running.back();
+  for (size_t k = 0; k < state.order.size(); ++k) {
+    const size_t index = state.order[k]; // order may grow meanwhile
+    if (state.jobs[index].priority <= current) {
+      break;
+    }
+    if (!state.settled[index]) {
+      attemptJob(state, index);
+    }
+  }
+}
+
+/**
+ * @brief Runs a batch worker over a shared queue directory.
+ *
+ * Any number of workers, on one machine or on several nodes mounting the
+ * same directory, can run the same manifest at once. Each one walks the
+ * jobs by urgency (-prioridad, then -plazo), and equally urgent jobs from
+ * its own starting point (a hash of its name, to spread the claims). It
+ * skips the jobs with a done or failed marker, and claims the rest one at a
+ * time with claimJob. While a job runs its claim is renewed by a
+ * LeaseHeartbeat, and when it ends a marker is written atomically and the
+ * claim is removed. Between the tiles of its warp, the job yields to more
+ * urgent jobs (yieldToUrgentJobs). Once every job is settled or held by a
+ * live worker, the worker waits and walks the jobs again, so the jobs of a
+ * worker that died are retaken when their lease runs out. It returns when
+ * every job has a marker.
+ *
+ * Jobs that would compute the same result (identicalKey) are coalesced:
+ * the first one claimed computes it, the others wait while it runs, and
+ * then hard-link its outputs under their own names (joinIdentical). Jobs
+ * that ask for a preview are never coalesced.
+ *
+ * Jobs run at least once: if a worker stalls for longer than the lease, its
+ * job may run a second time elsewhere, and outputs are simply rewritten.
+ *
+ * @param input The manifest, queue directory, worker name and lease.
+ * @return int Jobs this worker saw fail, or -1 if the manifest or the queue
+ * directory cannot be used.
+ */
+int runBatchWorker(const BatchConfig &input) {
+  WorkerState state;
+  state.config = resolveConfig(input);
+  const BatchConfig &config = state.config;
+  struct stat manifest;
+  if (stat(config.manifestPath.c_str(), &manifest) != 0 ||
+      !loadManifest(config.manifestPath, state.jobs)) {
+    cerr << "[ERROR] No se pudo leer el manifiesto " << config.manifestPath
+         << "\n";
+    return -1;
+  }
+  for (const char *kind :
+       {CLAIMS_DIR, DONE_DIR, FAILED_DIR, SUBMITTED_DIR, NODES_DIR,
+        JOURNAL_DIR, IDENTICAL_DIR}) {
+    if (!makeDirectories(config.queueDir + "/" + kind)) {
+      cerr << "[ERROR] No se pudo crear la cola en " << config.queueDir
+           << " (" << strerror(errno) << ")\n";
+      return -1;
+    }
+  }
+
+  NodeProgress &progress = state.progress;
+  progress.started = time(nullptr);
+  reportProgress(config, progress);
+  cout << "[INFO] Nodo " << config.nodeId << ": " << state.jobs.size()
+       << " trabajos, cola en " << config.queueDir << "\n";
+  resumeQueue(config);
+  state.journalPath = config.queueDir + "/" + JOURNAL_DIR + "/" + config.nodeId;
+  if (state.jobs.empty()) {
+    return 0;
+  }
+
+  state.tokenBase = config.nodeId + "." + to_string(getpid());
+  state.first = hash<string>()(config.nodeId) % state.jobs.size();
+  for (ManifestJob &job : state.jobs) {
+    recordSubmission(config.queueDir, job, manifest.st_mtime,
+                     state.tokenBase);
+  }
+  state.manifestSize = manifest.st_size;
+  state.settled.assign(state.jobs.size(), 0);
+  state.pending = state.jobs.size();
+  metricsSet(GAUGE_QUEUE_PENDING, static_cast<int64_t>(state.pending));
+  orderJobs(state);
+
+  const function<void()> yield = [&state]() { yieldToUrgentJobs(state); };
+  setTileYield(&yield);
+  const int pollSeconds = max(1, min(config.leaseSeconds / 4, 5));
+  for (;;) {
+    bool waiting = false;
+    for (size_t k = 0; k < state.order.size(); ++k) {
+      const size_t index = state.order[k];
+      if (state.settled[index]) {
+        continue;
+      }
+      const AttemptResult result = attemptJob(state, index);
+      if (result == ATTEMPT_ERROR) {
+        setTileYield(nullptr);
+        return -1;
+      }
+      waiting = waiting || result == ATTEMPT_HELD;
+    }
+    refreshManifest(state);
+    if (!waiting && state.pending == 0) {
+      break;
+    }
+    if (waiting) {
+      this_thread::sleep_for(chrono::seconds(pollSeconds));
+    }
+  }
+  setTileYield(nullptr);
+
+  cout << "[INFO] Nodo " << config.nodeId << " terminado: "
+       << progress.completed << " correctos, " << progress.failed
+       << " fallidos, " << progress.recovered << " recuperados\n";
+  return progress.failed;
+}
+
+/**
+ * @brief Prints how far a batch has got: job totals from the queue markers
+ * and the last progress report of every node.
+ *
+ * @param input The manifest and queue directory of the batch.
+ */
+void printBatchStatus(const BatchConfig &input) {
+  const BatchConfig config = resolveConfig(input);
+  vector<ManifestJob> jobs;
+  const bool haveManifest = loadManifest(config.manifestPath, jobs);
+
+  size_t done = 0, failed = 0, running = 0, expired = 0;
+  forEachMarker(config.queueDir, DONE_DIR, [&](const string &) { done++; });
+  forEachMarker(config.queueDir, FAILED_DIR,
+                [&](const string &) { failed++; });
+  const time_t now = time(nullptr);
+  forEachMarker(config.queueDir, CLAIMS_DIR, [&](const string &path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+      (now - info.st_mtime > config.leaseSeconds ? expired : running)++;
+    }
+  });
+
+  cout << "\033[32m+---------------------------+\n";
+  cout << "       ESTADO DEL LOTE      \n";
+  cout << "+---------------------------+\n";
+  cout << " Cola: " << config.queueDir << " \n";
+  if (haveManifest) {
+    cout << " Trabajos: " << jobs.size() << " \n";
+  }
+  cout << " Hechos: " << done << ", fallidos: " << failed
+       << ", en curso: " << running << ", caducados: " << expired << " \n";
+  if (haveManifest) {
+    const size_t settled = done + failed;
+    cout << " Pendientes: "
+         << (jobs.size() > settled ? jobs.size() - settled : 0) << " \n";
+  }
+  cout << "+---------------------------+\n";
+
+  const string nodesPath = config.queueDir + "/" + NODES_DIR;
+  DIR *nodes = opendir(nodesPath.c_str());
+  while (nodes) {
+    dirent *node = readdir(nodes);
+    if (!node) {
+      closedir(nodes);
+      break;
+    }
+    // Node names may contain dots, but not the temporary suffix
+    const string name = node->d_name;
+    string text;
+    if (name[0] == '.' || name.find(".tmp.") != string::npos ||
+        !readFileText(nodesPath + "/" + name, text)) {
+      continue;
+    }
+    istringstream fields(text);
+    string key;
+    long long value = 0, completed = 0, failures = 0, recovered = 0;
+    long long line = 0, updated = 0;
+    while (fields >> key) {
+      if (key == "nodo") {
+        getline(fields, key); // The name, already known from the file
+        continue;
+      }
+      fields >> value;
+      if (key == "completados") {
+        completed = value;
+      } else if (key == "fallidos") {
+        failures = value;
+      } else if (key == "recuperados") {
+        recovered = value;
+      } else if (key == "trabajo") {
+        line = value;
+      } else if (key == "actualizado") {
+        updated = value;
+      }
+    }
+    cout << " " << name << ": " << completed << " hechos, " << failures
+         << " fallidos, " << recovered << " recuperados, ";
+    if (line > 0) {
+      cout << "en el trabajo " << line;
+    } else {
+      cout << "sin trabajo";
+    }
+    cout << " (hace " << (now - updated) << " s)\n";
+  }
+  cout << "\033[0m";
+}
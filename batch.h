@@ -0,0 +1,23 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+
+// A batch worker: the manifest it runs and the shared queue directory used
+// to split the manifest's jobs between workers, on one or several nodes.
+struct BatchConfig {
+  std::string manifestPath; // One job per line, with the command-line flags
+  std::string queueDir;     // Claims and markers; empty uses "<manifest>.cola"
+  std::string nodeId;       // Worker name; empty uses "<host>-<pid>"
+  int leaseSeconds = 300;   // Claims not renewed for this long are retaken
+  bool showOutput = false;  // Print each job's processing report
+};
+
+// Runs the manifest's jobs that no live worker has claimed until none is
+// left. Returns the number of jobs this worker saw fail.
+int runBatchWorker(const BatchConfig &config);
+
+// Prints the queue totals and the progress reported by each node.
+void printBatchStatus(const BatchConfig &config);
+
+#endif // BATCH_H
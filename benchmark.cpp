@@ -1,11 +1,19 @@
 #include "buddy_memory.h"
+#include "cost_model.h"
 #include "image.h"
+#include "jpeg_codec.h"
+#include "tuning.h"
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 using namespace std;
@@ -175,6 +183,549 @@ runBenchmarks(const string &inputPath,
   return results;
 }
 
+/**
+ * @brief Compares the row-major and tiled source layouts across an angle
+ * sweep.
+ *
+ * Each angle is transformed once per layout with bilinear interpolation, and
+ * only the warp kernel time is recorded (decode and encode are the same for
+ * both layouts). The tiled run includes the one-pass conversion to tiles.
+ *
+ * @param inputPath The file path to the input image to be transformed.
+ * @param scaleFactor The scaling factor applied at every angle.
+ * @param tileSize Tile side in pixels for the tiled layout.
+ * @return A vector of PerformanceResult objects, one per angle and layout.
+ */
+vector<PerformanceResult> runLayoutSweep(const string &inputPath,
+                                         float scaleFactor, int tileSize) {
+  vector<PerformanceResult> results;
+  const int angles[] = {0, 15, 30, 45, 60, 75, 90, 135, 180, 270};
+
+  for (int angle : angles) {
+    for (PixelLayout layout : {LAYOUT_ROWS, LAYOUT_TILED}) {
+      TransformOptions options;
+      options.interpolation = INTERP_BILINEAR;
+      options.layout = layout;
+      options.tileSize = tileSize;
+
+      Image img;
+      string outputPath = "../output/barrido_" + to_string(angle) +
+                          (layout == LAYOUT_TILED ? "_teselas.jpg" : ".jpg");
+      img.transformImage(inputPath, outputPath, angle, scaleFactor, false,
+                         false, options);
+
+      results.push_back({layout == LAYOUT_TILED ? "Tesela" : "Fila", angle,
+                         scaleFactor, img.getWidth(), img.getHeight(), 0,
+                         img.getLastWarpMs(), 0});
+    }
+  }
+
+  return results;
+}
+
+/**
+ * @brief Prints the average warp speedup of the tiled layout over rows.
+ */
+void printLayoutSummary(const vector<PerformanceResult> &results) {
+  double rowsMs = 0, tiledMs = 0;
+  for (const auto &result : results) {
+    if (result.method == "Fila") {
+      rowsMs += result.processingTimeMs;
+    } else if (result.method == "Tesela") {
+      tiledMs += result.processingTimeMs;
+    }
+  }
+  if (rowsMs > 0 && tiledMs > 0) {
+    cout << "\033[1;34mAceleración del warp con teselas: " << fixed
+         << setprecision(2) << rowsMs / tiledMs << "x\n\033[0m";
+  }
+}
+
+/**
+ * @brief Compares packed RGB and padded RGBX warps across an angle sweep.
+ *
+ * Each angle is transformed with both filters, once per layout. Only the
+ * warp time is recorded; for RGBX it includes widening the source and
+ * packing the result back to RGB, so the comparison is the net effect.
+ *
+ * @param inputPath The file path to the input image to be transformed.
+ * @param scaleFactor The scaling factor applied at every angle.
+ * @return A vector of PerformanceResult objects, one per angle, filter and
+ *         layout.
+ */
+vector<PerformanceResult> runPaddingSweep(const string &inputPath,
+                                          float scaleFactor) {
+  vector<PerformanceResult> results;
+  const int angles[] = {0, 15, 30, 45, 60, 75, 90, 135, 180, 270};
+
+  for (int angle : angles) {
+    for (Interpolation interpolation : {INTERP_NEAREST, INTERP_BILINEAR}) {
+      for (bool padded : {false, true}) {
+        TransformOptions options;
+        options.interpolation = interpolation;
+        options.paddedRgb = padded;
+
+        Image img;
+        string outputPath = "../output/rgbx_" + to_string(angle) +
+                            (padded ? "_rgbx.jpg" : "_rgb.jpg");
+        img.transformImage(inputPath, outputPath, angle, scaleFactor, false,
+                           false, options);
+
+        string method = padded ? "RGBX" : "RGB";
+        method += interpolation == INTERP_BILINEAR ? "-B" : "-V";
+        results.push_back({method, angle, scaleFactor, img.getWidth(),
+                           img.getHeight(), 0, img.getLastWarpMs(), 0});
+      }
+    }
+  }
+
+  return results;
+}
+
+/**
+ * @brief Prints the warp speedup of RGBX over packed RGB for each filter.
+ */
+void printPaddingSummary(const vector<PerformanceResult> &results) {
+  for (const char *filter : {"-V", "-B"}) {
+    double packedMs = 0, paddedMs = 0;
+    for (const auto &result : results) {
+      if (result.method == string("RGB") + filter) {
+        packedMs += result.processingTimeMs;
+      } else if (result.method == string("RGBX") + filter) {
+        paddedMs += result.processingTimeMs;
+      }
+    }
+    if (packedMs > 0 && paddedMs > 0) {
+      cout << "\033[1;34mAceleración del warp con RGBX ("
+           << (filter[1] == 'B' ? "bilineal" : "vecino") << "): " << fixed
+           << setprecision(2) << packedMs / paddedMs << "x\n\033[0m";
+    }
+  }
+}
+
+/**
+ * @brief Runs one transform in a child process and measures it.
+ *
+ * A fresh process makes the peak resident set (ru_maxrss, from wait4) the
+ * peak of this transform alone, as it would be for a single job.
+ *
+ * @param sample Receives the total and warp times and the peak memory.
+ * @return bool Whether the child ran the transform.
+ */
+static bool measureTransform(const string &inputPath, int angle,
+                             float scaleFactor,
+                             const TransformOptions &options,
+                             CostSample &sample) {
+  int pipeFds[2];
+  if (pipe(pipeFds) != 0) {
+    return false;
+  }
+  const pid_t child = fork();
+  if (child < 0) {
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    return false;
+  }
+  if (child == 0) {
+    close(pipeFds[0]);
+    auto start = chrono::high_resolution_clock::now();
+    Image img;
+    const bool written =
+        img.transformImage(inputPath, "../output/calibracion.jpg", angle,
+                           scaleFactor, false, false, options);
+    const double times[2] = {
+        chrono::duration<double, milli>(chrono::high_resolution_clock::now() -
+                                        start)
+            .count(),
+        img.getLastWarpMs()};
+    if (written) {
+      const ssize_t sent = write(pipeFds[1], times, sizeof(times));
+      (void)sent;
+    }
+    _exit(written ? 0 : 1);
+  }
+  close(pipeFds[1]);
+  double times[2];
+  const bool received = read(pipeFds[0], times, sizeof(times)) ==
+                        static_cast<ssize_t>(sizeof(times));
+  close(pipeFds[0]);
+  int status = 0;
+  struct rusage usage;
+  if (wait4(child, &status, 0, &usage) != child || !received ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return false;
+  }
+  sample.totalMs = times[0];
+  sample.warpMs = times[1];
+  sample.peakMB = usage.ru_maxrss / 1024.0; // Convert KB to MB
+  return true;
+}
+
+/**
+ * @brief Calibrates the cost model on the input image and saves it.
+ *
+ * The sweep covers both filters at several angles and scales on the pixel
+ * path, the right angles done in the DCT domain (for JPEG inputs) and, on
+ * machines with several cores, a one-thread decode to size the parallel
+ * share. The fitted model's error is then printed for every run.
+ *
+ * @param inputPath The image to calibrate on.
+ * @param modelPath The model file to write.
+ * @return bool Whether the model was written.
+ */
+bool runCostCalibration(const string &inputPath, const string &modelPath) {
+  struct Run {
+    int angle;
+    float scaleFactor;
+    TransformOptions options;
+  };
+  vector<Run> runs;
+  for (Interpolation interpolation : {INTERP_NEAREST, INTERP_BILINEAR}) {
+    for (int angle : {10, 30, 45, 90}) {
+      for (float scaleFactor : {0.5f, 1.0f, 1.5f}) {
+        TransformOptions options;
+        options.interpolation = interpolation;
+        options.allowLossless = false;
+        runs.push_back({angle, scaleFactor, options});
+      }
+    }
+  }
+  const bool jpeg = isJpegFile(inputPath);
+  if (jpeg) {
+    for (int angle : {90, 180, 270}) {
+      runs.push_back({angle, 1.0f, TransformOptions()});
+    }
+  }
+  if (jpeg && thread::hardware_concurrency() > 1) {
+    for (Interpolation interpolation : {INTERP_NEAREST, INTERP_BILINEAR}) {
+      TransformOptions options;
+      options.interpolation = interpolation;
+      options.allowLossless = false;
+      options.threads = 1;
+      runs.push_back({30, 1.0f, options});
+    }
+  }
+
+  vector<CostSample> samples;
+  for (const Run &run : runs) {
+    CostSample sample;
+    if (!readCostQuery(inputPath, "../output/calibracion.jpg", run.angle,
+                       run.scaleFactor, run.options, sample.query) ||
+        !measureTransform(inputPath, run.angle, run.scaleFactor, run.options,
+                          sample)) {
+      cerr << "[ERROR] No se pudo medir " << inputPath << " a " << run.angle
+           << " grados\n";
+      return false;
+    }
+    samples.push_back(sample);
+  }
+  const CostModel model = fitCostModel(samples, CostModel());
+
+  cout << "\033[1;34m\n+------------------------------------------------"
+          "----------------------+\n";
+  cout << "| Grados | Escala | Ruta     | Real (ms) | Error  | Real (MB) | "
+          "Error  |\n";
+  cout << "+------------------------------------------------------------"
+          "----------+\n";
+  double timeError = 0, memoryError = 0;
+  for (const CostSample &sample : samples) {
+    const CostEstimate estimate = model.predict(sample.query);
+    const double timeOff =
+        costErrorPercent(estimate.milliseconds, sample.totalMs);
+    const double memoryOff = costErrorPercent(estimate.peakMB, sample.peakMB);
+    timeError += fabs(timeOff);
+    memoryError += fabs(memoryOff);
+    const char *path = sample.query.lossless ? "DCT"
+                       : sample.query.interpolation == INTERP_BILINEAR
+                           ? "Bilineal"
+                           : "Vecino";
+    cout << "| " << setw(6) << right << sample.query.angle << " | " << setw(6)
+         << fixed << setprecision(2) << sample.query.scaleFactor << " | "
+         << setw(8) << left << path << " | " << setw(9) << right
+         << setprecision(1) << sample.totalMs << " | " << setw(5)
+         << showpos << timeOff << noshowpos << "% | " << setw(9)
+         << sample.peakMB << " | " << setw(5) << showpos << memoryOff
+         << noshowpos << "% |\n";
+  }
+  cout << "+------------------------------------------------------------"
+          "----------+\n";
+  cout << "Error medio del modelo: " << fixed << setprecision(1)
+       << timeError / samples.size() << "% en tiempo, "
+       << memoryError / samples.size() << "% en memoria\n\033[0m";
+
+  if (!model.save(modelPath)) {
+    cerr << "[ERROR] No se pudo escribir el modelo en " << modelPath << "\n";
+    return false;
+  }
+  cout << "[INFO] Modelo de coste guardado en " << modelPath << "\n";
+  return true;
+}
+
+/**
+ * @brief Time of one transform of the input, best of `repeats` runs.
+ *
+ * @param warpOnly Whether to time the warp kernel alone rather than the
+ * whole transform.
+ */
+static double timeTransform(const string &inputPath, int angle,
+                            const TransformOptions &options, bool warpOnly,
+                            int repeats) {
+  double best = 0;
+  for (int r = 0; r < repeats; ++r) {
+    auto start = chrono::high_resolution_clock::now();
+    Image img;
+    img.transformImage(inputPath, "../output/ajuste.jpg", angle, 1.0f, false,
+                       false, options);
+    const double ms =
+        warpOnly ? img.getLastWarpMs()
+                 : chrono::duration<double, milli>(
+                       chrono::high_resolution_clock::now() - start)
+                       .count();
+    best = r == 0 ? ms : min(best, ms);
+  }
+  return best;
+}
+
+/**
+ * @brief Benchmarks the warp kernel variants for one filter and returns
+ * the fastest.
+ *
+ * Every variant, rows or tiles of 8 to 64 pixels, packed or RGBX, warps
+ * the image at 15, 45 and 75 degrees; the lowest total warp time wins.
+ */
+static KernelChoice tuneKernel(const string &inputPath,
+                               Interpolation interpolation, int threads) {
+  vector<KernelChoice> candidates;
+  for (bool padded : {false, true}) {
+    KernelChoice rows;
+    rows.paddedRgb = padded;
+    candidates.push_back(rows);
+    for (int tileSize : {8, 16, 32, 64}) {
+      KernelChoice tiled;
+      tiled.layout = LAYOUT_TILED;
+      tiled.tileSize = tileSize;
+      tiled.paddedRgb = padded;
+      candidates.push_back(tiled);
+    }
+  }
+
+  KernelChoice best;
+  double bestMs = 0;
+  for (const KernelChoice &candidate : candidates) {
+    TransformOptions options;
+    options.interpolation = interpolation;
+    options.layout = candidate.layout;
+    options.tileSize = candidate.tileSize;
+    options.paddedRgb = candidate.paddedRgb;
+    options.threads = threads;
+    double ms = 0;
+    for (int angle : {15, 45, 75}) {
+      ms += timeTransform(inputPath, angle, options, true, 1);
+    }
+    cout << "  " << setw(9) << left
+         << (interpolation == INTERP_BILINEAR ? "Bilineal" : "Vecino")
+         << setw(16) << formatKernelChoice(candidate) << right << setw(10)
+         << fixed << setprecision(1) << ms << " ms\n";
+    if (bestMs == 0 || ms < bestMs) {
+      best = candidate;
+      bestMs = ms;
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief Finds the fastest decode thread count and warp kernel variants on
+ * this host and stores them in the profile file under the CPU model.
+ *
+ * Thread counts are timed on whole transforms, since they only affect the
+ * JPEG decode, and only when the decode can use them: a JPEG with restart
+ * markers and at least 3 threads. The candidates are 1 (stb_image), powers
+ * of two from 4 up to the core count, and the core count. Otherwise the
+ * profile leaves the thread count to each job.
+ * The kernel variants are then timed on the warp alone with the winning
+ * thread count, once per filter, as RGBX pays off for bilinear but not
+ * always for nearest neighbour.
+ *
+ * @param inputPath The image to tune on, ideally a typical input.
+ * @param profilePath The profile file to update.
+ * @return bool Whether the profile was written.
+ */
+bool runAutoTune(const string &inputPath, const string &profilePath) {
+  TuningProfile profile;
+  profile.cpu = cpuModel();
+  cout << "\033[1;34mAjustando para " << profile.cpu << "\n";
+
+  const int cores = max(1, static_cast<int>(thread::hardware_concurrency()));
+  vector<int> threadCounts;
+  if (!jpegUsesRestartMarkers(inputPath)) {
+    cout << "  Hilos: la imagen no tiene marcadores de reinicio, no se "
+            "ajustan\n";
+  } else if (cores < MIN_DECODE_THREADS) {
+    cout << "  Hilos: menos de " << MIN_DECODE_THREADS
+         << " núcleos, no se ajustan\n";
+  } else {
+    threadCounts.push_back(1);
+    for (int threads = 4; threads < cores; threads *= 2) {
+      threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(cores);
+  }
+  double bestMs = 0;
+  for (int threads : threadCounts) {
+    TransformOptions options;
+    options.allowLossless = false;
+    options.threads = threads;
+    const double ms = timeTransform(inputPath, 30, options, false, 2);
+    cout << "  Hilos " << setw(18) << left << threads << right << setw(10)
+         << fixed << setprecision(1) << ms << " ms\n";
+    if (bestMs == 0 || ms < bestMs) {
+      profile.threads = threads;
+      bestMs = ms;
+    }
+  }
+
+  if (profile.threads > 0 && profile.threads < MIN_DECODE_THREADS) {
+    cout << "  Con " << profile.threads
+         << " hilo los trabajos no usan el decodificador multihilo\n";
+  }
+
+  profile.nearest = tuneKernel(inputPath, INTERP_NEAREST, profile.threads);
+  profile.bilinear = tuneKernel(inputPath, INTERP_BILINEAR, profile.threads);
+  cout << "Perfil: "
+       << (profile.threads > 0 ? to_string(profile.threads)
+                               : string("sin ajuste de"))
+       << " hilos, vecino "
+       << formatKernelChoice(profile.nearest) << ", bilineal "
+       << formatKernelChoice(profile.bilinear) << "\n\033[0m";
+
+  if (!saveTuningProfile(profilePath, profile)) {
+    cerr << "[ERROR] No se pudo escribir el perfil en " << profilePath
+         << "\n";
+    return false;
+  }
+  cout << "[INFO] Perfil de ajuste guardado en " << profilePath << "\n";
+  return true;
+}
+
+/**
+ * @brief PSNR of a JPEG file against the pixels it was encoded from, after
+ * decoding it with stb_image.
+ *
+ * @return double The PSNR in dB, infinity for identical pixels, or -1 when
+ * the file cannot be decoded at the same size.
+ */
+static double jpegPsnr(const string &path, const unsigned char *original,
+                       int width, int height, int channels) {
+  int decodedWidth = 0, decodedHeight = 0, fileChannels = 0;
+  unsigned char *decoded = stbi_load(path.c_str(), &decodedWidth,
+                                     &decodedHeight, &fileChannels, channels);
+  if (!decoded || decodedWidth != width || decodedHeight != height) {
+    stbi_image_free(decoded);
+    return -1;
+  }
+  const size_t samples = static_cast<size_t>(width) * height * channels;
+  double squared = 0;
+  for (size_t i = 0; i < samples; ++i) {
+    const double difference = static_cast<double>(decoded[i]) - original[i];
+    squared += difference * difference;
+  }
+  stbi_image_free(decoded);
+  return squared == 0 ? INFINITY
+                      : 10.0 * log10(255.0 * 255.0 * samples / squared);
+}
+
+/**
+ * @brief Compares the built-in JPEG encoder (writeJpegPixels) with
+ * stbi_write_jpg on the pixels of the input.
+ *
+ * At qualities 50, 75, 90 and 100, both encoders write the same gray or
+ * RGB pixels. Each file is decoded again with stb_image and compared with
+ * those pixels. The table lists the time of each encoder (best of 3 runs),
+ * the size of the built-in encoder's file relative to stb's, and the PSNR
+ * of both.
+ *
+ * @param inputPath The image to encode.
+ * @return bool Whether every file could be written and decoded.
+ */
+bool runEncoderComparison(const string &inputPath) {
+  int width = 0, height = 0, fileChannels = 0;
+  if (!stbi_info(inputPath.c_str(), &width, &height, &fileChannels)) {
+    cerr << "[ERROR] No se pudo leer " << inputPath << "\n";
+    return false;
+  }
+  // JPEG has no alpha, so both encoders get the colour channels only
+  const int channels = fileChannels <= 2 ? 1 : 3;
+  unsigned char *pixels = stbi_load(inputPath.c_str(), &width, &height,
+                                    &fileChannels, channels);
+  if (!pixels) {
+    cerr << "[ERROR] No se pudo leer " << inputPath << "\n";
+    return false;
+  }
+
+  const string stbPath = "../output/codificador_stb.jpg";
+  const string ownPath = "../output/codificador_propio.jpg";
+  auto bestOf = [](const function<bool()> &encode, double &ms) {
+    ms = 0;
+    for (int r = 0; r < 3; ++r) {
+      auto start = chrono::high_resolution_clock::now();
+      if (!encode()) {
+        return false;
+      }
+      const double elapsed = chrono::duration<double, milli>(
+                                 chrono::high_resolution_clock::now() - start)
+                                 .count();
+      ms = r == 0 ? elapsed : min(ms, elapsed);
+    }
+    return true;
+  };
+  auto fileSize = [](const string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<double>(info.st_size)
+                                          : 0.0;
+  };
+
+  const string border = "+" + string(68, '-') + "+\n";
+  cout << "\033[1;34m\n" << border;
+  cout << "| Calidad | stb (ms) | Propio (ms) | Tamaño | PSNR stb | "
+          "PSNR propio |\n"
+       << border;
+  bool ok = true;
+  for (int quality : {50, 75, 90, 100}) {
+    string error;
+    double stbMs = 0, ownMs = 0;
+    ok = bestOf(
+             [&]() {
+               return stbi_write_jpg(stbPath.c_str(), width, height, channels,
+                                     pixels, quality) != 0;
+             },
+             stbMs) &&
+         bestOf(
+             [&]() {
+               return writeJpegPixels(ownPath, pixels, width, height,
+                                      channels, quality, error);
+             },
+             ownMs);
+    const double stbPsnr = jpegPsnr(stbPath, pixels, width, height, channels);
+    const double ownPsnr = jpegPsnr(ownPath, pixels, width, height, channels);
+    if (!ok || stbPsnr < 0 || ownPsnr < 0) {
+      cerr << "[ERROR] No se pudo codificar a calidad " << quality
+           << (error.empty() ? "" : " (" + error + ")") << "\n";
+      ok = false;
+      break;
+    }
+    cout << "| " << setw(7) << right << quality << " | " << setw(8) << fixed
+         << setprecision(1) << stbMs << " | " << setw(11) << ownMs << " | "
+         << setw(5) << setprecision(3)
+         << fileSize(ownPath) / fileSize(stbPath) << "x | " << setw(8)
+         << setprecision(2) << stbPsnr << " | " << setw(11) << ownPsnr
+         << " |\n";
+  }
+  cout << border << "\033[0m";
+  stbi_image_free(pixels);
+  return ok;
+}
+
 /**
  * @brief Entry point for the performance benchmarking application.
  *
@@ -185,6 +736,17 @@ runBenchmarks(const string &inputPath,
  *
  * @param argc The number of command line arguments.
  * @param argv The array of command line arguments.
+ *        - "-barrido <n>": Compares row-major and n x n tiled layouts across
+ *          an angle sweep instead of the buddy benchmark.
+ *        - "-rgbx": Compares packed RGB and padded RGBX warps across an
+ *          angle sweep instead of the buddy benchmark.
+ *        - "-calibrar <archivo>": Fits the cost model to a sweep of
+ *          transforms of the input and writes it to the file.
+ *        - "-autoajuste <archivo>": Finds the fastest thread count and
+ *          warp kernel variants on this host and stores them in the
+ *          profile file.
+ *        - "-codificador": Compares the built-in JPEG encoder with
+ *          stbi_write_jpg in time, size and PSNR at several qualities.
  * @return int Returns 0 on successful execution.
  */
 int main(int argc, char *argv[]) {
@@ -192,6 +754,11 @@ int main(int argc, char *argv[]) {
   string inputPath = "../imgs/fish.jpg";
   int angulo = 0;
   float escalar = 1.0f;
+  int teselas = 0;
+  bool rgbx = false;
+  bool encoder = false;
+  string modelPath;
+  string profilePath;
 
   for (int i = 1; i < argc; ++i) {
     if (strcmp(argv[i], "-entrada") == 0 && i + 1 < argc) {
@@ -200,6 +767,16 @@ int main(int argc, char *argv[]) {
       angulo = stoi(argv[i + 1]);
     } else if (strcmp(argv[i], "-escalar") == 0 && i + 1 < argc) {
       escalar = stof(argv[i + 1]);
+    } else if (strcmp(argv[i], "-barrido") == 0 && i + 1 < argc) {
+      teselas = stoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-calibrar") == 0 && i + 1 < argc) {
+      modelPath = argv[i + 1];
+    } else if (strcmp(argv[i], "-autoajuste") == 0 && i + 1 < argc) {
+      profilePath = argv[i + 1];
+    } else if (strcmp(argv[i], "-rgbx") == 0) {
+      rgbx = true;
+    } else if (strcmp(argv[i], "-codificador") == 0) {
+      encoder = true;
     }
   }
 
@@ -207,6 +784,37 @@ int main(int argc, char *argv[]) {
   cout << "\033[1;33mEjecutando prueba de rendimiento con entrada: \033[0m"
        << inputPath << "\033[1;33m\n...\033[0m" << endl;
 
+  if (teselas > 0) {
+    // Layout sweep: row-major vs tiled source across angles
+    auto sweep = runLayoutSweep(inputPath, escalar, teselas);
+    printPerformanceTable(sweep);
+    printLayoutSummary(sweep);
+    return 0;
+  }
+
+  if (!modelPath.empty()) {
+    // Cost model: fit time and memory to a sweep of this image
+    return runCostCalibration(inputPath, modelPath) ? 0 : 1;
+  }
+
+  if (!profilePath.empty()) {
+    // Auto-tuning: fastest threads and kernels on this host
+    return runAutoTune(inputPath, profilePath) ? 0 : 1;
+  }
+
+  if (encoder) {
+    // JPEG encoders: built-in vs stbi_write_jpg on the same pixels
+    return runEncoderComparison(inputPath) ? 0 : 1;
+  }
+
+  if (rgbx) {
+    // Padding sweep: packed RGB vs RGBX across angles and filters
+    auto sweep = runPaddingSweep(inputPath, escalar);
+    printPerformanceTable(sweep);
+    printPaddingSummary(sweep);
+    return 0;
+  }
+
   // Benchmark test cases
   vector<pair<int, float>> transformParams = {
       {angulo, escalar},
@@ -24,4 +24,19 @@ std::vector<PerformanceResult>
 runBenchmarks(const std::string &inputPath,
               const std::vector<std::pair<int, float>> &transformParams);
 
+// Function to compare row-major and tiled layouts across an angle sweep
+std::vector<PerformanceResult> runLayoutSweep(const std::string &inputPath,
+                                              float scaleFactor, int tileSize);
+
+// Function to fit the cost model to a sweep of transforms and save it
+bool runCostCalibration(const std::string &inputPath,
+                        const std::string &modelPath);
+
+// Function to store the fastest threads and kernels of this host in a profile
+bool runAutoTune(const std::string &inputPath,
+                 const std::string &profilePath);
+
+// Function to compare the built-in JPEG encoder with stbi_write_jpg
+bool runEncoderComparison(const std::string &inputPath);
+
 #endif // BENCHMARK_H
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include "cost_model.h"
+#include "jpeg_codec.h"
+#include <algorithm>
+#include <cmath>
+#include <eigen3/Eigen/Dense>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+// Coefficients as named in the model file, one "<name> <value>" per line.
+static const struct {
+  const char *name;
+  double CostModel::*field;
+} COST_FIELDS[] = {
+    {"fixed_ms", &CostModel::fixedMs},
+    {"decode_ms", &CostModel::decodeMs},
+    {"parallel_fraction", &CostModel::parallelFraction},
+    {"warp_nearest_ms", &CostModel::warpNearestMs},
+    {"warp_bilinear_ms", &CostModel::warpBilinearMs},
+    {"encode_ms", &CostModel::encodeMs},
+    {"lossless_ms", &CostModel::losslessMs},
+    {"base_mb", &CostModel::baseMB},
+    {"pixel_factor", &CostModel::pixelFactor},
+    {"lossless_factor", &CostModel::losslessFactor},
+};
+
+/**
+ * @brief Reads the coefficients of a model file. Missing coefficients keep
+ * their current values and unknown names are ignored.
+ *
+ * @param path The model file, as written by save.
+ * @return bool Whether the file could be read.
+ */
+bool CostModel::load(const string &path) {
+  ifstream file(path);
+  if (!file) {
+    return false;
+  }
+  string line;
+  while (getline(file, line)) {
+    istringstream fields(line);
+    string name;
+    double value;
+    if (!(fields >> name >> value) || name[0] == '#') {
+      continue;
+    }
+    for (const auto &field : COST_FIELDS) {
+      if (name == field.name) {
+        this->*field.field = value;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Writes every coefficient to a model file.
+ */
+bool CostModel::save(const string &path) const {
+  ofstream file(path, ios::trunc);
+  file << "# Modelo de coste (Benchmark -calibrar)\n";
+  for (const auto &field : COST_FIELDS) {
+    file << field.name << " " << this->*field.field << "\n";
+  }
+  return static_cast<bool>(file.flush());
+}
+
+// Sizes the model is linear in.
+struct CostFeatures {
+  double inputSamples;  // Millions of decoded source samples
+  double outputSamples; // Millions of output samples
+  double inputMB;       // Decoded source pixels
+  double outputMB;      // Output pixels
+  double decodeShare;   // Decode time on `threads` over time on one
+};
+
+static CostFeatures costFeatures(const CostQuery &query,
+                                 double parallelFraction, int &outputWidth,
+                                 int &outputHeight) {
+  computeCanvasSize(query.width, query.height, query.scaleFactor, query.angle,
+                    query.canvas, outputWidth, outputHeight);
+  const double sampleBytes = static_cast<double>(query.depth);
+  CostFeatures features;
+  features.inputSamples =
+      static_cast<double>(query.width) * query.height * query.channels / 1e6;
+  features.outputSamples = static_cast<double>(outputWidth) * outputHeight *
+                           query.channels / 1e6;
+  features.inputMB = features.inputSamples * 1e6 * sampleBytes / 1048576.0;
+  features.outputMB = features.outputSamples * 1e6 * sampleBytes / 1048576.0;
+  features.decodeShare =
+      query.jpeg && query.threads > 1
+          ? (1.0 - parallelFraction) + parallelFraction / query.threads
+          : 1.0;
+  return features;
+}
+
+/**
+ * @brief Predicts the time and peak memory of a transform.
+ *
+ * Pixel-path jobs cost a fixed overhead, a decode proportional to the
+ * source samples (the JPEG share split across threads by Amdahl's law), a
+ * warp proportional to the output samples at the filter's rate and an
+ * encode proportional to the output samples. Their peak memory is the
+ * process baseline plus the source and output buffers. DCT-domain jobs
+ * scale with the source alone.
+ *
+ * @param query The transform, as described by readCostQuery.
+ * @return CostEstimate Predicted time, memory and output size.
+ */
+CostEstimate CostModel::predict(const CostQuery &query) const {
+  CostEstimate estimate;
+  const CostFeatures features =
+      costFeatures(query, parallelFraction, estimate.outputWidth,
+                   estimate.outputHeight);
+  if (query.lossless) {
+    estimate.milliseconds = fixedMs + losslessMs * features.inputSamples;
+    estimate.peakMB = baseMB + losslessFactor * features.inputMB;
+    return estimate;
+  }
+  const double warpMs =
+      query.interpolation == INTERP_BILINEAR ? warpBilinearMs : warpNearestMs;
+  estimate.milliseconds =
+      fixedMs + decodeMs * features.inputSamples * features.decodeShare +
+      (warpMs + encodeMs) * features.outputSamples;
+  estimate.peakMB =
+      baseMB + pixelFactor * (features.inputMB + features.outputMB);
+  return estimate;
+}
+
+/**
+ * @brief Describes a transform for the cost model from the input file's
+ * header, without decoding it.
+ *
+ * The DCT-domain path is predicted with the same checks transformImage
+ * makes before reading the coefficients; a JPEG whose size is not a whole
+ * number of MCUs still falls back to the pixel path when run.
+ *
+ * @param inputPath The image to transform.
+ * @param outputPath Its output, whose extension picks the encoder.
+ * @param query Receives the description.
+ * @return bool Whether the header could be read and the crop, if any,
+ * overlaps the image.
+ */
+bool readCostQuery(const string &inputPath, const string &outputPath,
+                   int angle, float scaleFactor,
+                   const TransformOptions &options, CostQuery &query) {
+  int width = 0, height = 0, fileChannels = 0;
+  if (!stbi_info(inputPath.c_str(), &width, &height, &fileChannels)) {
+    return false;
+  }
+  query.jpeg = isJpegFile(inputPath);
+  if (options.crop.width > 0 && options.crop.height > 0) {
+    // Clipped to the image as Image::cropImage does
+    width = min(options.crop.x + options.crop.width, width) -
+            max(0, options.crop.x);
+    height = min(options.crop.y + options.crop.height, height) -
+             max(0, options.crop.y);
+    if (width <= 0 || height <= 0) {
+      return false;
+    }
+  }
+  if (query.jpeg && options.autoOrient &&
+      readJpegOrientation(inputPath) >= 5) {
+    swap(width, height); // Orientations 5-8 turn the image a quarter
+  }
+  query.width = width;
+  query.height = height;
+  query.channels =
+      options.desiredChannels > 0 ? options.desiredChannels : fileChannels;
+  query.depth = options.depth != DEPTH_AUTO ? options.depth
+                : stbi_is_hdr(inputPath.c_str())     ? DEPTH_FLOAT
+                : stbi_is_16_bit(inputPath.c_str())  ? DEPTH_16
+                                                     : DEPTH_8;
+  query.angle = ((angle % 360) + 360) % 360;
+  query.scaleFactor = scaleFactor;
+  query.interpolation = options.interpolation;
+  query.canvas = options.canvas;
+  query.threads =
+      options.threads > 0
+          ? options.threads
+          : max(1, static_cast<int>(thread::hardware_concurrency()));
+
+  // The original-frame canvas crops when the axes swap on a non-square image
+  const bool cropsCanvas = options.canvas == CANVAS_ORIGINAL &&
+                           query.angle % 180 != 0 && width != height;
+  query.lossless = query.jpeg && options.allowLossless &&
+                   scaleFactor == 1.0f && query.angle % 90 == 0 &&
+                   options.desiredChannels == 0 &&
+                   (options.depth == DEPTH_8 || options.depth == DEPTH_AUTO) &&
+                   !hasExtension(outputPath, ".png") &&
+                   !hasExtension(outputPath, ".hdr") && !cropsCanvas;
+  return true;
+}
+
+/**
+ * @brief Fits the pixel-path time terms (fixed, decode, encode) to the
+ * samples' time outside the warp, for a given parallel fraction.
+ *
+ * @return double Sum of squared residuals.
+ */
+static double fitPixelTime(const vector<const CostSample *> &samples,
+                           double parallelFraction, CostModel &model) {
+  Eigen::MatrixXd terms(samples.size(), 3);
+  Eigen::VectorXd times(samples.size());
+  for (size_t i = 0; i < samples.size(); ++i) {
+    int outputWidth, outputHeight;
+    const CostFeatures features = costFeatures(
+        samples[i]->query, parallelFraction, outputWidth, outputHeight);
+    terms(i, 0) = 1.0;
+    terms(i, 1) = features.inputSamples * features.decodeShare;
+    terms(i, 2) = features.outputSamples;
+    times(i) = samples[i]->totalMs - samples[i]->warpMs;
+  }
+  const Eigen::VectorXd fit = terms.colPivHouseholderQr().solve(times);
+  model.fixedMs = max(0.0, fit(0));
+  model.decodeMs = max(0.0, fit(1));
+  model.encodeMs = max(0.0, fit(2));
+  model.parallelFraction = parallelFraction;
+  return (terms * fit - times).squaredNorm();
+}
+
+/**
+ * @brief Slope through the origin of y over x, by least squares.
+ *
+ * @param fallback Returned when there are no samples.
+ */
+static double fitSlope(const vector<pair<double, double>> &points,
+                       double fallback) {
+  double xy = 0, xx = 0;
+  for (const auto &point : points) {
+    xy += point.first * point.second;
+    xx += point.first * point.first;
+  }
+  return xx > 0 ? max(0.0, xy / xx) : fallback;
+}
+
+/**
+ * @brief Fits the model to the runs of a calibration sweep.
+ *
+ * The warp rate of each filter is fitted to the measured warp times alone.
+ * The remaining pixel-path time is fitted by least squares, trying
+ * parallel fractions in steps of 5% when the runs used different thread
+ * counts. Memory is fitted to each run's peak resident set.
+ *
+ * @param samples Measured runs.
+ * @param base Model whose coefficients are kept when the runs cannot
+ * determine them.
+ * @return CostModel The fitted model.
+ */
+CostModel fitCostModel(const vector<CostSample> &samples,
+                       const CostModel &base) {
+  CostModel model = base;
+  vector<const CostSample *> pixel;
+  vector<pair<double, double>> nearest, bilinear, memory;
+  bool threadCounts = false;
+  for (const CostSample &sample : samples) {
+    if (sample.query.lossless) {
+      continue;
+    }
+    int outputWidth, outputHeight;
+    const CostFeatures features =
+        costFeatures(sample.query, 0, outputWidth, outputHeight);
+    (sample.query.interpolation == INTERP_BILINEAR ? bilinear : nearest)
+        .emplace_back(features.outputSamples, sample.warpMs);
+    memory.emplace_back(features.inputMB + features.outputMB, sample.peakMB);
+    threadCounts = threadCounts || (sample.query.jpeg && !pixel.empty() &&
+                                    sample.query.threads !=
+                                        pixel.front()->query.threads);
+    pixel.push_back(&sample);
+  }
+  model.warpNearestMs = fitSlope(nearest, base.warpNearestMs);
+  model.warpBilinearMs = fitSlope(bilinear, base.warpBilinearMs);
+
+  if (pixel.size() >= 3) {
+    double best = fitPixelTime(pixel, base.parallelFraction, model);
+    if (threadCounts) {
+      for (int step = 0; step <= 20; ++step) {
+        CostModel candidate = model;
+        const double error = fitPixelTime(pixel, step / 20.0, candidate);
+        if (error < best) {
+          best = error;
+          model = candidate;
+        }
+      }
+    }
+  }
+  if (memory.size() >= 2) {
+    Eigen::MatrixXd terms(memory.size(), 2);
+    Eigen::VectorXd peaks(memory.size());
+    for (size_t i = 0; i < memory.size(); ++i) {
+      terms(i, 0) = 1.0;
+      terms(i, 1) = memory[i].first;
+      peaks(i) = memory[i].second;
+    }
+    const Eigen::VectorXd fit = terms.colPivHouseholderQr().solve(peaks);
+    model.baseMB = max(0.0, fit(0));
+    model.pixelFactor = max(0.0, fit(1));
+  }
+
+  vector<pair<double, double>> losslessTime, losslessMemory;
+  for (const CostSample &sample : samples) {
+    if (sample.query.lossless) {
+      int outputWidth, outputHeight;
+      const CostFeatures features =
+          costFeatures(sample.query, 0, outputWidth, outputHeight);
+      losslessTime.emplace_back(features.inputSamples,
+                                sample.totalMs - model.fixedMs);
+      losslessMemory.emplace_back(features.inputMB,
+                                  sample.peakMB - model.baseMB);
+    }
+  }
+  model.losslessMs = fitSlope(losslessTime, base.losslessMs);
+  model.losslessFactor = fitSlope(losslessMemory, base.losslessFactor);
+  return model;
+}
+
+/**
+ * @brief Error of a prediction, in percent of the actual value.
+ */
+double costErrorPercent(double predicted, double actual) {
+  return actual > 0 ? (predicted - actual) / actual * 100.0 : 0.0;
+}
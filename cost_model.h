@@ -0,0 +1,72 @@
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+#include "image.h"
+#include <string>
+#include <vector>
+
+// What the cost model needs to know about a transform, all of it available
+// from the file header and the options, before any pixel is decoded.
+struct CostQuery {
+  int width = 0, height = 0; // After the crop and the EXIF orientation
+  int channels = 0;          // Decoded channels
+  SampleDepth depth = DEPTH_8;
+  int angle = 0;
+  float scaleFactor = 1.0f;
+  Interpolation interpolation = INTERP_NEAREST;
+  CanvasMode canvas = CANVAS_EXPAND;
+  int threads = 1;       // JPEG decode threads
+  bool jpeg = false;     // Decoded by the (multi-threaded) JPEG decoder
+  bool lossless = false; // Done in the DCT domain, without decoding
+};
+
+// Predicted cost of one transform.
+struct CostEstimate {
+  double milliseconds = 0; // Decode, warp and encode
+  double peakMB = 0;       // Peak resident memory of the process
+  int outputWidth = 0, outputHeight = 0;
+};
+
+// Linear cost model. Times are per million samples (pixels x channels) and
+// memory is per MB of decoded source plus output pixels. The defaults come
+// from a Release build calibrated on a 4000x3000 JPEG.
+struct CostModel {
+  double fixedMs = 0;
+  double decodeMs = 4.6;        // Per input Msample, on one thread
+  double parallelFraction = 0;  // Share of the JPEG decode that threads split
+  double warpNearestMs = 5.1;   // Per output Msample
+  double warpBilinearMs = 9.0;  // Per output Msample
+  double encodeMs = 5.5;        // Per output Msample
+  double losslessMs = 13.2;     // Per input Msample, whole DCT-domain job
+  double baseMB = 6.9;
+  double pixelFactor = 0.98;    // Peak MB per MB of source and output pixels
+  double losslessFactor = 1.9;  // Peak MB per MB of source pixels
+
+  bool load(const std::string &path);
+  bool save(const std::string &path) const;
+  CostEstimate predict(const CostQuery &query) const;
+};
+
+// One measured run of the calibration sweep.
+struct CostSample {
+  CostQuery query;
+  double totalMs;
+  double warpMs;
+  double peakMB;
+};
+
+// Describes a transform from its input file's header and options. Returns
+// false when the header cannot be read or the crop misses the image.
+bool readCostQuery(const std::string &inputPath, const std::string &outputPath,
+                   int angle, float scaleFactor,
+                   const TransformOptions &options, CostQuery &query);
+
+// Least-squares fit of the model to measured runs; coefficients the runs do
+// not exercise keep the values of `base`.
+CostModel fitCostModel(const std::vector<CostSample> &samples,
+                       const CostModel &base);
+
+// Signed prediction error relative to the actual value, in percent.
+double costErrorPercent(double predicted, double actual);
+
+#endif // COST_MODEL_H
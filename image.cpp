@@ -1,440 +1,3283 @@
-#include "image.h"
-#include "benchmark.h"
-#include "buddy_memory.h"
-#include <chrono>
-#include <cmath>
-#include <cstring>
-#include <eigen3/Eigen/Dense>
-#include <fstream>
-#include <iostream>
-#include <sys/resource.h>
-
-using namespace std;
-
-BuddyMemoryManager *buddyManager = nullptr;
-
-/**
- * @brief Retrieves the memory usage of the current program in MB.
- *
- * This function uses `getrusage` to get memory statistics and converts
- * the result from KB to MB.
- *
- * @return double The memory usage in MB.
- */
-double getMemoryUsageMB() {
-  struct rusage usage;
-  getrusage(RUSAGE_SELF, &usage);
-  return usage.ru_maxrss / 1024.0; // Convert KB to MB
-}
-
-/**
- * @brief Default constructor for the Image class.
- *
- * Initializes the image properties such as width, height, channels, and
- * sets the data pointer to nullptr.
- */
-Image::Image()
-    : width(0), height(0), channels(0), data(nullptr), useBuddySystem(false) {}
-
-/**
- * @brief Loads an image from the specified file path.
- *
- * This function uses the `stbi_load` function to load the image and store
- * its data in the class. It prints the image's dimensions and the number
- * of color channels. If an error occurs, it outputs an error message.
- *
- * @param path The file path of the image to load.
- */
-void Image::image(const char *path) {
-  // Load the image and store it in the class members
-  data = stbi_load(path, &width, &height, &channels, 0);
-
-  if (data) {
-    cout << "+---------------------------+\n";
-    cout << "       Imagen Cargada      \n";
-    cout << "+---------------------------+\n";
-    cout << " Dimensiones: " << width << " x " << height << "\n";
-    cout << " Canales: " << channels << " (RGB) \n";
-    if (buddyManager == nullptr) {
-      // Allocate enough memory for transformations (e.g., 4x the original image
-      // size)
-      size_t estimatedSize = width * height * channels * 4;
-      buddyManager = new BuddyMemoryManager(estimatedSize);
-    }
-  } else {
-    cerr << "+---------------------------+\n";
-    cerr << "   Error al cargar imagen  \n";
-    cerr << "+---------------------------+\n";
-    cerr << " Motivo: " << stbi_failure_reason() << "\n";
-  }
-}
-
-/**
- * @brief Extracts the RGB channels of the loaded image.
- *
- * This function extracts the red, green, and blue color channels from the
- * image and stores them into separate vectors. The function prints a
- * success message once the channels are extracted.
- */
-void Image::extractChannels() {
-
-  canalRojo.resize(height, vector<int>(width));
-  canalVerde.resize(height, vector<int>(width));
-  canalAzul.resize(height, vector<int>(width));
-
-  for (int i = 0; i < height; i++) {
-    for (int j = 0; j < width; j++) {
-      canalRojo[i][j] = data[(i * width + j) * channels];
-      canalVerde[i][j] = data[(i * width + j) * channels + 1];
-      canalAzul[i][j] = data[(i * width + j) * channels + 2];
-    }
-  }
-
-  cout << "Canales extraídos.\n";
-}
-
-/**
- * @brief Rotates the image by a specified angle.
- *
- * This function performs a 2D rotation transformation on the image. The
- * angle is provided in degrees, and the function calculates the new
- * bounding box size to accommodate the rotated image. The rotated image is
- * then saved to the disk.
- *
- * @param angle The angle by which to rotate the image in degrees.
- */
-void Image::rotateImage(int angle) {
-  // Convert angle to radians
-  double radians = angle * M_PI / 180.0;
-
-  // Compute new bounding box dimensions
-  int newWidth = abs(width * cos(radians)) + abs(height * sin(radians));
-  int newHeight = abs(width * sin(radians)) + abs(height * cos(radians));
-
-  // Define the rotation matrix using Eigen
-  Eigen::Matrix2f rotationMatrix;
-  rotationMatrix << cos(radians), -sin(radians), sin(radians), cos(radians);
-
-  // Create new blank image data
-  Image rotatedImage;
-  rotatedImage.useBuddySystem = useBuddySystem;
-  if (useBuddySystem && buddyManager != nullptr) {
-    rotatedImage.data = static_cast<unsigned char *>(
-        buddyManager->allocate(newWidth * newHeight * channels));
-    memset(rotatedImage.data, 0, newWidth * newHeight * channels);
-  } else {
-    rotatedImage.data = new unsigned char[newWidth * newHeight * channels]();
-  }
-
-  rotatedImage.width = newWidth;
-  rotatedImage.height = newHeight;
-  rotatedImage.channels = channels;
-
-  // Find the center of the original and new images
-  Eigen::Vector2f centerOriginal(width / 2.0, height / 2.0);
-  Eigen::Vector2f centerNew(newWidth / 2.0, newHeight / 2.0);
-
-  // Iterate over each pixel in the new image
-  for (int i = 0; i < newHeight; i++) {
-    for (int j = 0; j < newWidth; j++) {
-      // Compute new pixel coordinates relative to center
-      Eigen::Vector2f newCoords(j, i);
-      Eigen::Vector2f oldCoords =
-          rotationMatrix.inverse() * (newCoords - centerNew) + centerOriginal;
-
-      int x = round(oldCoords[0]);
-      int y = round(oldCoords[1]);
-
-      // Check if the transformed coordinates are inside the original image
-      // bounds
-      if (x >= 0 && x < width && y >= 0 && y < height) {
-        // Copy pixel values from original image
-        for (int c = 0; c < channels; c++) {
-          rotatedImage.data[(i * newWidth + j) * channels + c] =
-              data[(y * width + x) * channels + c];
-        }
-      } else {
-        // Assign black pixels for out-of-bounds areas
-        for (int c = 0; c < channels; c++) {
-          rotatedImage.data[(i * newWidth + j) * channels + c] = 0;
-        }
-      }
-    }
-  }
-
-  cout << "Rotación completa" << endl;
-
-  rotatedImage.saveImage("./output/rotated.jpg");
-
-  if (useBuddySystem && buddyManager != nullptr &&
-      buddyManager->isManaged(rotatedImage.data)) {
-    buddyManager->deallocate(rotatedImage.data);
-    rotatedImage.data = nullptr;
-  }
-}
-
-/**
- * @brief Scales the image by a specified factor.
- *
- * This function resizes the image based on a scale factor. It performs
- * bilinear interpolation to ensure the image is scaled smoothly. The scaled
- * image is then saved to the disk.
- *
- * @param scaleFactor The factor by which to scale the image.
- */
-void Image::scaleImage(float scaleFactor) {
-  if (scaleFactor <= 0) {
-    cerr << "El factor de escala debe ser mayor que 0." << endl;
-    return;
-  }
-
-  // Calculate new size
-  int newWidth = static_cast<int>(width * scaleFactor);
-  int newHeight = static_cast<int>(height * scaleFactor);
-
-  // Create new blank image data
-  Image scaledImage;
-  scaledImage.useBuddySystem = useBuddySystem;
-
-  if (useBuddySystem && buddyManager != nullptr) {
-    scaledImage.data = static_cast<unsigned char *>(
-        buddyManager->allocate(newWidth * newHeight * channels));
-    memset(scaledImage.data, 0, newWidth * newHeight * channels);
-  } else {
-    scaledImage.data = new unsigned char[newWidth * newHeight * channels]();
-  }
-
-  scaledImage.width = newWidth;
-  scaledImage.height = newHeight;
-  scaledImage.channels = channels;
-
-  float scaleX = static_cast<float>(width) / newWidth;
-  float scaleY = static_cast<float>(height) / newHeight;
-
-  // Interpolation
-  for (int i = 0; i < newHeight; i++) {
-    for (int j = 0; j < newWidth; j++) {
-      float srcX = j * scaleX;
-      float srcY = i * scaleY;
-
-      int x1 = static_cast<int>(srcX);
-      int y1 = static_cast<int>(srcY);
-      int x2 = min(x1 + 1, width - 1);
-      int y2 = min(y1 + 1, height - 1);
-
-      float dx = srcX - x1;
-      float dy = srcY - y1;
-
-      for (int c = 0; c < channels; c++) {
-        float pixelValue =
-            (1 - dx) * (1 - dy) * data[(y1 * width + x1) * channels + c] +
-            dx * (1 - dy) * data[(y1 * width + x2) * channels + c] +
-            (1 - dx) * dy * data[(y2 * width + x1) * channels + c] +
-            dx * dy * data[(y2 * width + x2) * channels + c];
-
-        scaledImage.data[(i * newWidth + j) * channels + c] =
-            static_cast<unsigned char>(pixelValue);
-      }
-    }
-  }
-
-  cout << "Escalado completado! Nuevo tamaño: " << newWidth << " x "
-       << newHeight << endl;
-
-  scaledImage.saveImage("./output/scaled.jpg");
-  if (useBuddySystem && buddyManager != nullptr &&
-      buddyManager->isManaged(scaledImage.data)) {
-    buddyManager->deallocate(scaledImage.data);
-    scaledImage.data = nullptr;
-  }
-}
-
-/**
- * @brief Transforms the image by applying rotation and scaling.
- *
- * This function combines both rotation and scaling transformations
- * in sequence. It also tracks the time and memory usage of the process.
- *
- * @param inputPath The path to the input image.
- * @param outputPath The path where the transformed image will be saved.
- * @param angle The rotation angle in degrees.
- * @param scaleFactor The scaling factor.
- * @param buddySystem A flag indicating whether to use the buddy system for
- * memory allocation.
- */
-void Image::transformImage(const string &inputPath, const string &outputPath,
-                           int angle, float scaleFactor, bool buddySystem,
-                           bool showOutput) {
-  using namespace std::chrono;
-
-  // Set buddy system flag
-  useBuddySystem = buddySystem;
-
-  // Start measuring time
-  auto start = high_resolution_clock::now();
-
-  // Get memory usage before transformation
-  double memoryBefore = getMemoryUsageMB();
-
-  // Load the image
-  image(inputPath.c_str());
-
-  if (scaleFactor <= 0) {
-    if (showOutput) {
-      cerr << "El factor de escala debe ser mayor que 0." << endl;
-    }
-    return;
-  }
-
-  if (showOutput) {
-    cout << "\033[32m+---------------------------+\n";
-    cout << "       PROCESAMIENTO        \n";
-    cout << "+---------------------------+\n";
-    cout << " Archivo entrada: " << inputPath << " \n";
-    cout << " Archivo salida: " << outputPath << " \n";
-    cout << " Modo de asignación de memoria : "
-         << (buddySystem ? "Buddy system" : "Sin Buddy system") << " \n";
-    cout << "+---------------------------+\n";
-    cout << " Dimensiones originales: " << width << "x" << height
-         << " \n\033[0m";
-  }
-
-  double radians = angle * M_PI / 180.0;
-
-  Eigen::Matrix2f transformMatrix;
-  transformMatrix << scaleFactor * cos(radians), -scaleFactor * sin(radians),
-      scaleFactor * sin(radians), scaleFactor * cos(radians);
-
-  int newWidth = abs(width * scaleFactor * cos(radians)) +
-                 abs(height * scaleFactor * sin(radians));
-  int newHeight = abs(width * scaleFactor * sin(radians)) +
-                  abs(height * scaleFactor * cos(radians));
-
-  if (showOutput) {
-    cout << "\033[32m Dimensiones finales: " << newWidth << "x" << newHeight
-         << " \n";
-    cout << " Canales: " << channels << " (RGB)\n";
-    cout << " Ángulo de rotación: " << angle << " grados\n";
-    cout << " Factor de escalado: " << scaleFactor << " \n\033[0m";
-  }
-
-  Image transformedImage;
-  transformedImage.useBuddySystem = useBuddySystem;
-
-  // Start measuring time for the specific memory allocation method
-  auto buddyStart = high_resolution_clock::now();
-
-  if (useBuddySystem && buddyManager != nullptr) {
-    transformedImage.data = static_cast<unsigned char *>(
-        buddyManager->allocate(newWidth * newHeight * channels));
-    memset(transformedImage.data, 0, newWidth * newHeight * channels);
-  } else {
-    transformedImage.data =
-        new unsigned char[newWidth * newHeight * channels]();
-  }
-
-  auto buddyEnd = high_resolution_clock::now();
-  auto buddyDuration = duration_cast<milliseconds>(buddyEnd - buddyStart);
-
-  transformedImage.width = newWidth;
-  transformedImage.height = newHeight;
-  transformedImage.channels = channels;
-
-  Eigen::Vector2f centerOriginal(width / 2.0, height / 2.0);
-  Eigen::Vector2f centerNew(newWidth / 2.0, newHeight / 2.0);
-
-  for (int i = 0; i < newHeight; i++) {
-    for (int j = 0; j < newWidth; j++) {
-      Eigen::Vector2f newCoords(j, i);
-      Eigen::Vector2f oldCoords =
-          transformMatrix.inverse() * (newCoords - centerNew) + centerOriginal;
-
-      int x = round(oldCoords[0]);
-      int y = round(oldCoords[1]);
-
-      if (x >= 0 && x < width && y >= 0 && y < height) {
-        for (int c = 0; c < channels; c++) {
-          transformedImage.data[(i * newWidth + j) * channels + c] =
-              data[(y * width + x) * channels + c];
-        }
-      } else {
-        for (int c = 0; c < channels; c++) {
-          transformedImage.data[(i * newWidth + j) * channels + c] = 0;
-        }
-      }
-    }
-  }
-
-  // End measuring time
-  auto stop = high_resolution_clock::now();
-  auto duration = duration_cast<milliseconds>(stop - start);
-
-  // Get memory usage after transformation
-  double memoryAfter = getMemoryUsageMB();
-  double memoryUsed = memoryAfter - memoryBefore;
-
-  if (showOutput) {
-    cout << "\033[32m+---------------------------+\n";
-    cout << "   TIEMPO DE PROCESAMIENTO   \n";
-    cout << "+---------------------------+\n";
-
-    if (useBuddySystem) {
-      cout << "- Sin Buddy system: " << "[ ]" << " ms" << endl;
-      cout << "- Con Buddy system: " << duration.count() << " ms" << endl;
-      cout << "- Tiempo de asignación con Buddy: " << buddyDuration.count()
-           << " ms" << endl;
-    } else {
-      cout << "- Sin Buddy system: " << duration.count() << " ms" << endl;
-      cout << "- Con Buddy system: " << "[ ]" << " ms" << endl;
-    }
-
-    // Display memory usage
-    cout << "- Memoria utilizada: " << memoryUsed << " MB\n\033[0m";
-  }
-
-  transformedImage.saveImage(outputPath);
-
-  if (useBuddySystem && buddyManager != nullptr &&
-      buddyManager->isManaged(transformedImage.data)) {
-    buddyManager->deallocate(transformedImage.data);
-    transformedImage.data = nullptr;
-  }
-}
-
-/**
- * @brief Saves the image data to the specified file path.
- *
- * This function writes the image to the disk in JPG format. If the data is
- * invalid, an error message is displayed.
- *
- * @param outputPath The file path where the image will be saved.
- */
-void Image::saveImage(const string &outputPath) {
-  if (!data) {
-    cerr << "[ERROR] No hay datos de imagen disponibles para guardar\n";
-    return;
-  }
-
-  if (stbi_write_jpg(outputPath.c_str(), width, height, channels, data, 100)) {
-    cout << "[INFO] Imagen guardada correctamente en " << outputPath << "\n";
-  } else {
-    cerr << "[ERROR] Error al guardar la imagen \n";
-  }
-}
-
-/**
- * @brief Destructor for the Image class.
- *
- * Frees the allocated image data memory to avoid memory leaks.
- */
-Image::~Image() {
-  if (data) {
-    if (useBuddySystem && buddyManager != nullptr &&
-        buddyManager->isManaged(data)) {
-      buddyManager->deallocate(data);
-    } else {
-      stbi_image_free(data);
-    }
-    data = nullptr;
-  }
+#include "image.h"
+#include "benchmark.h"
+#include "buddy_memory.h"
+#include "jpeg_codec.h"
+#include "metrics.h"
+#include "srgb.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <eigen3/Eigen/Dense>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sys/resource.h>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+BuddyMemoryManager *buddyManager = nullptr;
+
+// Exported by stb_image_write's implementation, used by the 16-bit PNG writer
+extern "C" unsigned char *stbi_zlib_compress(unsigned char *data, int data_len,
+                                             int *out_len, int quality);
+
+/**
+ * @brief Retrieves the memory usage of the current program in MB.
+ *
+ * This function uses `getrusage` to get memory statistics and converts
+ * the result from KB to MB.
+ *
+ * @return double The memory usage in MB.
+ */
+double getMemoryUsageMB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0; // Convert KB to MB
+}
+
+/**
+ * @brief Default constructor for the Image class.
+ *
+ * Initializes the image properties such as width, height, channels, and
+ * sets the data pointer to nullptr.
+ */
+Image::Image()
+    : width(0), height(0), channels(0), depth(DEPTH_8), data(nullptr),
+      useBuddySystem(false), lastWarpMs(0) {}
+
+/**
+ * @brief Returns a printable name for an interleaved channel layout.
+ *
+ * @param channels Number of interleaved channels (1 to 4).
+ * @return const char* Layout name shown in the console reports.
+ */
+static const char *channelLayoutName(int channels) {
+  switch (channels) {
+  case 1:
+    return "Gris";
+  case 2:
+    return "Gris+Alfa";
+  case 3:
+    return "RGB";
+  case 4:
+    return "RGBA";
+  default:
+    return "Desconocido";
+  }
+}
+
+/**
+ * @brief Returns a printable name for a sample depth.
+ */
+static const char *sampleDepthName(SampleDepth depth) {
+  switch (depth) {
+  case DEPTH_8:
+    return "8 bits";
+  case DEPTH_16:
+    return "16 bits";
+  case DEPTH_FLOAT:
+    return "float";
+  default:
+    return "auto";
+  }
+}
+
+/**
+ * @brief Allocates a zeroed pixel buffer from the buddy pool or the heap.
+ *
+ * Falls back to the heap when the buddy pool cannot satisfy the request, so
+ * callers never receive a null buffer for a non-empty image.
+ *
+ * @param bytes Size of the buffer in bytes.
+ * @param buddySystem Whether to try the buddy system first.
+ * @return unsigned char* The zero-initialised buffer.
+ */
+static unsigned char *allocatePixels(size_t bytes, bool buddySystem) {
+  if (buddySystem && buddyManager != nullptr) {
+    unsigned char *pixels =
+        static_cast<unsigned char *>(buddyManager->allocate(bytes));
+    if (pixels) {
+      memset(pixels, 0, bytes);
+      metricsAdd(COUNTER_POOL_HITS);
+      metricsAdd(COUNTER_POOL_BYTES, bytes);
+      return pixels;
+    }
+    metricsAdd(COUNTER_POOL_MISSES);
+  }
+  metricsAdd(COUNTER_HEAP_BYTES, bytes);
+  return static_cast<unsigned char *>(calloc(bytes, 1));
+}
+
+/**
+ * @brief Clamps and converts an interpolated value back to a sample type.
+ *
+ * Integer depths are truncated like the original 8-bit kernels; float
+ * samples keep their full range so HDR highlights above 1.0 survive.
+ */
+template <typename T> static inline T toSample(float value) {
+  const float maxValue = static_cast<float>(numeric_limits<T>::max());
+  return static_cast<T>(value < 0 ? 0 : (value > maxValue ? maxValue : value));
+}
+
+template <> inline float toSample<float>(float value) { return value; }
+
+/**
+ * @brief Source addressing used by the warp kernels.
+ *
+ * Row-major is the layout stb decodes to. The tiled layout stores the image
+ * as square tiles of 2^shift pixels, each tile row-major and the tiles
+ * themselves row-major, so the neighbourhood a warp reads stays within one
+ * or two tiles (and cache lines) whatever the rotation angle.
+ */
+struct RowMajorLayout {
+  int width;
+  size_t offset(int x, int y) const {
+    return static_cast<size_t>(y) * width + x;
+  }
+};
+
+struct TiledLayout {
+  int shift;       // log2 of the tile side
+  int mask;        // Tile side - 1
+  int tilesPerRow; // Tiles per row of tiles, including the padded one
+  size_t offset(int x, int y) const {
+    size_t tile = static_cast<size_t>(y >> shift) * tilesPerRow + (x >> shift);
+    return (tile << (2 * shift)) + ((y & mask) << shift) + (x & mask);
+  }
+};
+
+// Runtime description of the source layout handed to the kernel adaptors
+struct SourceLayout {
+  int tileShift = 0; // 0 for row-major, otherwise log2 of the tile side
+  int tilesPerRow = 0;
+};
+
+/**
+ * @brief Copies a row-major image into the tiled layout in one linear pass.
+ *
+ * Edge tiles are padded to the full tile size (the padding is never read,
+ * since the warp kernels bounds-check against the real image size).
+ *
+ * @param src Row-major source pixels.
+ * @param width Image width in pixels.
+ * @param height Image height in pixels.
+ * @param pixelBytes Size of one pixel in bytes.
+ * @param tileShift log2 of the tile side.
+ * @param buddySystem Whether to allocate the tiled copy from the buddy pool.
+ * @param layout Receives the layout description for the kernels.
+ * @return unsigned char* The tiled copy.
+ */
+static unsigned char *tileImage(const unsigned char *src, int width,
+                                int height, size_t pixelBytes, int tileShift,
+                                bool buddySystem, SourceLayout &layout) {
+  const int tileSide = 1 << tileShift;
+  const int tilesPerRow = (width + tileSide - 1) >> tileShift;
+  const int tileRows = (height + tileSide - 1) >> tileShift;
+  const size_t tileBytes = pixelBytes << (2 * tileShift);
+
+  unsigned char *tiled = allocatePixels(
+      static_cast<size_t>(tilesPerRow) * tileRows * tileBytes, buddySystem);
+
+  for (int y = 0; y < height; y++) {
+    const unsigned char *row =
+        src + static_cast<size_t>(y) * width * pixelBytes;
+    unsigned char *tileRow =
+        tiled + static_cast<size_t>(y >> tileShift) * tilesPerRow * tileBytes +
+        static_cast<size_t>(y & (tileSide - 1)) * tileSide * pixelBytes;
+    for (int tx = 0; tx < tilesPerRow; tx++) {
+      int x0 = tx << tileShift;
+      int count = min(tileSide, width - x0);
+      memcpy(tileRow + tx * tileBytes, row + x0 * pixelBytes,
+             count * pixelBytes);
+    }
+  }
+
+  layout.tileShift = tileShift;
+  layout.tilesPerRow = tilesPerRow;
+  return tiled;
+}
+
+/**
+ * @brief Returns a pixel buffer to the buddy pool or the heap.
+ */
+static void releasePixels(unsigned char *pixels) {
+  if (buddyManager != nullptr && buddyManager->isManaged(pixels)) {
+    buddyManager->deallocate(pixels);
+  } else {
+    free(pixels);
+  }
+}
+
+/**
+ * @brief One 8-bit RGB pixel padded to 32 bits.
+ *
+ * Kernels instantiated on this type with a single "channel" load, store
+ * and copy each pixel as one word instead of three bytes. The fourth byte
+ * is padding and never reaches the output image.
+ */
+struct RgbxPixel {
+  uint32_t bits;
+
+  RgbxPixel() = default;
+  RgbxPixel(uint32_t value) : bits(value) {}
+};
+
+/**
+ * @brief Widens packed RGB to RGBX with one unaligned word copy per pixel.
+ *
+ * Each copy picks up the next pixel's red byte as padding; the last pixel
+ * is copied bytewise so the read never runs past the source.
+ *
+ * @param src Packed RGB pixels.
+ * @param dst Receives `count` padded pixels.
+ * @param count Number of pixels.
+ */
+static void padRgb(const unsigned char *src, RgbxPixel *dst, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  for (size_t i = 0; i + 1 < count; i++) {
+    memcpy(&dst[i].bits, src + 3 * i, 4);
+  }
+  dst[count - 1].bits = 0;
+  memcpy(&dst[count - 1].bits, src + 3 * (count - 1), 3);
+}
+
+/**
+ * @brief Packs RGBX pixels back to RGB in place.
+ *
+ * Each word store overlaps the next pixel's first byte, which that pixel's
+ * own store then overwrites; writes never overtake unread pixels, since
+ * pixel i moves from byte 4i down to byte 3i.
+ *
+ * @param pixels Buffer holding `count` padded pixels; receives packed RGB.
+ * @param count Number of pixels.
+ */
+static void packRgbx(unsigned char *pixels, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  for (size_t i = 0; i + 1 < count; i++) {
+    uint32_t word;
+    memcpy(&word, pixels + 4 * i, 4);
+    memcpy(pixels + 3 * i, &word, 4);
+  }
+  memmove(pixels + 3 * (count - 1), pixels + 4 * (count - 1), 3);
+}
+
+/**
+ * @brief Affine mapping from destination pixels to source positions.
+ *
+ * Centres are measured between pixel centres, so right-angle rotations map
+ * every destination pixel onto exactly one source pixel. The kernels
+ * evaluate the mapping with two multiply-adds per pixel instead of a matrix
+ * product.
+ */
+struct WarpMapping {
+  float originX, originY; // Source position of destination pixel (0, 0)
+  float colX, colY;       // Source step per destination column
+  float rowX, rowY;       // Source step per destination row
+
+  float sourceX(int j, int i) const { return originX + j * colX + i * rowX; }
+  float sourceY(int j, int i) const { return originY + j * colY + i * rowY; }
+};
+
+static WarpMapping makeWarpMapping(int srcWidth, int srcHeight, int dstWidth,
+                                   int dstHeight,
+                                   const Eigen::Matrix2f &inverse) {
+  Eigen::Vector2f centerOriginal((srcWidth - 1) / 2.0, (srcHeight - 1) / 2.0);
+  Eigen::Vector2f centerNew((dstWidth - 1) / 2.0, (dstHeight - 1) / 2.0);
+  Eigen::Vector2f origin = centerOriginal - inverse * centerNew;
+
+  WarpMapping mapping;
+  mapping.originX = origin[0];
+  mapping.originY = origin[1];
+  mapping.colX = inverse(0, 0);
+  mapping.colY = inverse(1, 0);
+  mapping.rowX = inverse(0, 1);
+  mapping.rowY = inverse(1, 1);
+  return mapping;
+}
+
+// Preemption point of the calling thread's warps (see setTileYield)
+static thread_local const function<void()> *tileYield = nullptr;
+
+// Rows per band when a row-order warp is split for tileYield
+static const int YIELD_BAND_ROWS = 64;
+
+/**
+ * @brief Sets the calling thread's preemption point between warp tiles.
+ *
+ * @param yield Called between tiles; it may run whole other transforms on
+ * this thread before returning. nullptr removes it.
+ */
+void setTileYield(const function<void()> *yield) { tileYield = yield; }
+
+// Preview callback of the calling thread's transforms and its size limit
+// (see setTransformPreview)
+static thread_local const function<void(const PreviewImage &)>
+    *transformPreview = nullptr;
+static thread_local int previewSide = 0;
+// The preview the current transform has yet to deliver
+static thread_local const function<void(const PreviewImage &)>
+    *pendingPreview = nullptr;
+
+/**
+ * @brief Sets the calling thread's preview callback.
+ *
+ * @param preview Receives the preview of each transform; nullptr removes it.
+ * @param maxSide Longest side of the previews, in pixels.
+ */
+void setTransformPreview(const function<void(const PreviewImage &)> *preview,
+                         int maxSide) {
+  transformPreview = preview;
+  previewSide = maxSide;
+}
+
+/**
+ * @brief Visits the destination either whole or in square blocks.
+ *
+ * Walking the destination in blocks keeps the source footprint of
+ * consecutive pixels compact at every angle, which is what makes the tiled
+ * source layout pay off. With a tileYield installed, row order is split in
+ * bands of rows, and tileYield runs after each band or row of blocks. The
+ * visiting order, and so the output, stays the same.
+ *
+ * @param blockSize Side of the blocks, or 0 to visit the image row by row.
+ * @param visit Callback receiving the block bounds [x0, x1) x [y0, y1).
+ */
+template <typename Visit>
+static void forEachBlock(int dstWidth, int dstHeight, int blockSize,
+                         Visit visit) {
+  if (blockSize <= 0 && !tileYield) {
+    visit(0, 0, dstWidth, dstHeight);
+    return;
+  }
+  if (blockSize <= 0) {
+    for (int y0 = 0; y0 < dstHeight; y0 += YIELD_BAND_ROWS) {
+      visit(0, y0, dstWidth, min(y0 + YIELD_BAND_ROWS, dstHeight));
+      (*tileYield)();
+    }
+    return;
+  }
+  for (int y0 = 0; y0 < dstHeight; y0 += blockSize) {
+    for (int x0 = 0; x0 < dstWidth; x0 += blockSize) {
+      visit(x0, y0, min(x0 + blockSize, dstWidth),
+            min(y0 + blockSize, dstHeight));
+    }
+    if (tileYield) {
+      (*tileYield)();
+    }
+  }
+}
+
+/**
+ * @brief Nearest-neighbour inverse warp specialised on sample type, channel
+ * count and source layout.
+ *
+ * Every destination pixel is mapped back through the inverse transform to
+ * the source image. Pixels that fall outside the source are written as zero,
+ * which is black for colour channels and fully transparent for alpha.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @tparam Layout Source addressing (RowMajorLayout or TiledLayout).
+ * @param src Source pixels.
+ * @param layout Source addressing.
+ * @param srcWidth Source width in pixels.
+ * @param srcHeight Source height in pixels.
+ * @param dst Destination pixels (row-major).
+ * @param dstWidth Destination width in pixels.
+ * @param dstHeight Destination height in pixels.
+ * @param inverse Matrix mapping destination offsets to source offsets.
+ * @param blockSize Destination block side, or 0 for row order.
+ */
+template <typename T, int C, typename Layout>
+static void warpNearest(const T *src, const Layout &layout, int srcWidth,
+                        int srcHeight, T *dst, int dstWidth, int dstHeight,
+                        const Eigen::Matrix2f &inverse, int blockSize) {
+  const WarpMapping mapping =
+      makeWarpMapping(srcWidth, srcHeight, dstWidth, dstHeight, inverse);
+
+  forEachBlock(dstWidth, dstHeight, blockSize,
+               [&](int x0, int y0, int x1, int y1) {
+    for (int i = y0; i < y1; i++) {
+      T *out = dst + (static_cast<size_t>(i) * dstWidth + x0) * C;
+      for (int j = x0; j < x1; j++, out += C) {
+        int x = round(mapping.sourceX(j, i));
+        int y = round(mapping.sourceY(j, i));
+
+        if (x >= 0 && x < srcWidth && y >= 0 && y < srcHeight) {
+          const T *in = src + layout.offset(x, y) * C;
+          for (int c = 0; c < C; c++) {
+            out[c] = in[c];
+          }
+        } else {
+          for (int c = 0; c < C; c++) {
+            out[c] = 0;
+          }
+        }
+      }
+    }
+  });
+}
+
+#ifdef __SSE2__
+/**
+ * @brief Loads one 4-channel pixel of any supported depth into a float
+ * vector.
+ */
+static inline __m128 loadPixel4(const unsigned char *p) {
+  __m128i v = _mm_cvtsi32_si128(*reinterpret_cast<const int *>(p));
+  v = _mm_unpacklo_epi8(v, _mm_setzero_si128());
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+}
+
+static inline __m128 loadPixel4(const unsigned short *p) {
+  __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(p));
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+}
+
+static inline __m128 loadPixel4(const float *p) { return _mm_loadu_ps(p); }
+
+/**
+ * @brief Stores a float vector as one 4-channel pixel, truncating and
+ * saturating integer depths like toSample.
+ */
+static inline void storePixel4(unsigned char *p, __m128 v) {
+  __m128i i = _mm_cvttps_epi32(_mm_max_ps(v, _mm_setzero_ps()));
+  i = _mm_packs_epi32(i, i);
+  i = _mm_packus_epi16(i, i);
+  *reinterpret_cast<int *>(p) = _mm_cvtsi128_si32(i);
+}
+
+static inline void storePixel4(unsigned short *p, __m128 v) {
+  v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(65535.0f));
+  // Bias into signed range so the signed 16-bit pack does not saturate
+  __m128i i = _mm_sub_epi32(_mm_cvttps_epi32(v), _mm_set1_epi32(32768));
+  i = _mm_packs_epi32(i, i);
+  i = _mm_xor_si128(i, _mm_set1_epi16(static_cast<short>(0x8000)));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(p), i);
+}
+
+static inline void storePixel4(float *p, __m128 v) { _mm_storeu_ps(p, v); }
+#endif
+
+/**
+ * @brief Converts samples to and from the space the bilinear kernels blend
+ * in.
+ *
+ * By default samples are blended as stored. The linear-light specialisation
+ * for 8-bit samples decodes sRGB through a 256-entry table and encodes the
+ * result through a 4096-entry table, so gamma-correct blending costs two
+ * lookups instead of two `pow` calls per sample. Float samples from
+ * `stbi_loadf` are already linear and 16-bit samples are blended as stored.
+ */
+template <typename T, bool Linear> struct SampleCodec {
+  static inline float decode(T value) { return value; }
+  static inline T encode(float value) { return toSample<T>(value); }
+};
+
+template <> struct SampleCodec<unsigned char, true> {
+  static inline float decode(unsigned char value) {
+    return srgbToLinear(value);
+  }
+  static inline unsigned char encode(float value) {
+    return linearToSrgb(value);
+  }
+};
+
+/**
+ * @brief Blends four neighbouring pixels with bilinear weights.
+ *
+ * For layouts with alpha (gray+alpha and RGBA) the colour samples are
+ * weighted by their alpha before blending and divided by the blended alpha
+ * afterwards. This is the premultiplied-alpha path: without it, the colour of
+ * fully transparent pixels bleeds into the visible edge. Alpha is always
+ * blended as stored, never through the sRGB curve. On SSE2 targets the RGBA
+ * blend handles a whole pixel per instruction at every depth, except in
+ * linear-light mode, which needs per-sample table lookups.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @tparam Linear Whether 8-bit colour samples are blended in linear light.
+ */
+template <typename T, int C, bool Linear>
+static inline void blendBilinear(const T *p11, const T *p21, const T *p12,
+                                 const T *p22, float dx, float dy, T *out) {
+  typedef SampleCodec<T, Linear> Codec;
+  const bool premultiplied = (C == 2 || C == 4);
+  const int alpha = C - 1;
+
+  float w11 = (1 - dx) * (1 - dy);
+  float w21 = dx * (1 - dy);
+  float w12 = (1 - dx) * dy;
+  float w22 = dx * dy;
+
+  // Alpha-weighted blend weights (equal to the plain weights without alpha)
+  float a11 = w11, a21 = w21, a12 = w12, a22 = w22;
+  float blendedAlpha = 1;
+  if (premultiplied) {
+    a11 *= p11[alpha];
+    a21 *= p21[alpha];
+    a12 *= p12[alpha];
+    a22 *= p22[alpha];
+    blendedAlpha = a11 + a21 + a12 + a22;
+  }
+
+#ifdef __SSE2__
+  if (C == 4 && !Linear) {
+    __m128 sum = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a11), loadPixel4(p11)),
+                   _mm_mul_ps(_mm_set1_ps(a21), loadPixel4(p21))),
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a12), loadPixel4(p12)),
+                   _mm_mul_ps(_mm_set1_ps(a22), loadPixel4(p22))));
+    float inv = blendedAlpha > 0 ? 1.0f / blendedAlpha : 0.0f;
+    // Lanes 0-2 are unpremultiplied colour, lane 3 the blended alpha
+    __m128 result = _mm_mul_ps(sum, _mm_set_ps(0, inv, inv, inv));
+    result = _mm_add_ps(result, _mm_set_ps(blendedAlpha, 0, 0, 0));
+    storePixel4(out, result);
+    return;
+  }
+#endif
+
+  if (premultiplied) {
+    for (int c = 0; c < alpha; c++) {
+      float pixelValue = 0;
+      if (blendedAlpha > 0) {
+        pixelValue =
+            (a11 * Codec::decode(p11[c]) + a21 * Codec::decode(p21[c]) +
+             a12 * Codec::decode(p12[c]) + a22 * Codec::decode(p22[c])) /
+            blendedAlpha;
+      }
+      out[c] = Codec::encode(pixelValue);
+    }
+    out[alpha] = toSample<T>(blendedAlpha);
+  } else {
+    for (int c = 0; c < C; c++) {
+      float pixelValue =
+          w11 * Codec::decode(p11[c]) + w21 * Codec::decode(p21[c]) +
+          w12 * Codec::decode(p12[c]) + w22 * Codec::decode(p22[c]);
+      out[c] = Codec::encode(pixelValue);
+    }
+  }
+}
+
+/**
+ * @brief Blends four padded RGB pixels with bilinear weights.
+ *
+ * On SSE2 targets each pixel is loaded and stored as one word and blended
+ * as a vector, in the same order of operations as the packed RGB blend, so
+ * both layouts give the same result. There is no alpha to premultiply; the
+ * padding lane is blended along and ignored. Linear light, which needs
+ * per-sample lookups, goes through the packed RGB blend.
+ */
+template <bool Linear>
+static inline void blendRgbx(const RgbxPixel *p11, const RgbxPixel *p21,
+                             const RgbxPixel *p12, const RgbxPixel *p22,
+                             float dx, float dy, RgbxPixel *out) {
+  typedef const unsigned char *Bytes;
+#ifdef __SSE2__
+  if (!Linear) {
+    __m128 w11 = _mm_set1_ps((1 - dx) * (1 - dy));
+    __m128 w21 = _mm_set1_ps(dx * (1 - dy));
+    __m128 w12 = _mm_set1_ps((1 - dx) * dy);
+    __m128 w22 = _mm_set1_ps(dx * dy);
+    __m128 sum = _mm_mul_ps(w11, loadPixel4(reinterpret_cast<Bytes>(p11)));
+    sum = _mm_add_ps(sum,
+                     _mm_mul_ps(w21, loadPixel4(reinterpret_cast<Bytes>(p21))));
+    sum = _mm_add_ps(sum,
+                     _mm_mul_ps(w12, loadPixel4(reinterpret_cast<Bytes>(p12))));
+    sum = _mm_add_ps(sum,
+                     _mm_mul_ps(w22, loadPixel4(reinterpret_cast<Bytes>(p22))));
+    storePixel4(reinterpret_cast<unsigned char *>(out), sum);
+    return;
+  }
+#endif
+  blendBilinear<unsigned char, 3, Linear>(
+      reinterpret_cast<Bytes>(p11), reinterpret_cast<Bytes>(p21),
+      reinterpret_cast<Bytes>(p12), reinterpret_cast<Bytes>(p22), dx, dy,
+      reinterpret_cast<unsigned char *>(out));
+}
+
+template <>
+inline void blendBilinear<RgbxPixel, 1, false>(
+    const RgbxPixel *p11, const RgbxPixel *p21, const RgbxPixel *p12,
+    const RgbxPixel *p22, float dx, float dy, RgbxPixel *out) {
+  blendRgbx<false>(p11, p21, p12, p22, dx, dy, out);
+}
+
+template <>
+inline void blendBilinear<RgbxPixel, 1, true>(
+    const RgbxPixel *p11, const RgbxPixel *p21, const RgbxPixel *p12,
+    const RgbxPixel *p22, float dx, float dy, RgbxPixel *out) {
+  blendRgbx<true>(p11, p21, p12, p22, dx, dy, out);
+}
+
+/**
+ * @brief Bilinear resampling kernel specialised on sample type and channel
+ * count.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @tparam Linear Whether 8-bit colour samples are blended in linear light.
+ */
+template <typename T, int C, bool Linear>
+static void scaleBilinear(const T *src, int srcWidth, int srcHeight, T *dst,
+                          int dstWidth, int dstHeight) {
+  float scaleX = static_cast<float>(srcWidth) / dstWidth;
+  float scaleY = static_cast<float>(srcHeight) / dstHeight;
+
+  for (int i = 0; i < dstHeight; i++) {
+    T *out = dst + static_cast<size_t>(i) * dstWidth * C;
+    for (int j = 0; j < dstWidth; j++, out += C) {
+      float srcX = j * scaleX;
+      float srcY = i * scaleY;
+
+      int x1 = static_cast<int>(srcX);
+      int y1 = static_cast<int>(srcY);
+      int x2 = min(x1 + 1, srcWidth - 1);
+      int y2 = min(y1 + 1, srcHeight - 1);
+
+      blendBilinear<T, C, Linear>(src + (y1 * srcWidth + x1) * C,
+                                  src + (y1 * srcWidth + x2) * C,
+                                  src + (y2 * srcWidth + x1) * C,
+                                  src + (y2 * srcWidth + x2) * C, srcX - x1,
+                                  srcY - y1, out);
+    }
+  }
+}
+
+/**
+ * @brief Bilinear inverse warp specialised on sample type, channel count and
+ * source layout.
+ *
+ * Like warpNearest, but the mapped source position is blended from its four
+ * neighbours. Neighbours outside the source count as zero, so the rotated
+ * edge fades into the black (or transparent) border instead of stepping.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @tparam Linear Whether 8-bit colour samples are blended in linear light.
+ * @tparam Layout Source addressing (RowMajorLayout or TiledLayout).
+ */
+template <typename T, int C, bool Linear, typename Layout>
+static void warpBilinear(const T *src, const Layout &layout, int srcWidth,
+                         int srcHeight, T *dst, int dstWidth, int dstHeight,
+                         const Eigen::Matrix2f &inverse, int blockSize) {
+  static const T zero[C] = {};
+  const WarpMapping mapping =
+      makeWarpMapping(srcWidth, srcHeight, dstWidth, dstHeight, inverse);
+
+  auto pixelAt = [&](int x, int y) -> const T * {
+    if (x < 0 || x >= srcWidth || y < 0 || y >= srcHeight) {
+      return zero;
+    }
+    return src + layout.offset(x, y) * C;
+  };
+
+  forEachBlock(dstWidth, dstHeight, blockSize,
+               [&](int x0, int y0, int x1, int y1) {
+    for (int i = y0; i < y1; i++) {
+      T *out = dst + (static_cast<size_t>(i) * dstWidth + x0) * C;
+      for (int j = x0; j < x1; j++, out += C) {
+        float srcX = mapping.sourceX(j, i);
+        float srcY = mapping.sourceY(j, i);
+
+        int xa = static_cast<int>(floor(srcX));
+        int ya = static_cast<int>(floor(srcY));
+
+        if (xa < -1 || xa >= srcWidth || ya < -1 || ya >= srcHeight) {
+          for (int c = 0; c < C; c++) {
+            out[c] = 0;
+          }
+          continue;
+        }
+
+        blendBilinear<T, C, Linear>(pixelAt(xa, ya), pixelAt(xa + 1, ya),
+                                    pixelAt(xa, ya + 1),
+                                    pixelAt(xa + 1, ya + 1), srcX - xa,
+                                    srcY - ya, out);
+      }
+    }
+  });
+}
+
+/**
+ * @brief Recognises exact 2x, 3x and 4x up- and downscales.
+ *
+ * Sizes rather than the float factor decide, so a downscale only qualifies
+ * when every output pixel covers whole source pixels.
+ *
+ * @return int K for an exact K x upscale, -K for an exact 1/K downscale, or
+ * 0 for any other ratio.
+ */
+static int integerScaleRatio(int srcWidth, int srcHeight, int dstWidth,
+                             int dstHeight) {
+  for (int k = 2; k <= 4; k++) {
+    if (dstWidth == srcWidth * k && dstHeight == srcHeight * k) {
+      return k;
+    }
+    if (srcWidth == dstWidth * k && srcHeight == dstHeight * k) {
+      return -k;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Output-to-source taps of an exact K x upscale along one axis.
+ *
+ * Pixel centres stay aligned as in the warp mapping, so output pixel j
+ * samples source position (j + 0.5) / K - 0.5 and the phase j % K alone
+ * fixes the weights. Only the outer half pixel reaches past the source;
+ * there the edge sample is repeated, or read as zero like the warps do.
+ */
+struct UpscaleTaps {
+  vector<int> first, second; // Source indices, -1 outside the source
+  vector<float> weight;      // Weight of `second`
+  vector<int> fixedWeight;   // The same in 1/256
+
+  UpscaleTaps(int srcSize, int factor, bool clampEdges) {
+    const int size = srcSize * factor;
+    first.resize(size);
+    second.resize(size);
+    weight.resize(size);
+    fixedWeight.resize(size);
+    for (int j = 0; j < size; j++) {
+      const float position = (j + 0.5f) / factor - 0.5f;
+      const int left = static_cast<int>(floor(position));
+      weight[j] = position - left;
+      fixedWeight[j] = static_cast<int>(lround(weight[j] * 256));
+      if (clampEdges) {
+        first[j] = max(left, 0);
+        second[j] = min(left + 1, srcSize - 1);
+      } else {
+        first[j] = left;
+        second[j] = left + 1 < srcSize ? left + 1 : -1;
+      }
+    }
+  }
+};
+
+/**
+ * @brief Exact K x upscale by replication or fixed-weight bilinear blending.
+ *
+ * Replication widens each source row once and copies it down K times.
+ * Bilinear blending uses the per-phase taps of UpscaleTaps with the same
+ * premultiplied-alpha and linear-light rules as the other kernels.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @tparam Linear Whether 8-bit colour samples are blended in linear light.
+ */
+template <typename T, int C, bool Linear>
+static void upscaleInteger(const T *src, int srcWidth, int srcHeight, T *dst,
+                           int factor, bool bilinear, bool clampEdges) {
+  const int dstWidth = srcWidth * factor, dstHeight = srcHeight * factor;
+  const size_t dstStride = static_cast<size_t>(dstWidth) * C;
+
+  if (!bilinear) {
+    for (int y = 0; y < srcHeight; y++) {
+      const T *in = src + static_cast<size_t>(y) * srcWidth * C;
+      T *first = dst + static_cast<size_t>(y) * factor * dstStride;
+      T *out = first;
+      for (int x = 0; x < srcWidth; x++, in += C) {
+        for (int r = 0; r < factor; r++, out += C) {
+          for (int c = 0; c < C; c++) {
+            out[c] = in[c];
+          }
+        }
+      }
+      for (int r = 1; r < factor; r++) {
+        memcpy(first + r * dstStride, first, dstStride * sizeof(T));
+      }
+    }
+    return;
+  }
+
+  static const T zero[C] = {};
+  const UpscaleTaps columns(srcWidth, factor, clampEdges);
+  const UpscaleTaps rows(srcHeight, factor, clampEdges);
+  auto pixelAt = [&](int x, int y) -> const T * {
+    if (x < 0 || y < 0) {
+      return zero;
+    }
+    return src + (static_cast<size_t>(y) * srcWidth + x) * C;
+  };
+
+  for (int i = 0; i < dstHeight; i++) {
+    T *out = dst + i * dstStride;
+    const int top = rows.first[i], bottom = rows.second[i];
+    for (int j = 0; j < dstWidth; j++, out += C) {
+      const int left = columns.first[j], right = columns.second[j];
+      blendBilinear<T, C, Linear>(pixelAt(left, top), pixelAt(right, top),
+                                  pixelAt(left, bottom),
+                                  pixelAt(right, bottom), columns.weight[j],
+                                  rows.weight[i], out);
+    }
+  }
+}
+
+/**
+ * @brief 8-bit bilinear K x upscale in fixed point.
+ *
+ * Separable: each source row is blended across once into a row of 16.8
+ * values (two are cached, since consecutive output rows share them), and
+ * output rows are blended down from a pair of those. Results are truncated
+ * like the float kernels; for 2x and 4x, whose weights are exact eighths,
+ * they are identical.
+ */
+template <int C>
+static void upscaleBilinear8(const unsigned char *src, int srcWidth,
+                             int srcHeight, unsigned char *dst, int factor,
+                             bool clampEdges) {
+  const int dstWidth = srcWidth * factor, dstHeight = srcHeight * factor;
+  const size_t dstStride = static_cast<size_t>(dstWidth) * C;
+  const UpscaleTaps columns(srcWidth, factor, clampEdges);
+  const UpscaleTaps rows(srcHeight, factor, clampEdges);
+
+  vector<int> widened[2] = {vector<int>(dstStride), vector<int>(dstStride)};
+  int widenedRow[2] = {-1, -1};
+  const vector<int> zeroRow(dstStride, 0);
+  auto widen = [&](int y) -> const int * {
+    if (y < 0) {
+      return zeroRow.data();
+    }
+    int *row = widened[y & 1].data();
+    if (widenedRow[y & 1] == y) {
+      return row;
+    }
+    const unsigned char *in = src + static_cast<size_t>(y) * srcWidth * C;
+    for (int j = 0; j < dstWidth; j++) {
+      const int left = columns.first[j], right = columns.second[j];
+      const int w = columns.fixedWeight[j];
+      for (int c = 0; c < C; c++) {
+        const int a = left < 0 ? 0 : in[left * C + c];
+        const int b = right < 0 ? 0 : in[right * C + c];
+        row[j * C + c] = a * (256 - w) + b * w;
+      }
+    }
+    widenedRow[y & 1] = y;
+    return row;
+  };
+
+  for (int i = 0; i < dstHeight; i++) {
+    const int *top = widen(rows.first[i]);
+    const int *bottom = widen(rows.second[i]);
+    const int w = rows.fixedWeight[i];
+    unsigned char *out = dst + i * dstStride;
+    for (size_t k = 0; k < dstStride; k++) {
+      out[k] = static_cast<unsigned char>((top[k] * (256 - w) +
+                                           bottom[k] * w) >>
+                                          16);
+    }
+  }
+}
+
+/**
+ * @brief Exact 1/K downscale by averaging K x K boxes.
+ *
+ * Colour is weighted by alpha for layouts with alpha, and blended in linear
+ * light when asked, like blendBilinear; for 1/2 the result is the one the
+ * bilinear kernels give, since they sample the middle of each 2 x 2 box.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @tparam Linear Whether 8-bit colour samples are blended in linear light.
+ */
+template <typename T, int C, bool Linear>
+static void downscaleBox(const T *src, int srcWidth, T *dst, int dstWidth,
+                         int dstHeight, int factor) {
+  typedef SampleCodec<T, Linear> Codec;
+  const bool premultiplied = (C == 2 || C == 4);
+  const int alpha = C - 1;
+  const int colours = premultiplied ? C - 1 : C;
+  const float area = static_cast<float>(factor * factor);
+
+  for (int i = 0; i < dstHeight; i++) {
+    T *out = dst + static_cast<size_t>(i) * dstWidth * C;
+    for (int j = 0; j < dstWidth; j++, out += C) {
+      float sums[C] = {};
+      float weight = 0;
+      for (int dy = 0; dy < factor; dy++) {
+        const T *p = src + (static_cast<size_t>(i * factor + dy) * srcWidth +
+                            j * factor) *
+                               C;
+        for (int dx = 0; dx < factor; dx++, p += C) {
+          const float a = premultiplied ? static_cast<float>(p[alpha]) : 1.0f;
+          for (int c = 0; c < colours; c++) {
+            sums[c] += a * Codec::decode(p[c]);
+          }
+          weight += a;
+        }
+      }
+      for (int c = 0; c < colours; c++) {
+        out[c] = Codec::encode(weight > 0 ? sums[c] / weight : 0.0f);
+      }
+      if (premultiplied) {
+        out[alpha] = toSample<T>(weight / area);
+      }
+    }
+  }
+}
+
+/**
+ * @brief 8-bit 1/K box downscale without alpha.
+ *
+ * The K source rows of an output row are summed into 16-bit lanes sixteen
+ * samples at a time (SSE2), then each run of K pixels is summed across and
+ * divided by K * K, truncating like downscaleBox.
+ */
+template <int C, int K>
+static void downscaleBox8(const unsigned char *src, int srcWidth,
+                          unsigned char *dst, int dstWidth, int dstHeight) {
+  const int used = dstWidth * K * C;
+  vector<unsigned short> sums(used);
+
+  for (int i = 0; i < dstHeight; i++) {
+    const unsigned char *rows[K];
+    for (int r = 0; r < K; r++) {
+      rows[r] = src + static_cast<size_t>(i * K + r) * srcWidth * C;
+    }
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= used; x += 16) {
+      __m128i low = zero, high = zero;
+      for (int r = 0; r < K; r++) {
+        __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(rows[r] + x));
+        low = _mm_add_epi16(low, _mm_unpacklo_epi8(v, zero));
+        high = _mm_add_epi16(high, _mm_unpackhi_epi8(v, zero));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(&sums[x]), low);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(&sums[x + 8]), high);
+    }
+#endif
+    for (; x < used; x++) {
+      int sum = 0;
+      for (int r = 0; r < K; r++) {
+        sum += rows[r][x];
+      }
+      sums[x] = static_cast<unsigned short>(sum);
+    }
+
+    unsigned char *out = dst + static_cast<size_t>(i) * dstWidth * C;
+    const unsigned short *in = sums.data();
+    for (int j = 0; j < dstWidth; j++, out += C, in += K * C) {
+      for (int c = 0; c < C; c++) {
+        int sum = 0;
+        for (int dx = 0; dx < K; dx++) {
+          sum += in[dx * C + c];
+        }
+        out[c] = static_cast<unsigned char>(sum / (K * K));
+      }
+    }
+  }
+}
+
+/**
+ * @brief Mirrors an image in place by swapping pixels from both ends.
+ *
+ * Reversing the row order is a vertical flip, reversing every row a
+ * horizontal one, and both together a 180 degree rotation. Each pair of
+ * pixels is swapped once, when the first of the two is visited.
+ *
+ * @tparam T Sample type (unsigned char, unsigned short or float).
+ * @tparam C Number of interleaved channels (1 to 4).
+ * @param pixels Row-major pixels, overwritten with the result.
+ * @param reverseRows Whether row y ends up at row height - 1 - y.
+ * @param reverseColumns Whether column x ends up at column width - 1 - x.
+ */
+template <typename T, int C>
+static void mirrorInPlace(T *pixels, int width, int height, bool reverseRows,
+                          bool reverseColumns) {
+  const size_t rowSamples = static_cast<size_t>(width) * C;
+  for (int y = 0; y < height; y++) {
+    const int mirrorY = reverseRows ? height - 1 - y : y;
+    if (mirrorY < y) {
+      break; // The remaining rows were swapped from the other end
+    }
+    T *row = pixels + y * rowSamples;
+    T *mirrorRow = pixels + mirrorY * rowSamples;
+    if (!reverseColumns) {
+      if (mirrorY != y) {
+        swap_ranges(row, row + rowSamples, mirrorRow);
+      }
+      continue;
+    }
+    // On the middle row only the left half swaps with the right half
+    const int columns = mirrorY == y ? width / 2 : width;
+    for (int x = 0; x < columns; x++) {
+      T *a = row + static_cast<size_t>(x) * C;
+      T *b = mirrorRow + static_cast<size_t>(width - 1 - x) * C;
+      for (int c = 0; c < C; c++) {
+        swap(a[c], b[c]);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Whether an unrotated warp can write over its own source.
+ *
+ * The warp kernels visit the destination in row-major order and read the
+ * source pixels of each destination pixel before writing it. Writing in
+ * place is therefore safe when no destination pixel reads a source pixel
+ * stored before it, i.e. when minRow(i) * srcWidth + minColumn(j) is at
+ * least i * dstWidth + j for every row i and column j. For an axis-aligned
+ * mapping both minima are separable, so the check costs one pass over the
+ * columns and one over the rows.
+ *
+ * @param inverse Matrix mapping destination offsets to source offsets.
+ * @param bilinear Whether the kernel reads the 2 x 2 neighbourhood.
+ */
+static bool warpFitsInPlace(int srcWidth, int srcHeight, int dstWidth,
+                            int dstHeight, const Eigen::Matrix2f &inverse,
+                            bool bilinear) {
+  if (dstWidth > srcWidth || dstHeight > srcHeight || inverse(0, 1) != 0 ||
+      inverse(1, 0) != 0 || inverse(0, 0) < 0 || inverse(1, 1) < 0) {
+    return false;
+  }
+  const WarpMapping mapping =
+      makeWarpMapping(srcWidth, srcHeight, dstWidth, dstHeight, inverse);
+  // First source row or column read; pixels outside the source are not read
+  auto firstRead = [&](float position) -> long long {
+    int first = bilinear ? static_cast<int>(floor(position))
+                         : static_cast<int>(round(position));
+    return max(first, 0);
+  };
+
+  long long slack = numeric_limits<long long>::max();
+  for (int j = 0; j < dstWidth; j++) {
+    slack = min(slack, firstRead(mapping.sourceX(j, 0)) - j);
+  }
+  for (int i = 0; i < dstHeight; i++) {
+    if (firstRead(mapping.sourceY(0, i)) * srcWidth + slack <
+        static_cast<long long>(i) * dstWidth) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Kernel adaptors that reinterpret raw pixel buffers as samples.
+ *
+ * Each adaptor exposes a static `run` taking byte pointers, so a single
+ * dispatcher can instantiate it for every depth and channel count. The warp
+ * adaptors also pick the source layout instantiation.
+ */
+template <typename T, int C> struct WarpNearestKernel {
+  static void run(const unsigned char *src, int srcWidth, int srcHeight,
+                  unsigned char *dst, int dstWidth, int dstHeight,
+                  const Eigen::Matrix2f &inverse, const SourceLayout &source,
+                  int blockSize) {
+    const T *in = reinterpret_cast<const T *>(src);
+    T *out = reinterpret_cast<T *>(dst);
+    if (source.tileShift > 0) {
+      TiledLayout tiled = {source.tileShift, (1 << source.tileShift) - 1,
+                           source.tilesPerRow};
+      warpNearest<T, C>(in, tiled, srcWidth, srcHeight, out, dstWidth,
+                        dstHeight, inverse, blockSize);
+    } else {
+      RowMajorLayout rows = {srcWidth};
+      warpNearest<T, C>(in, rows, srcWidth, srcHeight, out, dstWidth,
+                        dstHeight, inverse, blockSize);
+    }
+  }
+};
+
+template <typename T, int C> struct WarpBilinearKernel {
+  template <bool Linear>
+  static void runLayout(const T *in, int srcWidth, int srcHeight, T *out,
+                        int dstWidth, int dstHeight,
+                        const Eigen::Matrix2f &inverse,
+                        const SourceLayout &source, int blockSize) {
+    if (source.tileShift > 0) {
+      TiledLayout tiled = {source.tileShift, (1 << source.tileShift) - 1,
+                           source.tilesPerRow};
+      warpBilinear<T, C, Linear>(in, tiled, srcWidth, srcHeight, out,
+                                 dstWidth, dstHeight, inverse, blockSize);
+    } else {
+      RowMajorLayout rows = {srcWidth};
+      warpBilinear<T, C, Linear>(in, rows, srcWidth, srcHeight, out, dstWidth,
+                                 dstHeight, inverse, blockSize);
+    }
+  }
+
+  static void run(const unsigned char *src, int srcWidth, int srcHeight,
+                  unsigned char *dst, int dstWidth, int dstHeight,
+                  const Eigen::Matrix2f &inverse, const SourceLayout &source,
+                  int blockSize, bool linearLight) {
+    const T *in = reinterpret_cast<const T *>(src);
+    T *out = reinterpret_cast<T *>(dst);
+    if (linearLight) {
+      runLayout<true>(in, srcWidth, srcHeight, out, dstWidth, dstHeight,
+                      inverse, source, blockSize);
+    } else {
+      runLayout<false>(in, srcWidth, srcHeight, out, dstWidth, dstHeight,
+                       inverse, source, blockSize);
+    }
+  }
+};
+
+template <typename T, int C> struct ScaleBilinearKernel {
+  static void run(const unsigned char *src, int srcWidth, int srcHeight,
+                  unsigned char *dst, int dstWidth, int dstHeight,
+                  bool linearLight) {
+    if (linearLight) {
+      scaleBilinear<T, C, true>(reinterpret_cast<const T *>(src), srcWidth,
+                                srcHeight, reinterpret_cast<T *>(dst),
+                                dstWidth, dstHeight);
+    } else {
+      scaleBilinear<T, C, false>(reinterpret_cast<const T *>(src), srcWidth,
+                                 srcHeight, reinterpret_cast<T *>(dst),
+                                 dstWidth, dstHeight);
+    }
+  }
+};
+
+template <typename T, int C> struct IntegerScaleKernel {
+  template <bool Linear>
+  static void runLinear(const T *in, int srcWidth, int srcHeight, T *out,
+                        int dstWidth, int dstHeight, int ratio, bool bilinear,
+                        bool clampEdges) {
+    if (ratio > 0) {
+      upscaleInteger<T, C, Linear>(in, srcWidth, srcHeight, out, ratio,
+                                   bilinear, clampEdges);
+    } else {
+      downscaleBox<T, C, Linear>(in, srcWidth, out, dstWidth, dstHeight,
+                                 -ratio);
+    }
+  }
+
+  static void run(const unsigned char *src, int srcWidth, int srcHeight,
+                  unsigned char *dst, int dstWidth, int dstHeight, int ratio,
+                  bool bilinear, bool clampEdges, bool linearLight) {
+    // 8-bit samples without alpha or linear light take the integer paths
+    if (sizeof(T) == 1 && C != 2 && C != 4 && !linearLight) {
+      switch (ratio) {
+      case -2:
+        downscaleBox8<C, 2>(src, srcWidth, dst, dstWidth, dstHeight);
+        return;
+      case -3:
+        downscaleBox8<C, 3>(src, srcWidth, dst, dstWidth, dstHeight);
+        return;
+      case -4:
+        downscaleBox8<C, 4>(src, srcWidth, dst, dstWidth, dstHeight);
+        return;
+      default:
+        if (bilinear) {
+          upscaleBilinear8<C>(src, srcWidth, srcHeight, dst, ratio,
+                              clampEdges);
+          return;
+        }
+        break;
+      }
+    }
+    const T *in = reinterpret_cast<const T *>(src);
+    T *out = reinterpret_cast<T *>(dst);
+    if (linearLight) {
+      runLinear<true>(in, srcWidth, srcHeight, out, dstWidth, dstHeight,
+                      ratio, bilinear, clampEdges);
+    } else {
+      runLinear<false>(in, srcWidth, srcHeight, out, dstWidth, dstHeight,
+                       ratio, bilinear, clampEdges);
+    }
+  }
+};
+
+template <typename T, int C> struct MirrorKernel {
+  static void run(unsigned char *pixels, int width, int height,
+                  bool reverseRows, bool reverseColumns) {
+    mirrorInPlace<T, C>(reinterpret_cast<T *>(pixels), width, height,
+                        reverseRows, reverseColumns);
+  }
+};
+
+/**
+ * @brief Instantiates a kernel adaptor for the given channel count.
+ */
+template <template <typename, int> class Kernel, typename T,
+          typename... Args>
+static bool dispatchChannels(int channels, Args &&...args) {
+  switch (channels) {
+  case 1:
+    Kernel<T, 1>::run(args...);
+    return true;
+  case 2:
+    Kernel<T, 2>::run(args...);
+    return true;
+  case 3:
+    Kernel<T, 3>::run(args...);
+    return true;
+  case 4:
+    Kernel<T, 4>::run(args...);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+ * @brief Runs a kernel adaptor instantiated for a pixel format.
+ *
+ * @param depth Sample depth of both buffers.
+ * @param channels Interleaved channel count of both buffers.
+ * @param args Arguments forwarded to the adaptor's `run`.
+ * @return bool False (with an error message) for unsupported formats.
+ */
+template <template <typename, int> class Kernel, typename... Args>
+static bool dispatchPixelFormat(SampleDepth depth, int channels,
+                                Args &&...args) {
+  bool handled = false;
+  switch (depth) {
+  case DEPTH_8:
+    handled = dispatchChannels<Kernel, unsigned char>(channels, args...);
+    break;
+  case DEPTH_16:
+    handled = dispatchChannels<Kernel, unsigned short>(channels, args...);
+    break;
+  case DEPTH_FLOAT:
+    handled = dispatchChannels<Kernel, float>(channels, args...);
+    break;
+  default:
+    break;
+  }
+  if (!handled) {
+    cerr << "[ERROR] Formato de píxel no soportado: " << channels
+         << " canales, " << sampleDepthName(depth) << "\n";
+  }
+  return handled;
+}
+
+/**
+ * @brief Loads an image from the specified file path.
+ *
+ * This function uses the `stbi_load` function to load the image and store
+ * its data in the class. It prints the image's dimensions and the number
+ * of color channels. If an error occurs, it outputs an error message.
+ *
+ * When `desiredChannels` is non-zero, stb converts the pixels to that layout
+ * while decoding (1 = gray, 2 = gray+alpha, 3 = RGB, 4 = RGBA), so channels
+ * that would be dropped later are never processed.
+ *
+ * The sample depth selects the stb decoder: `stbi_load` for 8 bits,
+ * `stbi_load_16` for 16 bits and `stbi_loadf` for linear float. With
+ * `DEPTH_AUTO` the file's native depth is kept (HDR files decode to float,
+ * 16-bit PNG/PNM to 16 bits, everything else to 8 bits).
+ *
+ * Baseline JPEGs written with restart markers are decoded at 8 bits with
+ * `threads` threads (see decodeJpegPixels). Per core that decoder costs
+ * about twice stb_image's SIMD one, so fewer than three threads, and files
+ * without restart markers, use stb_image.
+ *
+ * @param path The file path of the image to load.
+ * @param desiredChannels Channel count to decode to, or 0 to keep the file's.
+ * @param requestedDepth Sample depth to decode to.
+ * @param threads Threads for JPEGs with restart markers.
+ */
+void Image::image(const char *path, int desiredChannels,
+                  SampleDepth requestedDepth, int threads) {
+  if (desiredChannels < 0 || desiredChannels > 4) {
+    cerr << "[ERROR] Canales solicitados inválidos: " << desiredChannels
+         << " (use 1-4, o 0 para los del archivo)\n";
+    return;
+  }
+
+  depth = requestedDepth;
+  if (depth == DEPTH_AUTO) {
+    depth = stbi_is_hdr(path)       ? DEPTH_FLOAT
+            : stbi_is_16_bit(path) ? DEPTH_16
+                                   : DEPTH_8;
+  }
+
+  // Load the image and store it in the class members
+  int fileChannels = 0;
+  switch (depth) {
+  case DEPTH_16:
+    data = reinterpret_cast<unsigned char *>(
+        stbi_load_16(path, &width, &height, &fileChannels, desiredChannels));
+    break;
+  case DEPTH_FLOAT:
+    data = reinterpret_cast<unsigned char *>(
+        stbi_loadf(path, &width, &height, &fileChannels, desiredChannels));
+    break;
+  default: {
+    string error;
+    if (threads >= MIN_DECODE_THREADS && jpegUsesRestartMarkers(path) &&
+        decodeJpegPixels(path, desiredChannels, threads, data, width, height,
+                         fileChannels, error)) {
+      cout << "[INFO] JPEG con marcadores de reinicio decodificado con "
+           << threads << " hilos\n";
+    } else {
+      data = stbi_load(path, &width, &height, &fileChannels, desiredChannels);
+    }
+    break;
+  }
+  }
+  // stb reports the file's channel count even when it converted the pixels
+  channels = desiredChannels != 0 ? desiredChannels : fileChannels;
+
+  if (data) {
+    reportLoaded(fileChannels);
+  } else {
+    cerr << "+---------------------------+\n";
+    cerr << "   Error al cargar imagen  \n";
+    cerr << "+---------------------------+\n";
+    cerr << " Motivo: " << stbi_failure_reason() << "\n";
+  }
+}
+
+/**
+ * @brief Prints the load report and sizes the buddy pool for the image.
+ *
+ * @param fileChannels Channel count stored in the file.
+ */
+void Image::reportLoaded(int fileChannels) {
+  cout << "+---------------------------+\n";
+  cout << "       Imagen Cargada      \n";
+  cout << "+---------------------------+\n";
+  cout << " Dimensiones: " << width << " x " << height << "\n";
+  cout << " Canales: " << channels << " (" << channelLayoutName(channels)
+       << ")";
+  if (channels != fileChannels) {
+    cout << " [archivo: " << fileChannels << "]";
+  }
+  cout << " \n";
+  cout << " Profundidad: " << sampleDepthName(depth) << "\n";
+  if (buddyManager == nullptr) {
+    // Allocate enough memory for transformations (e.g., 4x the original image
+    // size)
+    size_t estimatedSize =
+        static_cast<size_t>(width) * height * getBytesPerPixel() * 4;
+    buddyManager = new BuddyMemoryManager(estimatedSize);
+  }
+}
+
+/**
+ * @brief Extracts the color and alpha channels of the loaded image.
+ *
+ * Works for every interleaved layout stb can return. Gray images fill the
+ * red, green and blue planes with the same luma value, and images without
+ * alpha get a fully opaque alpha plane, so callers can treat every image as
+ * RGBA. Integer depths keep their native range (0-255 or 0-65535); float
+ * samples are scaled to 0-255. The function prints a success message once
+ * the channels are extracted.
+ */
+void Image::extractChannels() {
+  if (!data) {
+    cerr << "[ERROR] No hay datos de imagen para extraer canales\n";
+    return;
+  }
+
+  canalRojo.assign(height, vector<int>(width));
+  canalVerde.assign(height, vector<int>(width));
+  canalAzul.assign(height, vector<int>(width));
+  canalAlfa.assign(height, vector<int>(width));
+
+  const int colorChannels = hasAlpha() ? channels - 1 : channels;
+  const int opaque = depth == DEPTH_16 ? 65535 : 255;
+
+  auto sample = [&](size_t index) -> int {
+    switch (depth) {
+    case DEPTH_16:
+      return reinterpret_cast<const unsigned short *>(data)[index];
+    case DEPTH_FLOAT:
+      return toSample<unsigned char>(
+          reinterpret_cast<const float *>(data)[index] * 255.0f + 0.5f);
+    default:
+      return data[index];
+    }
+  };
+
+  for (int i = 0; i < height; i++) {
+    for (int j = 0; j < width; j++) {
+      const size_t pixel = (static_cast<size_t>(i) * width + j) * channels;
+      if (colorChannels >= 3) {
+        canalRojo[i][j] = sample(pixel);
+        canalVerde[i][j] = sample(pixel + 1);
+        canalAzul[i][j] = sample(pixel + 2);
+      } else {
+        canalRojo[i][j] = canalVerde[i][j] = canalAzul[i][j] = sample(pixel);
+      }
+      canalAlfa[i][j] = hasAlpha() ? sample(pixel + channels - 1) : opaque;
+    }
+  }
+
+  cout << "Canales extraídos.\n";
+}
+
+/**
+ * @brief Rotates the image by a specified angle.
+ *
+ * This function performs a 2D rotation transformation on the image. The
+ * angle is provided in degrees, and the function calculates the new
+ * bounding box size to accommodate the rotated image. The rotated image is
+ * then saved to the disk.
+ *
+ * @param angle The angle by which to rotate the image in degrees.
+ */
+void Image::rotateImage(int angle) {
+  // Convert angle to radians
+  double radians = angle * M_PI / 180.0;
+
+  // Compute new bounding box dimensions
+  int newWidth = abs(width * cos(radians)) + abs(height * sin(radians));
+  int newHeight = abs(width * sin(radians)) + abs(height * cos(radians));
+
+  // Define the rotation matrix using Eigen
+  Eigen::Matrix2f rotationMatrix;
+  rotationMatrix << cos(radians), -sin(radians), sin(radians), cos(radians);
+
+  // Create new blank image data
+  Image rotatedImage;
+  rotatedImage.useBuddySystem = useBuddySystem;
+  rotatedImage.data = allocatePixels(
+      static_cast<size_t>(newWidth) * newHeight * getBytesPerPixel(),
+      useBuddySystem);
+
+  rotatedImage.width = newWidth;
+  rotatedImage.height = newHeight;
+  rotatedImage.channels = channels;
+  rotatedImage.depth = depth;
+
+  // Map every pixel in the new image back to the original
+  dispatchPixelFormat<WarpNearestKernel>(
+      depth, channels, data, width, height, rotatedImage.data, newWidth,
+      newHeight, rotationMatrix.inverse(), SourceLayout(), 0);
+
+  cout << "Rotación completa" << endl;
+
+  rotatedImage.saveAndRelease("./output/rotated.jpg");
+}
+
+/**
+ * @brief Scales the image by a specified factor.
+ *
+ * This function resizes the image based on a scale factor. It performs
+ * bilinear interpolation to ensure the image is scaled smoothly. The scaled
+ * image is then saved to the disk.
+ *
+ * Exact 2x, 3x and 4x ratios (and 1/2, 1/3, 1/4 when the size divides)
+ * use the integer-ratio kernels instead: box averaging down, fixed-weight
+ * blending up, with pixel centres aligned and edge samples repeated.
+ *
+ * @param scaleFactor The factor by which to scale the image.
+ * @param linearLight Whether to blend 8-bit sRGB samples in linear light,
+ * which keeps downscaled edges from darkening.
+ */
+void Image::scaleImage(float scaleFactor, bool linearLight) {
+  if (scaleFactor <= 0) {
+    cerr << "El factor de escala debe ser mayor que 0." << endl;
+    return;
+  }
+
+  // Calculate new size
+  int newWidth = static_cast<int>(width * scaleFactor);
+  int newHeight = static_cast<int>(height * scaleFactor);
+
+  // Create new blank image data
+  Image scaledImage;
+  scaledImage.useBuddySystem = useBuddySystem;
+  scaledImage.data = allocatePixels(
+      static_cast<size_t>(newWidth) * newHeight * getBytesPerPixel(),
+      useBuddySystem);
+
+  scaledImage.width = newWidth;
+  scaledImage.height = newHeight;
+  scaledImage.channels = channels;
+  scaledImage.depth = depth;
+
+  // Interpolation
+  const int ratio = integerScaleRatio(width, height, newWidth, newHeight);
+  if (ratio != 0) {
+    dispatchPixelFormat<IntegerScaleKernel>(depth, channels, data, width,
+                                            height, scaledImage.data, newWidth,
+                                            newHeight, ratio, true, true,
+                                            linearLight);
+  } else {
+    dispatchPixelFormat<ScaleBilinearKernel>(
+        depth, channels, data, width, height, scaledImage.data, newWidth,
+        newHeight, linearLight);
+  }
+
+  cout << "Escalado completado! Nuevo tamaño: " << newWidth << " x "
+       << newHeight << endl;
+
+  scaledImage.saveAndRelease("./output/scaled.jpg");
+}
+
+/**
+ * @brief Clips a crop rectangle to the image.
+ *
+ * @return bool False when the rectangle is empty or outside the image.
+ */
+static bool clampCropRect(const CropRect &crop, int width, int height,
+                          CropRect &clamped) {
+  clamped.x = max(0, crop.x);
+  clamped.y = max(0, crop.y);
+  clamped.width = min(crop.x + crop.width, width) - clamped.x;
+  clamped.height = min(crop.y + crop.height, height) - clamped.y;
+  return clamped.width > 0 && clamped.height > 0;
+}
+
+/**
+ * @brief Keeps only a rectangular region of the image.
+ *
+ * Rows are moved to the front of the existing buffer (each destination row
+ * starts at or before its source row), so no second buffer is needed. The
+ * rectangle is clipped to the image.
+ *
+ * @param crop The region to keep, in pixels.
+ * @return bool False when the region does not overlap the image.
+ */
+bool Image::cropImage(const CropRect &crop) {
+  CropRect region;
+  if (!data || !clampCropRect(crop, width, height, region)) {
+    cerr << "[ERROR] Recorte fuera de la imagen\n";
+    return false;
+  }
+
+  const size_t pixelBytes = getBytesPerPixel();
+  const size_t rowBytes = static_cast<size_t>(region.width) * pixelBytes;
+  for (int y = 0; y < region.height; y++) {
+    memmove(data + y * rowBytes,
+            data + ((static_cast<size_t>(region.y) + y) * width + region.x) *
+                       pixelBytes,
+            rowBytes);
+  }
+  width = region.width;
+  height = region.height;
+  return true;
+}
+
+/**
+ * @brief Tells whether a path ends in the given extension, dot included.
+ */
+bool hasExtension(const string &path, const char *extension) {
+  const size_t length = strlen(extension);
+  return path.size() >= length &&
+         path.compare(path.size() - length, length, extension) == 0;
+}
+
+/**
+ * @brief Computes the output size of a rotation + scale under a canvas
+ * policy.
+ *
+ * - `CANVAS_EXPAND` keeps the whole rotated image (the rotated bounding box).
+ * - `CANVAS_ORIGINAL` keeps the frame of the scaled source, cropping the
+ *   rotated corners.
+ * - `CANVAS_INNER` keeps the largest axis-aligned rectangle that fits inside
+ *   the rotated image, so the result has no black border at all.
+ *
+ * The canvas is always centred on the rotated image, so a smaller canvas is
+ * a centred crop of the expanded one.
+ *
+ * @param width Source width in pixels.
+ * @param height Source height in pixels.
+ * @param scaleFactor The scaling factor.
+ * @param angle The rotation angle in degrees.
+ * @param mode The canvas policy.
+ * @param canvasWidth Receives the output width.
+ * @param canvasHeight Receives the output height.
+ */
+void computeCanvasSize(int width, int height, float scaleFactor, int angle,
+                       CanvasMode mode, int &canvasWidth, int &canvasHeight) {
+  double radians = angle * M_PI / 180.0;
+  double scaledWidth = width * scaleFactor;
+  double scaledHeight = height * scaleFactor;
+  double sinA = abs(sin(radians));
+  double cosA = abs(cos(radians));
+
+  switch (mode) {
+  case CANVAS_ORIGINAL:
+    canvasWidth = static_cast<int>(scaledWidth);
+    canvasHeight = static_cast<int>(scaledHeight);
+    break;
+  case CANVAS_INNER: {
+    // Largest axis-aligned rectangle inside a w x h rectangle rotated by the
+    // angle. When the short side is the limit, the rectangle touches both
+    // long sides (half-constrained case); otherwise all four sides.
+    bool widthIsLonger = scaledWidth >= scaledHeight;
+    double longSide = widthIsLonger ? scaledWidth : scaledHeight;
+    double shortSide = widthIsLonger ? scaledHeight : scaledWidth;
+    double innerWidth, innerHeight;
+    if (shortSide <= 2.0 * sinA * cosA * longSide ||
+        abs(sinA - cosA) < 1e-10) {
+      double half = 0.5 * shortSide;
+      innerWidth = widthIsLonger ? half / sinA : half / cosA;
+      innerHeight = widthIsLonger ? half / cosA : half / sinA;
+    } else {
+      double cos2A = cosA * cosA - sinA * sinA;
+      innerWidth = (scaledWidth * cosA - scaledHeight * sinA) / cos2A;
+      innerHeight = (scaledHeight * cosA - scaledWidth * sinA) / cos2A;
+    }
+    // Nearest and bilinear sampling reach half a pixel past the exact edge,
+    // so keep a one-pixel margin on each side unless pixels map one-to-one
+    bool oneToOne = scaleFactor == 1.0f && (sinA < 1e-6 || cosA < 1e-6);
+    int margin = oneToOne ? 0 : 2;
+    // The epsilon absorbs the rounding error of sin/cos at right angles
+    canvasWidth = max(static_cast<int>(innerWidth + 1e-6) - margin, 1);
+    canvasHeight = max(static_cast<int>(innerHeight + 1e-6) - margin, 1);
+    break;
+  }
+  default:
+    canvasWidth = scaledWidth * cosA + scaledHeight * sinA;
+    canvasHeight = scaledWidth * sinA + scaledHeight * cosA;
+    break;
+  }
+}
+
+/**
+ * @brief Builds the forward matrix of a flip, rotation and scale.
+ *
+ * The mirror is applied first, so it is relative to the source axes.
+ *
+ * @param angle Clockwise rotation in degrees.
+ * @param scaleFactor The scaling factor.
+ * @param flip Mirror applied before the rotation.
+ * @return Eigen::Matrix2f Matrix mapping source offsets to output offsets.
+ */
+static Eigen::Matrix2f buildTransformMatrix(int angle, float scaleFactor,
+                                           FlipMode flip) {
+  double radians = angle * M_PI / 180.0;
+
+  Eigen::Matrix2f transformMatrix;
+  transformMatrix << scaleFactor * cos(radians), -scaleFactor * sin(radians),
+      scaleFactor * sin(radians), scaleFactor * cos(radians);
+
+  if (flip != FLIP_NONE) {
+    Eigen::Matrix2f flipMatrix = Eigen::Matrix2f::Identity();
+    const int axis = flip == FLIP_HORIZONTAL ? 0 : 1;
+    flipMatrix(axis, axis) = -1.0f;
+    transformMatrix = transformMatrix * flipMatrix;
+  }
+  return transformMatrix;
+}
+
+/**
+ * @brief Resolves the JPEG decode thread count of a request.
+ *
+ * @return int `options.threads`, or the core count when it is 0.
+ */
+static int decoderThreads(const TransformOptions &options) {
+  if (options.threads > 0) {
+    return options.threads;
+  }
+  return max(1, static_cast<int>(thread::hardware_concurrency()));
+}
+
+/**
+ * @brief Maps a flip followed by a right-angle rotation to a single DCT
+ * domain transform.
+ *
+ * @param flip Mirror applied first.
+ * @param angle Clockwise rotation in {0, 90, 180, 270}.
+ * @return JpegTransform The equivalent transform.
+ */
+static JpegTransform jpegTransformFor(FlipMode flip, int angle) {
+  static const JpegTransform table[3][4] = {
+      {JPEG_NONE, JPEG_ROT_90, JPEG_ROT_180, JPEG_ROT_270},
+      {JPEG_FLIP_H, JPEG_TRANSVERSE, JPEG_FLIP_V, JPEG_TRANSPOSE},
+      {JPEG_FLIP_V, JPEG_TRANSPOSE, JPEG_FLIP_H, JPEG_TRANSVERSE},
+  };
+  return table[flip][angle / 90];
+}
+
+/**
+ * @brief Folds an EXIF orientation into a requested flip and rotation.
+ *
+ * The orientation is first written as a horizontal flip followed by a
+ * clockwise right angle (5, transpose, is a flip then 270 degrees). The
+ * requested transform then runs after it; a requested mirror moves past
+ * the orientation's rotation by negating it (F R(a) = R(-a) F), and a
+ * vertical mirror is a horizontal one turned by 180 degrees. The result is
+ * again one flip followed by one rotation, so the pipeline still makes a
+ * single pass.
+ *
+ * @param orientation EXIF orientation, 1 to 8.
+ * @param angle Requested clockwise rotation; receives the combined one.
+ * @param flip Requested mirror; receives the combined one.
+ */
+static void foldOrientation(int orientation, int &angle, FlipMode &flip) {
+  static const bool orientationFlips[9] = {false, false, true,  false, true,
+                                           true,  false, true,  false};
+  static const int orientationAngles[9] = {0, 0, 0, 180, 180, 270, 90, 90,
+                                           270};
+  if (orientation < 2 || orientation > 8) {
+    return;
+  }
+  const bool flips = orientationFlips[orientation];
+  const int turn = orientationAngles[orientation];
+
+  if (flip == FLIP_NONE) {
+    angle += turn;
+    flip = flips ? FLIP_HORIZONTAL : FLIP_NONE;
+  } else {
+    angle += (flip == FLIP_VERTICAL ? 180 : 0) - turn;
+    flip = flips ? FLIP_NONE : FLIP_HORIZONTAL;
+  }
+  angle = ((angle % 360) + 360) % 360;
+}
+
+/**
+ * @brief Decodes only the MCU-aligned part of a JPEG that covers a crop.
+ *
+ * The crop is widened to the MCU grid at its top-left corner, the blocks of
+ * that region are re-entropy-coded into a small in-memory JPEG, and only
+ * that JPEG goes through stb's IDCT, upsampling and colour conversion. The
+ * remaining offset (under one MCU) is trimmed in the pixel domain.
+ *
+ * @param path The JPEG file.
+ * @param crop The region to keep, in source pixels.
+ * @param desiredChannels Channel count to decode to, or 0 for the file's.
+ * @param requestedDepth Sample depth to decode to.
+ * @return bool False if the file is not a baseline JPEG; the caller then
+ * decodes the whole image.
+ */
+bool Image::loadJpegRegion(const string &path, const CropRect &crop,
+                           int desiredChannels, SampleDepth requestedDepth) {
+  JpegCoefficients jpeg;
+  string error;
+  CropRect region;
+  if (desiredChannels < 0 || desiredChannels > 4 || !isJpegFile(path) ||
+      !readJpegCoefficients(path, jpeg, error) ||
+      !clampCropRect(crop, jpeg.width, jpeg.height, region)) {
+    return false;
+  }
+
+  const int alignedX = region.x - region.x % (8 * jpeg.maxH);
+  const int alignedY = region.y - region.y % (8 * jpeg.maxV);
+  cropJpegCoefficients(jpeg, alignedX, alignedY,
+                       region.x + region.width - alignedX,
+                       region.y + region.height - alignedY);
+
+  vector<unsigned char> encoded;
+  encodeJpegCoefficients(jpeg, encoded);
+
+  depth = requestedDepth == DEPTH_AUTO ? DEPTH_8 : requestedDepth;
+  int fileChannels = 0;
+  const int size = static_cast<int>(encoded.size());
+  switch (depth) {
+  case DEPTH_16:
+    data = reinterpret_cast<unsigned char *>(
+        stbi_load_16_from_memory(encoded.data(), size, &width, &height,
+                                 &fileChannels, desiredChannels));
+    break;
+  case DEPTH_FLOAT:
+    data = reinterpret_cast<unsigned char *>(
+        stbi_loadf_from_memory(encoded.data(), size, &width, &height,
+                               &fileChannels, desiredChannels));
+    break;
+  default:
+    data = stbi_load_from_memory(encoded.data(), size, &width, &height,
+                                 &fileChannels, desiredChannels);
+    break;
+  }
+  if (!data) {
+    return false;
+  }
+  channels = desiredChannels != 0 ? desiredChannels : fileChannels;
+
+  cout << "[INFO] Recorte en dominio comprimido: bloques desde (" << alignedX
+       << ", " << alignedY << "), " << width << "x" << height << "\n";
+
+  CropRect residual;
+  residual.x = region.x - alignedX;
+  residual.y = region.y - alignedY;
+  residual.width = region.width;
+  residual.height = region.height;
+  cropImage(residual);
+  reportLoaded(fileChannels);
+  return true;
+}
+
+/**
+ * @brief Delivers the pending preview of the current transform, if any:
+ * the source warped with nearest neighbour onto a reduced canvas.
+ *
+ * It reuses the full render's plan (the canvas size and the inverse
+ * matrix, scaled to the preview) and reads the source pixels directly, so
+ * it costs one gather per preview pixel and no copy of the source. A
+ * transform delivers at most one preview, whichever path it ends up on.
+ *
+ * @param source The decoded pixels, row-major.
+ * @param outputWidth Width of the full-quality output.
+ * @param outputHeight Height of the full-quality output.
+ * @param inverse The full render's inverse matrix, in source pixels.
+ * @param start When the transform started.
+ */
+static void renderPreview(const unsigned char *source, int width, int height,
+                          int channels, SampleDepth depth, int outputWidth,
+                          int outputHeight, const Eigen::Matrix2f &inverse,
+                          chrono::high_resolution_clock::time_point start,
+                          bool showOutput) {
+  const function<void(const PreviewImage &)> *preview = pendingPreview;
+  if (!preview) {
+    return;
+  }
+  pendingPreview = nullptr;
+  const double reduction =
+      min(1.0, static_cast<double>(max(previewSide, 1)) /
+                   max(outputWidth, outputHeight));
+  const int previewWidth =
+      max(1, static_cast<int>(lround(outputWidth * reduction)));
+  const int previewHeight =
+      max(1, static_cast<int>(lround(outputHeight * reduction)));
+  Eigen::Matrix2f stretch = Eigen::Matrix2f::Zero();
+  stretch(0, 0) = static_cast<float>(outputWidth) / previewWidth;
+  stretch(1, 1) = static_cast<float>(outputHeight) / previewHeight;
+
+  vector<unsigned char> pixels(static_cast<size_t>(previewWidth) *
+                               previewHeight * channels * depth);
+  // A preview is not worth a preemption point
+  const function<void()> *yield = tileYield;
+  tileYield = nullptr;
+  dispatchPixelFormat<WarpNearestKernel>(
+      depth, channels, source, width, height, pixels.data(), previewWidth,
+      previewHeight, Eigen::Matrix2f(inverse * stretch), SourceLayout(), 0);
+  tileYield = yield;
+
+  PreviewImage image = {pixels.data(), previewWidth, previewHeight, channels,
+                        depth, 0};
+  image.elapsedMs = chrono::duration<double, milli>(
+                        chrono::high_resolution_clock::now() - start)
+                        .count();
+  metricsRecord(STAGE_PREVIEW, image.elapsedMs);
+  if (showOutput) {
+    cout << " Vista previa: " << previewWidth << "x" << previewHeight
+         << " en " << round(image.elapsedMs * 10) / 10 << " ms \n";
+  }
+  (*preview)(image);
+}
+
+/**
+ * @brief Delivers the pending preview from a JPEG's DC image (1/8 of the
+ * frame size, rounded up) by mapping the full render's inverse onto it.
+ *
+ * @param frameWidth Width of the frame the DC image was built from.
+ * @param frameHeight Height of that frame.
+ */
+static void renderDcPreview(const vector<unsigned char> &pixels, int width,
+                            int height, int channels, int frameWidth,
+                            int frameHeight, int outputWidth,
+                            int outputHeight, const Eigen::Matrix2f &inverse,
+                            chrono::high_resolution_clock::time_point start,
+                            bool showOutput) {
+  Eigen::Matrix2f shrink = Eigen::Matrix2f::Zero();
+  shrink(0, 0) = static_cast<float>(width) / frameWidth;
+  shrink(1, 1) = static_cast<float>(height) / frameHeight;
+  renderPreview(pixels.data(), width, height, channels, DEPTH_8, outputWidth,
+                outputHeight, Eigen::Matrix2f(shrink * inverse), start,
+                showOutput);
+}
+
+/**
+ * @brief Delivers the pending preview of a compressed-domain transform from
+ * the image the JPEG's DC coefficients hold, 1/8 of the frame size, so the
+ * output keeps its own path. Colour spaces decodeJpegDcImage does not
+ * handle get no preview.
+ *
+ * @param jpeg The coefficients the transform reads.
+ * @param channels Channel count of the output, or 0 for the file's.
+ * @param inverse The full render's inverse matrix, in frame pixels.
+ */
+static void renderDcPreview(const JpegCoefficients &jpeg, int channels,
+                            int outputWidth, int outputHeight,
+                            const Eigen::Matrix2f &inverse,
+                            chrono::high_resolution_clock::time_point start,
+                            bool showOutput) {
+  vector<unsigned char> pixels;
+  int width = 0, height = 0;
+  if (pendingPreview &&
+      decodeJpegDcImage(jpeg, channels, pixels, width, height, channels)) {
+    renderDcPreview(pixels, width, height, channels, jpeg.width, jpeg.height,
+                    outputWidth, outputHeight, inverse, start, showOutput);
+  }
+}
+
+/**
+ * @brief Prints the opening of a processing report: the files, the mode
+ * and the source and output sizes. The caller adds its settings and times
+ * and resets the colour.
+ */
+static void printReportHeader(const string &inputPath,
+                              const string &outputPath, const string &mode,
+                              int sourceWidth, int sourceHeight,
+                              int outputWidth, int outputHeight) {
+  cout << "\033[32m+---------------------------+\n";
+  cout << "       PROCESAMIENTO        \n";
+  cout << "+---------------------------+\n";
+  cout << " Archivo entrada: " << inputPath << " \n";
+  cout << " Archivo salida: " << outputPath << " \n";
+  cout << " Modo: " << mode << "\n";
+  cout << "+---------------------------+\n";
+  cout << " Dimensiones originales: " << sourceWidth << "x" << sourceHeight
+       << " \n";
+  cout << " Dimensiones finales: " << outputWidth << "x" << outputHeight
+       << " \n";
+}
+
+/**
+ * @brief Applies a right-angle rotation and/or flip to a JPEG without
+ * decoding it to pixels.
+ *
+ * The quantised DCT blocks are rearranged and re-entropy-coded, so the
+ * output has exactly the quality of the input (no second quantisation).
+ * Only used when the request is a pure right-angle rotation/flip between
+ * JPEG files at 8 bits with the file's own channels; progressive files and
+ * sizes that are not a whole number of MCUs along a mirrored axis return
+ * false so the caller takes the pixel path.
+ *
+ * @return bool True if the output was written here.
+ */
+bool Image::transformJpegLossless(const string &inputPath,
+                                  const string &outputPath, int angle,
+                                  float scaleFactor, bool showOutput,
+                                  const TransformOptions &options) {
+  using namespace std::chrono;
+
+  const int rightAngle = ((angle % 360) + 360) % 360;
+  if (!options.allowLossless || scaleFactor != 1.0f || rightAngle % 90 != 0 ||
+      options.desiredChannels != 0 ||
+      (options.depth != DEPTH_8 && options.depth != DEPTH_AUTO) ||
+      hasExtension(outputPath, ".png") || hasExtension(outputPath, ".hdr") ||
+      !isJpegFile(inputPath)) {
+    return false;
+  }
+
+  auto start = high_resolution_clock::now();
+
+  JpegCoefficients jpeg;
+  string error;
+  if (!readJpegCoefficients(inputPath, jpeg, error,
+                            decoderThreads(options))) {
+    if (showOutput) {
+      cout << "[INFO] Sin rotación sin pérdida (" << error
+           << "), se usa la ruta de píxeles\n";
+    }
+    return false;
+  }
+
+  // A crop stays lossless when it starts on the MCU grid
+  const int sourceWidth = jpeg.width, sourceHeight = jpeg.height;
+  if (options.crop.width > 0 && options.crop.height > 0) {
+    CropRect region;
+    if (!clampCropRect(options.crop, jpeg.width, jpeg.height, region) ||
+        region.x % (8 * jpeg.maxH) != 0 || region.y % (8 * jpeg.maxV) != 0) {
+      return false;
+    }
+    cropJpegCoefficients(jpeg, region.x, region.y, region.width,
+                         region.height);
+  }
+
+  // The original-frame canvas crops when the axes swap on a non-square image
+  const bool swapsAxes = rightAngle == 90 || rightAngle == 270;
+  if (options.canvas == CANVAS_ORIGINAL && swapsAxes &&
+      jpeg.width != jpeg.height) {
+    return false;
+  }
+
+  JpegTransform transform = jpegTransformFor(options.flip, rightAngle);
+  if (!isLosslessTransformPossible(jpeg, transform)) {
+    if (showOutput) {
+      cout << "[INFO] Sin rotación sin pérdida (tamaño no múltiplo del "
+              "MCU de "
+           << 8 * jpeg.maxH << "x" << 8 * jpeg.maxV
+           << "), se usa la ruta de píxeles\n";
+    }
+    return false;
+  }
+
+  renderDcPreview(jpeg, 0, swapsAxes ? jpeg.height : jpeg.width,
+                  swapsAxes ? jpeg.width : jpeg.height,
+                  buildTransformMatrix(rightAngle, 1.0f, options.flip)
+                      .inverse(),
+                  start, showOutput);
+
+  auto transformStart = high_resolution_clock::now();
+  transformJpegCoefficients(jpeg, transform);
+  if (options.autoOrient) {
+    resetJpegOrientation(jpeg); // The blocks are upright now
+  }
+  lastWarpMs = duration<double, milli>(high_resolution_clock::now() -
+                                       transformStart)
+                   .count();
+
+  if (!writeJpegCoefficients(outputPath, jpeg, error)) {
+    cerr << "[ERROR] Error al guardar la imagen (" << error << ")\n";
+    return false;
+  }
+  width = jpeg.width;
+  height = jpeg.height;
+
+  auto duration =
+      duration_cast<milliseconds>(high_resolution_clock::now() - start);
+  if (showOutput) {
+    printReportHeader(inputPath, outputPath,
+                      "transformación JPEG sin pérdida (dominio DCT)",
+                      sourceWidth, sourceHeight, width, height);
+    if (options.crop.width > 0 && options.crop.height > 0) {
+      cout << " Recorte: " << options.crop.x << ", " << options.crop.y
+           << " (sin pérdida, alineado a MCU)\n";
+    }
+    cout << " Ángulo de rotación: " << rightAngle << " grados\n";
+    cout << " Volteo: "
+         << (options.flip == FLIP_HORIZONTAL
+                 ? "Horizontal"
+                 : options.flip == FLIP_VERTICAL ? "Vertical" : "Ninguno")
+         << " \n";
+    cout << "+---------------------------+\n";
+    cout << "- Tiempo total: " << duration.count() << " ms\n\033[0m";
+  }
+  cout << "[INFO] Imagen guardada correctamente en " << outputPath << "\n";
+  return true;
+}
+
+/**
+ * @brief Warps a JPEG as Y/Cb/Cr planes at their native subsampling.
+ *
+ * The DCT blocks are inverse-transformed straight into planes, each plane
+ * is warped on its own (chroma at its subsampled size, with the transform
+ * conjugated by the subsampling ratios), and the planes are forward-DCT'd
+ * and entropy-coded with the source's quantisation tables and sampling.
+ * This skips stb's chroma upsampling and YCbCr->RGB conversion and the
+ * encoder's RGB->YCbCr conversion and downsampling; for 4:2:0 files the
+ * warp touches 1.5 samples per pixel instead of 3.
+ *
+ * Used for JPEG-to-JPEG requests with `planarYCbCr`, no channel, depth,
+ * linear-light or crop conversion, on baseline gray or YCbCr files.
+ *
+ * @return bool True if the output was written here.
+ */
+bool Image::transformJpegPlanar(const string &inputPath,
+                                const string &outputPath, int angle,
+                                float scaleFactor, bool showOutput,
+                                const TransformOptions &options) {
+  using namespace std::chrono;
+
+  if (!options.planarYCbCr || scaleFactor <= 0 ||
+      options.desiredChannels != 0 ||
+      (options.depth != DEPTH_8 && options.depth != DEPTH_AUTO) ||
+      options.linearLight || options.crop.width > 0 ||
+      hasExtension(outputPath, ".png") || hasExtension(outputPath, ".hdr") ||
+      !isJpegFile(inputPath)) {
+    return false;
+  }
+
+  auto start = high_resolution_clock::now();
+
+  JpegCoefficients jpeg;
+  string error;
+  if (!readJpegCoefficients(inputPath, jpeg, error,
+                            decoderThreads(options)) ||
+      (jpeg.components.size() != 1 && jpeg.components.size() != 3)) {
+    if (showOutput) {
+      cout << "[INFO] Sin ruta YCbCr ("
+           << (error.empty() ? "espacio de color no soportado" : error)
+           << "), se usa la ruta RGB\n";
+    }
+    return false;
+  }
+
+  int newWidth = 0, newHeight = 0;
+  computeCanvasSize(jpeg.width, jpeg.height, scaleFactor, angle,
+                    options.canvas, newWidth, newHeight);
+  renderDcPreview(
+      jpeg, 0, newWidth, newHeight,
+      buildTransformMatrix(angle, scaleFactor, options.flip).inverse(), start,
+      showOutput);
+
+  vector<JpegPlane> planes;
+  decodeJpegPlanes(jpeg, planes);
+
+  // The output keeps the source's components, tables and metadata
+  JpegCoefficients output;
+  output.width = newWidth;
+  output.height = newHeight;
+  output.restartInterval = jpeg.restartInterval;
+  memcpy(output.quantTables, jpeg.quantTables, sizeof(jpeg.quantTables));
+  memcpy(output.quantTablePresent, jpeg.quantTablePresent,
+         sizeof(jpeg.quantTablePresent));
+  output.extraSegments = jpeg.extraSegments;
+  if (options.autoOrient) {
+    resetJpegOrientation(output);
+  }
+  for (const auto &component : jpeg.components) {
+    JpegComponent described;
+    described.id = component.id;
+    described.h = component.h;
+    described.v = component.v;
+    described.quantTable = component.quantTable;
+    output.components.push_back(described);
+  }
+  output.maxH = jpeg.maxH;
+  output.maxV = jpeg.maxV;
+
+  const Eigen::Matrix2f inverse =
+      buildTransformMatrix(angle, scaleFactor, options.flip).inverse();
+  vector<JpegPlane> warped(planes.size());
+
+  auto warpStart = high_resolution_clock::now();
+  for (size_t c = 0; c < planes.size(); c++) {
+    const JpegComponent &component = output.components[c];
+    JpegPlane &plane = warped[c];
+    jpegComponentSize(output, component, plane.width, plane.height);
+    plane.offset = planes[c].offset;
+    plane.samples.assign(static_cast<size_t>(plane.width) * plane.height, 0);
+
+    // Offsets on a subsampled plane are scaled by the sampling ratios
+    Eigen::Matrix2f ratios = Eigen::Matrix2f::Identity();
+    ratios(0, 0) = static_cast<float>(component.h) / output.maxH;
+    ratios(1, 1) = static_cast<float>(component.v) / output.maxV;
+    const Eigen::Matrix2f planeInverse = ratios * inverse * ratios.inverse();
+
+    const unsigned char *src =
+        reinterpret_cast<const unsigned char *>(planes[c].samples.data());
+    unsigned char *dst =
+        reinterpret_cast<unsigned char *>(plane.samples.data());
+    if (options.interpolation == INTERP_BILINEAR) {
+      WarpBilinearKernel<float, 1>::run(src, planes[c].width, planes[c].height,
+                                        dst, plane.width, plane.height,
+                                        planeInverse, SourceLayout(), 0,
+                                        false);
+    } else {
+      WarpNearestKernel<float, 1>::run(src, planes[c].width, planes[c].height,
+                                       dst, plane.width, plane.height,
+                                       planeInverse, SourceLayout(), 0);
+    }
+  }
+  lastWarpMs =
+      duration<double, milli>(high_resolution_clock::now() - warpStart).count();
+
+  encodeJpegPlanes(warped, output);
+  if (!writeJpegCoefficients(outputPath, output, error)) {
+    cerr << "[ERROR] Error al guardar la imagen (" << error << ")\n";
+    return false;
+  }
+  width = newWidth;
+  height = newHeight;
+
+  auto duration =
+      duration_cast<milliseconds>(high_resolution_clock::now() - start);
+  if (showOutput) {
+    printReportHeader(inputPath, outputPath,
+                      "planos YCbCr nativos (" +
+                          to_string(jpeg.components.size()) +
+                          " planos, muestreo " + to_string(jpeg.maxH) + "x" +
+                          to_string(jpeg.maxV) + ")",
+                      jpeg.width, jpeg.height, width, height);
+    cout << " Ángulo de rotación: " << angle << " grados\n";
+    cout << " Factor de escalado: " << scaleFactor << " \n";
+    cout << " Interpolación: "
+         << (options.interpolation == INTERP_BILINEAR ? "Bilineal" : "Vecino")
+         << " \n";
+    cout << "+---------------------------+\n";
+    cout << "- Tiempo de deformación: " << lastWarpMs << " ms\n";
+    cout << "- Tiempo total: " << duration.count() << " ms\n\033[0m";
+  }
+  cout << "[INFO] Imagen guardada correctamente en " << outputPath << "\n";
+  return true;
+}
+
+/**
+ * @brief Scales a JPEG into a JPEG one row at a time.
+ *
+ * Source rows come from a JpegRowReader (three MCU rows of samples), are
+ * resampled horizontally to the output width as they arrive and kept in a
+ * ring of one (nearest) or two (bilinear) rows; each output row is blended
+ * from the ring and handed straight to the row encoder, which writes every
+ * MCU row out as it is coded. Memory is O(width) rather than
+ * O(width x height), plus the compressed input. The geometry and the
+ * zero-outside-the-source edges are those of the warp kernels.
+ *
+ * Used for `streaming` requests that only scale (angle a multiple of 360,
+ * no flip, crop or linear light) a gray or YCbCr baseline JPEG with a single
+ * scan into a JPEG, at 8 bits with 1 or 3 channels.
+ *
+ * @return bool True if the output was written here.
+ */
+bool Image::scaleJpegStreaming(const string &inputPath,
+                               const string &outputPath, int angle,
+                               float scaleFactor, bool showOutput,
+                               const TransformOptions &options) {
+  using namespace std::chrono;
+
+  if (!options.streaming || scaleFactor <= 0 || angle % 360 != 0 ||
+      options.flip != FLIP_NONE || options.linearLight ||
+      options.crop.width > 0 ||
+      (options.desiredChannels != 0 && options.desiredChannels != 1 &&
+       options.desiredChannels != 3) ||
+      (options.depth != DEPTH_8 && options.depth != DEPTH_AUTO) ||
+      hasExtension(outputPath, ".png") || hasExtension(outputPath, ".hdr") ||
+      !isJpegFile(inputPath)) {
+    return false;
+  }
+
+  auto start = high_resolution_clock::now();
+  double memoryBefore = getMemoryUsageMB();
+
+  JpegRowReader reader;
+  string error;
+  if (!reader.open(inputPath, options.desiredChannels, error)) {
+    if (showOutput) {
+      cout << "[INFO] Sin escalado en flujo (" << error
+           << "), se usa la ruta de píxeles\n";
+    }
+    return false;
+  }
+
+  const int srcWidth = reader.width(), srcHeight = reader.height();
+  const int C = reader.channels();
+  int newWidth = 0, newHeight = 0;
+  computeCanvasSize(srcWidth, srcHeight, scaleFactor, 0, options.canvas,
+                    newWidth, newHeight);
+  const WarpMapping mapping = makeWarpMapping(
+      srcWidth, srcHeight, newWidth, newHeight,
+      buildTransformMatrix(0, scaleFactor, FLIP_NONE).inverse());
+
+  // The preview comes from a second reader that only entropy-decodes, so
+  // memory stays at one sample per block
+  JpegRowReader previewReader;
+  vector<unsigned char> previewPixels;
+  int previewWidth = 0, previewHeight = 0;
+  if (pendingPreview &&
+      previewReader.open(inputPath, options.desiredChannels, error) &&
+      previewReader.readDcImage(previewPixels, previewWidth, previewHeight)) {
+    renderDcPreview(previewPixels, previewWidth, previewHeight, C, srcWidth,
+                    srcHeight, newWidth, newHeight,
+                    buildTransformMatrix(0, scaleFactor, FLIP_NONE).inverse(),
+                    start, showOutput);
+  }
+  const bool bilinear = options.interpolation == INTERP_BILINEAR;
+
+  // Source column (the left one when blending) and weight per output column
+  vector<int> columns(newWidth);
+  vector<float> weights(newWidth, 0.0f);
+  for (int j = 0; j < newWidth; j++) {
+    const float srcX = mapping.sourceX(j, 0);
+    columns[j] = bilinear ? static_cast<int>(floor(srcX))
+                          : static_cast<int>(round(srcX));
+    weights[j] = srcX - columns[j];
+  }
+
+  // Ring of horizontally-resampled rows, slot = source row % ring size
+  const int ringSize = bilinear ? 2 : 1;
+  const size_t rowSamples = static_cast<size_t>(newWidth) * C;
+  vector<float> ring(ringSize * rowSamples), zeroRow(rowSamples, 0.0f);
+  vector<int> ringRows(ringSize, -1);
+  int rowsRead = 0;
+
+  // Source rows are asked for in non-decreasing order, so a row that is
+  // not in the ring has not been read yet
+  auto resampledRow = [&](int y) -> const float * {
+    float *slot = &ring[(y % ringSize) * rowSamples];
+    if (ringRows[y % ringSize] == y) {
+      return slot;
+    }
+    const unsigned char *row = nullptr;
+    while (rowsRead <= y) {
+      row = reader.readRow();
+      if (!row) {
+        return nullptr;
+      }
+      rowsRead++;
+    }
+    for (int j = 0; j < newWidth; j++) {
+      const int x = columns[j];
+      float *out = slot + static_cast<size_t>(j) * C;
+      if (!bilinear) {
+        for (int c = 0; c < C; c++) {
+          out[c] = x >= 0 && x < srcWidth ? row[x * C + c] : 0.0f;
+        }
+        continue;
+      }
+      const float dx = weights[j];
+      for (int c = 0; c < C; c++) {
+        const float left = x >= 0 && x < srcWidth ? row[x * C + c] : 0.0f;
+        const float right =
+            x + 1 >= 0 && x + 1 < srcWidth ? row[(x + 1) * C + c] : 0.0f;
+        out[c] = x < -1 || x >= srcWidth ? 0.0f : left + (right - left) * dx;
+      }
+    }
+    ringRows[y % ringSize] = y;
+    return slot;
+  };
+
+  vector<unsigned char> outRow(rowSamples);
+  auto nextRow = [&](int i) -> const unsigned char * {
+    const float srcY = mapping.sourceY(0, i);
+    const float *top = zeroRow.data(), *bottom = zeroRow.data();
+    float dy = 0;
+    if (bilinear) {
+      const int ya = static_cast<int>(floor(srcY));
+      dy = srcY - ya;
+      if (ya >= -1 && ya < srcHeight) {
+        top = ya >= 0 ? resampledRow(ya) : zeroRow.data();
+        bottom = top && ya + 1 < srcHeight ? resampledRow(ya + 1)
+                                           : zeroRow.data();
+      }
+    } else {
+      const int y = static_cast<int>(round(srcY));
+      if (y >= 0 && y < srcHeight) {
+        top = resampledRow(y);
+      }
+    }
+    if (!top || !bottom) {
+      return nullptr;
+    }
+    for (size_t k = 0; k < rowSamples; k++) {
+      outRow[k] = toSample<unsigned char>(top[k] + (bottom[k] - top[k]) * dy);
+    }
+    return outRow.data();
+  };
+
+  auto scaleStart = high_resolution_clock::now();
+  if (!writeJpegRows(outputPath, newWidth, newHeight, C, 100, nextRow,
+                     error)) {
+    cerr << "[ERROR] Error al guardar la imagen (" << error << ")\n";
+    return false;
+  }
+  lastWarpMs =
+      duration<double, milli>(high_resolution_clock::now() - scaleStart)
+          .count();
+  width = newWidth;
+  height = newHeight;
+  channels = C;
+
+  auto duration =
+      duration_cast<milliseconds>(high_resolution_clock::now() - start);
+  if (showOutput) {
+    printReportHeader(inputPath, outputPath,
+                      "escalado JPEG en flujo (fila a fila)", srcWidth,
+                      srcHeight, newWidth, newHeight);
+    cout << " Canales: " << C << " (" << channelLayoutName(C) << ")\n";
+    cout << " Factor de escalado: " << scaleFactor << " \n";
+    cout << " Interpolación: " << (bilinear ? "Bilineal" : "Vecino") << " \n";
+    cout << "+---------------------------+\n";
+    cout << "- Tiempo total: " << duration.count() << " ms\n";
+    cout << "- Memoria utilizada: " << getMemoryUsageMB() - memoryBefore
+         << " MB\n\033[0m";
+  }
+  cout << "[INFO] Imagen guardada correctamente en " << outputPath << "\n";
+  return true;
+}
+
+/**
+ * @brief Transforms the image by applying rotation and scaling.
+ *
+ * This function combines both rotation and scaling transformations
+ * in sequence. It also tracks the time and memory usage of the process.
+ *
+ * @param inputPath The path to the input image.
+ * @param outputPath The path where the transformed image will be saved.
+ * @param angle The rotation angle in degrees.
+ * @param scaleFactor The scaling factor.
+ * @param buddySystem A flag indicating whether to use the buddy system for
+ * memory allocation.
+ * @param showOutput Whether to print the processing report.
+ * @param requested Decode and resampling options (see TransformOptions).
+ * With `autoOrient`, a JPEG's EXIF orientation is folded into the angle
+ * and flip, so an upright result costs no extra pass.
+ * @return bool Whether the output file was written.
+ */
+bool Image::transformImage(const string &inputPath, const string &outputPath,
+                           int angle, float scaleFactor, bool buddySystem,
+                           bool showOutput,
+                           const TransformOptions &requested) {
+  using namespace std::chrono;
+
+  // Set buddy system flag
+  useBuddySystem = buddySystem;
+
+  // The orientation runs first; right angles and flips stay eligible for
+  // the lossless path once combined with the requested ones
+  TransformOptions options = requested;
+  if (options.autoOrient) {
+    const int orientation = readJpegOrientation(inputPath);
+    if (orientation > 1) {
+      foldOrientation(orientation, angle, options.flip);
+      if (showOutput) {
+        cout << "[INFO] Orientación EXIF " << orientation
+             << " aplicada: giro de " << angle << " grados"
+             << (options.flip == FLIP_NONE ? "" : " con volteo") << "\n";
+      }
+    }
+  }
+
+  // Start measuring time
+  auto start = high_resolution_clock::now();
+
+  // Right-angle rotations and flips of JPEGs never need the pixels; the
+  // planar path skips the RGB round trip for everything else, and a
+  // streaming scale never holds the whole image. Each path delivers the
+  // preview, if one is pending, before its full render
+  pendingPreview = transformPreview;
+  MetricCounter path = COUNTER_PATH_PIXELS;
+  if (transformJpegLossless(inputPath, outputPath, angle, scaleFactor,
+                            showOutput, options)) {
+    path = COUNTER_PATH_LOSSLESS;
+  } else if (transformJpegPlanar(inputPath, outputPath, angle, scaleFactor,
+                                 showOutput, options)) {
+    path = COUNTER_PATH_PLANAR;
+  } else if (scaleJpegStreaming(inputPath, outputPath, angle, scaleFactor,
+                                showOutput, options)) {
+    path = COUNTER_PATH_STREAMING;
+  }
+  if (path != COUNTER_PATH_PIXELS) {
+    // These paths decode, warp and encode in one go; width and height now
+    // describe the output
+    metricsAdd(path);
+    metricsAdd(COUNTER_OUTPUT_PIXELS, static_cast<uint64_t>(width) * height);
+    metricsRecord(STAGE_WARP, lastWarpMs);
+    return true;
+  }
+
+  // Get memory usage before transformation
+  double memoryBefore = getMemoryUsageMB();
+
+  // Load the image, converting to the requested channel layout if any. A
+  // crop of a baseline JPEG only decodes the MCUs it covers
+  const bool cropping = options.crop.width > 0 && options.crop.height > 0;
+  auto decodeStart = high_resolution_clock::now();
+  if (!cropping || !loadJpegRegion(inputPath, options.crop,
+                                   options.desiredChannels, options.depth)) {
+    image(inputPath.c_str(), options.desiredChannels, options.depth,
+          decoderThreads(options));
+    if (!data) {
+      return false;
+    }
+    if (cropping && !cropImage(options.crop)) {
+      return false;
+    }
+  }
+  metricsRecord(STAGE_DECODE,
+                duration<double, milli>(high_resolution_clock::now() -
+                                        decodeStart)
+                    .count());
+
+  if (scaleFactor <= 0) {
+    if (showOutput) {
+      cerr << "El factor de escala debe ser mayor que 0." << endl;
+    }
+    return false;
+  }
+
+  if (showOutput) {
+    cout << "\033[32m+---------------------------+\n";
+    cout << "       PROCESAMIENTO        \n";
+    cout << "+---------------------------+\n";
+    cout << " Archivo entrada: " << inputPath << " \n";
+    cout << " Archivo salida: " << outputPath << " \n";
+    cout << " Modo de asignación de memoria : "
+         << (buddySystem ? "Buddy system" : "Sin Buddy system") << " \n";
+    cout << "+---------------------------+\n";
+    cout << " Dimensiones originales: " << width << "x" << height;
+    if (cropping) {
+      cout << " (recorte en " << options.crop.x << ", " << options.crop.y
+           << ")";
+    }
+    cout << " \n\033[0m";
+  }
+
+  Eigen::Matrix2f transformMatrix =
+      buildTransformMatrix(angle, scaleFactor, options.flip);
+
+  // Only the pixels kept by the canvas policy are allocated, warped and
+  // encoded
+  int newWidth = 0, newHeight = 0;
+  computeCanvasSize(width, height, scaleFactor, angle, options.canvas,
+                    newWidth, newHeight);
+
+  // Unrotated 2x/3x/4x up- and downscales have dedicated kernels; nearest
+  // downscaling is a plain gather either way, so it stays on the warp
+  const bool bilinear = options.interpolation == INTERP_BILINEAR;
+  int ratio = 0;
+  if (angle % 360 == 0 && options.flip == FLIP_NONE) {
+    ratio = integerScaleRatio(width, height, newWidth, newHeight);
+    if (ratio < 0 && !bilinear) {
+      ratio = 0;
+    }
+  }
+  // 180 degree turns and flips at scale 1 only move pixels around
+  const int turn = (angle % 360 + 360) % 360;
+  const bool mirror = scaleFactor == 1.0f && turn % 180 == 0 &&
+                      newWidth == width && newHeight == height;
+
+  // 8-bit RGB can be warped as padded 32-bit RGBX pixels
+  const bool padded = options.paddedRgb && ratio == 0 && !mirror &&
+                      depth == DEPTH_8 && channels == 3;
+
+  // The preview shares the plan of the full render and goes out before it
+  const Eigen::Matrix2f inverse = transformMatrix.inverse();
+  renderPreview(data, width, height, channels, depth, newWidth, newHeight,
+                inverse, start, showOutput);
+
+  // Mirrors, box downscales and warps whose reads stay ahead of their
+  // writes overwrite the source instead of allocating a second buffer
+  const bool inPlace =
+      mirror ||
+      (!padded && options.layout == LAYOUT_ROWS &&
+       (ratio < 0 || (ratio == 0 && warpFitsInPlace(width, height, newWidth,
+                                                     newHeight, inverse,
+                                                     bilinear))));
+
+  if (showOutput) {
+    cout << "\033[32m Dimensiones finales: " << newWidth << "x" << newHeight
+         << " \n";
+    cout << " Canales: " << channels << " (" << channelLayoutName(channels)
+         << ", " << sampleDepthName(depth) << ")\n";
+    cout << " Ángulo de rotación: " << angle << " grados\n";
+    cout << " Factor de escalado: " << scaleFactor << " \n";
+    cout << " Interpolación: "
+         << (options.interpolation == INTERP_BILINEAR ? "Bilineal" : "Vecino")
+         << (options.linearLight ? " (luz lineal)" : "") << " \n";
+    cout << " Disposición: "
+         << (options.layout == LAYOUT_TILED
+                 ? "Teselas de " + to_string(options.tileSize) + " px"
+                 : string("Filas"))
+         << (padded ? " (RGBX)" : "") << " \n";
+    if (ratio != 0) {
+      cout << " Núcleo: razón entera "
+           << (ratio > 0 ? to_string(ratio) + "x"
+                         : "1/" + to_string(-ratio))
+           << " \n";
+    }
+    if (inPlace) {
+      cout << " Ejecución: en el sitio (sin búfer de salida) \n";
+    }
+    cout << "\033[0m";
+  }
+
+  Image transformedImage;
+  transformedImage.useBuddySystem = useBuddySystem;
+  transformedImage.width = newWidth;
+  transformedImage.height = newHeight;
+  transformedImage.channels = channels;
+  transformedImage.depth = depth;
+
+  auto warpStart = high_resolution_clock::now();
+
+  // Every stage frees its input as soon as it has read it: the padded copy
+  // retires the decoded pixels, the tiled copy retires the padded one, the
+  // output is allocated only once the warp source is final, and the warp
+  // retires its source before encoding. Together with saveAndRelease, no
+  // more than two image buffers are ever live (one when running in place).
+  SourceLayout source;
+  const unsigned char *warpSource = data;
+  size_t warpPixelBytes = getBytesPerPixel();
+  unsigned char *sourceCopy = nullptr; // Padded and/or tiled copy
+  int blockSize = 0;
+  if (padded) {
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+    sourceCopy =
+        allocatePixels(pixelCount * sizeof(RgbxPixel), useBuddySystem);
+    padRgb(data, reinterpret_cast<RgbxPixel *>(sourceCopy), pixelCount);
+    releaseData();
+    warpSource = sourceCopy;
+    warpPixelBytes = sizeof(RgbxPixel);
+  }
+  // Optionally re-lay the source as tiles and walk the destination in blocks
+  // of the same size, so source reads stay local at any angle
+  if (options.layout == LAYOUT_TILED && ratio == 0 && !mirror) {
+    int tileShift = 1;
+    while ((1 << tileShift) < options.tileSize && tileShift < 8) {
+      tileShift++;
+    }
+    unsigned char *tiled = tileImage(warpSource, width, height,
+                                     warpPixelBytes, tileShift,
+                                     useBuddySystem, source);
+    if (sourceCopy) {
+      releasePixels(sourceCopy);
+    } else {
+      releaseData();
+    }
+    sourceCopy = tiled;
+    warpSource = tiled;
+    blockSize = 1 << tileShift;
+  }
+
+  // Start measuring time for the specific memory allocation method
+  auto buddyStart = high_resolution_clock::now();
+
+  // Padded output is packed back to RGB in place, so the buffer is sized
+  // for the wider layout
+  const size_t outputPixelBytes =
+      padded ? sizeof(RgbxPixel) : getBytesPerPixel();
+  transformedImage.data =
+      inPlace ? data
+              : allocatePixels(static_cast<size_t>(newWidth) * newHeight *
+                                   outputPixelBytes,
+                               useBuddySystem);
+
+  auto buddyEnd = high_resolution_clock::now();
+  auto buddyDuration = duration_cast<milliseconds>(buddyEnd - buddyStart);
+
+  if (mirror) {
+    dispatchPixelFormat<MirrorKernel>(
+        depth, channels, transformedImage.data, width, height,
+        (turn == 180) != (options.flip == FLIP_VERTICAL),
+        (turn == 180) != (options.flip == FLIP_HORIZONTAL));
+  } else if (ratio != 0) {
+    // Zero past the edges, like the warps, so the output is the same
+    dispatchPixelFormat<IntegerScaleKernel>(
+        depth, channels, data, width, height, transformedImage.data, newWidth,
+        newHeight, ratio, bilinear, false, options.linearLight);
+  } else if (padded) {
+    // Whole-word kernels on RGBX, then back to packed RGB for the encoders
+    if (bilinear) {
+      WarpBilinearKernel<RgbxPixel, 1>::run(
+          warpSource, width, height, transformedImage.data, newWidth,
+          newHeight, inverse, source, blockSize, options.linearLight);
+    } else {
+      WarpNearestKernel<RgbxPixel, 1>::run(
+          warpSource, width, height, transformedImage.data, newWidth,
+          newHeight, inverse, source, blockSize);
+    }
+    packRgbx(transformedImage.data, static_cast<size_t>(newWidth) * newHeight);
+  } else if (bilinear) {
+    dispatchPixelFormat<WarpBilinearKernel>(
+        depth, channels, warpSource, width, height, transformedImage.data,
+        newWidth, newHeight, inverse, source, blockSize, options.linearLight);
+  } else {
+    dispatchPixelFormat<WarpNearestKernel>(
+        depth, channels, warpSource, width, height, transformedImage.data,
+        newWidth, newHeight, inverse, source, blockSize);
+  }
+
+  // The kernel was the source's last reader
+  if (sourceCopy) {
+    releasePixels(sourceCopy);
+  }
+  if (inPlace) {
+    data = nullptr; // The source buffer now belongs to the result
+  } else {
+    releaseData();
+  }
+
+  // Kernel time only: the output allocation is reported on its own
+  lastWarpMs =
+      duration<double, milli>(high_resolution_clock::now() - warpStart -
+                              (buddyEnd - buddyStart))
+          .count();
+  metricsRecord(STAGE_WARP, lastWarpMs);
+  metricsAdd(COUNTER_PATH_PIXELS);
+
+  // End measuring time
+  auto stop = high_resolution_clock::now();
+  auto duration = duration_cast<milliseconds>(stop - start);
+
+  // Get memory usage after transformation
+  double memoryAfter = getMemoryUsageMB();
+  double memoryUsed = memoryAfter - memoryBefore;
+
+  if (showOutput) {
+    cout << "\033[32m+---------------------------+\n";
+    cout << "   TIEMPO DE PROCESAMIENTO   \n";
+    cout << "+---------------------------+\n";
+
+    if (useBuddySystem) {
+      cout << "- Sin Buddy system: " << "[ ]" << " ms" << endl;
+      cout << "- Con Buddy system: " << duration.count() << " ms" << endl;
+      cout << "- Tiempo de asignación con Buddy: " << buddyDuration.count()
+           << " ms" << endl;
+    } else {
+      cout << "- Sin Buddy system: " << duration.count() << " ms" << endl;
+      cout << "- Con Buddy system: " << "[ ]" << " ms" << endl;
+    }
+
+    // Display memory usage
+    cout << "- Memoria utilizada: " << memoryUsed << " MB\n\033[0m";
+  }
+
+  auto encodeStart = high_resolution_clock::now();
+  const bool written = transformedImage.saveAndRelease(outputPath);
+  metricsRecord(STAGE_ENCODE,
+                chrono::duration<double, milli>(high_resolution_clock::now() -
+                                                encodeStart)
+                    .count());
+  if (written) {
+    metricsAdd(COUNTER_OUTPUT_PIXELS,
+               static_cast<uint64_t>(newWidth) * newHeight);
+  }
+  return written;
+}
+
+/**
+ * @brief Turns the decoded pixels upright for an EXIF orientation.
+ *
+ * Flips and 180 degree turns mirror the buffer in place; orientations that
+ * swap the axes are a nearest-neighbour warp at an exact right angle,
+ * which maps every pixel one to one.
+ *
+ * @param orientation EXIF orientation, 1 to 8.
+ */
+void Image::applyOrientation(int orientation) {
+  int angle = 0;
+  FlipMode flip = FLIP_NONE;
+  foldOrientation(orientation, angle, flip);
+  if (!data || (angle == 0 && flip == FLIP_NONE)) {
+    return;
+  }
+
+  if (angle == 0 || angle == 180) {
+    dispatchPixelFormat<MirrorKernel>(depth, channels, data, width, height,
+                                      angle == 180,
+                                      (angle == 180) != (flip != FLIP_NONE));
+    return;
+  }
+
+  unsigned char *upright = allocatePixels(
+      static_cast<size_t>(width) * height * getBytesPerPixel(),
+      useBuddySystem);
+  dispatchPixelFormat<WarpNearestKernel>(
+      depth, channels, data, width, height, upright, height, width,
+      buildTransformMatrix(angle, 1.0f, flip).inverse(), SourceLayout(), 0);
+  releaseData();
+  data = upright;
+  swap(width, height);
+}
+
+/**
+ * @brief Output path of one ladder level: the level size is appended to
+ * the file name, before the extension ("foto.jpg" -> "foto_512.jpg").
+ */
+string ladderPath(const string &outputPath, int size) {
+  const size_t dot = outputPath.find_last_of('.');
+  const size_t slash = outputPath.find_last_of('/');
+  if (dot == string::npos || (slash != string::npos && dot < slash)) {
+    return outputPath + "_" + to_string(size);
+  }
+  return outputPath.substr(0, dot) + "_" + to_string(size) +
+         outputPath.substr(dot);
+}
+
+/**
+ * @brief Downscales one ladder level from the next larger one.
+ *
+ * Exact 1/2, 1/3 and 1/4 ratios box-average through the integer-ratio
+ * kernels. Any other ratio is first halved with the 2 x 2 box while the
+ * image is at least twice the target, then finished with a centred
+ * bilinear step of less than 2x, so every source pixel still contributes
+ * to the result instead of being skipped.
+ *
+ * @param src Pixels of the larger level.
+ * @param pixelBytes Size of one pixel in bytes.
+ * @return unsigned char* The new level, from allocatePixels.
+ */
+static unsigned char *downscaleLevel(const unsigned char *src, int srcWidth,
+                                     int srcHeight, int dstWidth,
+                                     int dstHeight, SampleDepth depth,
+                                     int channels, size_t pixelBytes,
+                                     bool linearLight, bool buddySystem) {
+  const unsigned char *current = src;
+  unsigned char *halved = nullptr;
+  int width = srcWidth, height = srcHeight;
+  int ratio = integerScaleRatio(width, height, dstWidth, dstHeight);
+  while (ratio == 0 && width >= 2 * dstWidth && height >= 2 * dstHeight) {
+    // The box kernel uses the width as the row stride, so an odd last
+    // column or row is simply left out
+    const int halfWidth = width / 2, halfHeight = height / 2;
+    unsigned char *half = allocatePixels(
+        static_cast<size_t>(halfWidth) * halfHeight * pixelBytes, buddySystem);
+    dispatchPixelFormat<IntegerScaleKernel>(
+        depth, channels, current, width, height, half, halfWidth, halfHeight,
+        -2, true, true, linearLight);
+    if (halved) {
+      releasePixels(halved);
+    }
+    current = halved = half;
+    width = halfWidth;
+    height = halfHeight;
+    ratio = integerScaleRatio(width, height, dstWidth, dstHeight);
+  }
+
+  unsigned char *level = allocatePixels(
+      static_cast<size_t>(dstWidth) * dstHeight * pixelBytes, buddySystem);
+  if (ratio < 0) {
+    dispatchPixelFormat<IntegerScaleKernel>(
+        depth, channels, current, width, height, level, dstWidth, dstHeight,
+        ratio, true, true, linearLight);
+  } else {
+    Eigen::Matrix2f inverse = Eigen::Matrix2f::Zero();
+    inverse(0, 0) = static_cast<float>(width) / dstWidth;
+    inverse(1, 1) = static_cast<float>(height) / dstHeight;
+    dispatchPixelFormat<WarpBilinearKernel>(
+        depth, channels, current, width, height, level, dstWidth, dstHeight,
+        inverse, SourceLayout(), 0, linearLight);
+  }
+  if (halved) {
+    releasePixels(halved);
+  }
+  return level;
+}
+
+/**
+ * @brief Writes a ladder of downscaled copies of an image in one pass.
+ *
+ * The source is decoded once. Each level is then resampled from the next
+ * larger level rather than from the full-size source, so the cost of the
+ * whole ladder is close to that of its first level. As soon as a level is
+ * ready its encoding starts on its own thread, while the main thread goes
+ * on with the next level from the same (read-only) pixels. The decoded
+ * source is freed once the first level exists.
+ *
+ * @param inputPath The path to the input image.
+ * @param outputPath Base output path; each level inserts "_<size>" before
+ * the extension.
+ * @param sizes Longest side of each level, in pixels. Sizes not smaller
+ * than the source are skipped, and the order does not matter.
+ * @param buddySystem Whether level buffers come from the buddy pool.
+ * @param showOutput Whether to print the processing report.
+ * @param options Decode and resampling options; only the channels, depth,
+ * decode threads, linear light and EXIF orientation apply.
+ * @return bool Whether every level was written.
+ */
+bool Image::generateLadder(const string &inputPath, const string &outputPath,
+                           const vector<int> &sizes, bool buddySystem,
+                           bool showOutput, const TransformOptions &options) {
+  using namespace std::chrono;
+
+  useBuddySystem = buddySystem;
+  auto start = high_resolution_clock::now();
+
+  image(inputPath.c_str(), options.desiredChannels, options.depth,
+        decoderThreads(options));
+  if (!data) {
+    return false;
+  }
+  if (options.autoOrient) {
+    applyOrientation(readJpegOrientation(inputPath));
+  }
+  metricsRecord(STAGE_DECODE,
+                duration<double, milli>(high_resolution_clock::now() - start)
+                    .count());
+
+  vector<int> levels;
+  const int longSide = max(width, height);
+  for (int size : sizes) {
+    if (size > 0 && size < longSide) {
+      levels.push_back(size);
+    }
+  }
+  sort(levels.rbegin(), levels.rend());
+  levels.erase(unique(levels.begin(), levels.end()), levels.end());
+  if (levels.empty()) {
+    cerr << "[ERROR] Ningún tamaño de la escalera es menor que la imagen ("
+         << width << "x" << height << ")\n";
+    return false;
+  }
+
+  if (showOutput) {
+    cout << "\033[32m+---------------------------+\n";
+    cout << "     ESCALERA DE MINIATURAS  \n";
+    cout << "+---------------------------+\n";
+    cout << " Archivo entrada: " << inputPath << " \n";
+    cout << " Dimensiones originales: " << width << "x" << height << " \n";
+    cout << " Canales: " << channels << " (" << channelLayoutName(channels)
+         << ", " << sampleDepthName(depth) << ")\n\033[0m";
+  }
+
+  // Each level stays alive until its encoder and the next level are done
+  vector<unique_ptr<Image>> images;
+  vector<thread> encoders;
+  vector<char> saved(levels.size(), 0); // One slot per encoder thread
+  const unsigned char *previous = data;
+  int previousWidth = width, previousHeight = height;
+  for (int size : levels) {
+    int levelWidth = size, levelHeight = size;
+    if (width >= height) {
+      levelHeight = max(1, static_cast<int>(lround(
+                               static_cast<double>(height) * size / width)));
+    } else {
+      levelWidth = max(1, static_cast<int>(lround(
+                              static_cast<double>(width) * size / height)));
+    }
+
+    unique_ptr<Image> level(new Image());
+    level->useBuddySystem = useBuddySystem;
+    level->width = levelWidth;
+    level->height = levelHeight;
+    level->channels = channels;
+    level->depth = depth;
+    auto levelStart = high_resolution_clock::now();
+    level->data = downscaleLevel(previous, previousWidth, previousHeight,
+                                 levelWidth, levelHeight, depth, channels,
+                                 getBytesPerPixel(), options.linearLight,
+                                 useBuddySystem);
+    metricsRecord(STAGE_WARP,
+                  duration<double, milli>(high_resolution_clock::now() -
+                                          levelStart)
+                      .count());
+    if (previous == data) {
+      releaseData(); // Later levels start from this one
+    }
+    previous = level->data;
+    previousWidth = levelWidth;
+    previousHeight = levelHeight;
+
+    if (showOutput) {
+      cout << "\033[32m Nivel " << size << ": " << levelWidth << "x"
+           << levelHeight << " -> " << ladderPath(outputPath, size)
+           << " \n\033[0m";
+    }
+
+    Image *ready = level.get();
+    const string path = ladderPath(outputPath, size);
+    char *result = &saved[images.size()];
+    encoders.emplace_back([ready, path, result]() {
+      auto encodeStart = high_resolution_clock::now();
+      *result = ready->saveImage(path);
+      metricsRecord(STAGE_ENCODE,
+                    duration<double, milli>(high_resolution_clock::now() -
+                                            encodeStart)
+                        .count());
+      if (*result) {
+        metricsAdd(COUNTER_OUTPUT_PIXELS,
+                   static_cast<uint64_t>(ready->width) * ready->height);
+      }
+    });
+    images.push_back(move(level));
+  }
+
+  for (thread &encoder : encoders) {
+    encoder.join();
+  }
+
+  if (showOutput) {
+    auto duration =
+        duration_cast<milliseconds>(high_resolution_clock::now() - start);
+    cout << "\033[32m+---------------------------+\n";
+    cout << "- " << levels.size() << " niveles en " << duration.count()
+         << " ms\n\033[0m";
+  }
+  return find(saved.begin(), saved.end(), 0) == saved.end();
+}
+
+/**
+ * @brief Converts one stored sample to a normalised value in [0, 1] (or
+ * beyond, for HDR float samples).
+ */
+static float normalizedSample(const unsigned char *data, SampleDepth depth,
+                              size_t index) {
+  switch (depth) {
+  case DEPTH_16:
+    return reinterpret_cast<const unsigned short *>(data)[index] / 65535.0f;
+  case DEPTH_FLOAT:
+    return reinterpret_cast<const float *>(data)[index];
+  default:
+    return data[index] / 255.0f;
+  }
+}
+
+/**
+ * @brief Converts a pixel buffer of any depth to 8-bit samples.
+ *
+ * 16-bit samples are rescaled. Float samples are linear light (stb decodes
+ * LDR files to float with a 2.2 gamma), so colour channels are re-encoded
+ * with the same gamma while alpha stays linear, mirroring stb's own
+ * HDR-to-LDR conversion. `out` may be `data` itself: sample i is written to
+ * byte i, which never lies past a sample still to be read.
+ */
+static void convertToU8(const unsigned char *data, SampleDepth depth,
+                        size_t pixels, int channels, unsigned char *out) {
+  const bool alphaLast = channels == 2 || channels == 4;
+  const size_t samples = pixels * channels;
+  for (size_t i = 0; i < samples; i++) {
+    float value = normalizedSample(data, depth, i);
+    bool isAlpha =
+        alphaLast && i % channels == static_cast<size_t>(channels) - 1;
+    if (depth == DEPTH_FLOAT && !isAlpha) {
+      value = pow(max(value, 0.0f), 1.0f / 2.2f);
+    }
+    out[i] = toSample<unsigned char>(value * 255.0f + 0.5f);
+  }
+}
+
+/**
+ * @brief Composites 8-bit gray+alpha or RGBA pixels over black, dropping
+ * the alpha channel.
+ *
+ * `out` may be `in` itself: each pixel's alpha is read first, and its
+ * colour samples only move towards the start of the buffer.
+ */
+static void flattenAlpha(const unsigned char *in, size_t pixels,
+                         int channels, unsigned char *out) {
+  const int colorChannels = channels - 1;
+  for (size_t p = 0; p < pixels; p++, in += channels, out += colorChannels) {
+    const int a = in[colorChannels];
+    for (int c = 0; c < colorChannels; c++) {
+      out[c] = static_cast<unsigned char>((in[c] * a + 127) / 255);
+    }
+  }
+}
+
+/**
+ * @brief Converts a pixel buffer of any depth to linear float samples for
+ * the Radiance HDR writer, applying the inverse of convertToU8's gamma.
+ */
+static vector<float> convertToFloat(const unsigned char *data,
+                                    SampleDepth depth, size_t pixels,
+                                    int channels) {
+  const bool alphaLast = channels == 2 || channels == 4;
+  vector<float> converted(pixels * channels);
+  for (size_t i = 0; i < converted.size(); i++) {
+    float value = normalizedSample(data, depth, i);
+    bool isAlpha =
+        alphaLast && i % channels == static_cast<size_t>(channels) - 1;
+    converted[i] = isAlpha ? value : pow(value, 2.2f);
+  }
+  return converted;
+}
+
+/**
+ * @brief Computes the CRC-32 used by PNG chunks.
+ */
+static unsigned int pngCrc(const unsigned char *bytes, size_t length,
+                           unsigned int crc = 0xFFFFFFFFu) {
+  for (size_t i = 0; i < length; i++) {
+    crc ^= bytes[i];
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+  return crc;
+}
+
+/**
+ * @brief Writes a 16-bit-per-sample PNG.
+ *
+ * stb_image_write only emits 8-bit PNGs, so this writer reuses its zlib
+ * compressor and produces the chunks itself. Rows use the Sub filter, which
+ * compresses smooth 16-bit gradients much better than no filtering.
+ *
+ * @return int 1 on success, 0 on failure (like the stb writers).
+ */
+static int writePng16(const char *path, int width, int height, int channels,
+                      const unsigned short *pixels) {
+  static const unsigned char colorTypes[] = {0, 0, 4, 2, 6};
+  const size_t rowBytes = static_cast<size_t>(width) * channels * 2;
+  const size_t bpp = static_cast<size_t>(channels) * 2;
+
+  vector<unsigned char> raw((rowBytes + 1) * height);
+  vector<unsigned char> row(rowBytes);
+  for (int y = 0; y < height; y++) {
+    const unsigned short *in =
+        pixels + static_cast<size_t>(y) * width * channels;
+    for (size_t s = 0; s < rowBytes / 2; s++) {
+      row[s * 2] = static_cast<unsigned char>(in[s] >> 8); // Big-endian
+      row[s * 2 + 1] = static_cast<unsigned char>(in[s] & 0xFF);
+    }
+    unsigned char *out = &raw[y * (rowBytes + 1)];
+    out[0] = 1; // Sub filter
+    for (size_t b = 0; b < rowBytes; b++) {
+      out[b + 1] =
+          static_cast<unsigned char>(row[b] - (b >= bpp ? row[b - bpp] : 0));
+    }
+  }
+
+  int compressedLength = 0;
+  unsigned char *compressed = stbi_zlib_compress(
+      raw.data(), static_cast<int>(raw.size()), &compressedLength, 8);
+  if (!compressed) {
+    return 0;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    free(compressed);
+    return 0;
+  }
+
+  auto writeChunk = [file](const char *type, const unsigned char *payload,
+                           unsigned int length) {
+    unsigned char header[8] = {
+        static_cast<unsigned char>(length >> 24),
+        static_cast<unsigned char>(length >> 16),
+        static_cast<unsigned char>(length >> 8),
+        static_cast<unsigned char>(length),
+        static_cast<unsigned char>(type[0]),
+        static_cast<unsigned char>(type[1]),
+        static_cast<unsigned char>(type[2]),
+        static_cast<unsigned char>(type[3])};
+    unsigned int crc = pngCrc(header + 4, 4);
+    if (length > 0) {
+      crc = pngCrc(payload, length, crc);
+    }
+    crc ^= 0xFFFFFFFFu;
+    unsigned char trailer[4] = {static_cast<unsigned char>(crc >> 24),
+                                static_cast<unsigned char>(crc >> 16),
+                                static_cast<unsigned char>(crc >> 8),
+                                static_cast<unsigned char>(crc)};
+    fwrite(header, 1, 8, file);
+    if (length > 0) { // IEND has no payload
+      fwrite(payload, 1, length, file);
+    }
+    fwrite(trailer, 1, 4, file);
+  };
+
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G',
+                                             '\r', '\n', 0x1A, '\n'};
+  fwrite(signature, 1, 8, file);
+
+  unsigned char ihdr[13] = {
+      static_cast<unsigned char>(width >> 24),
+      static_cast<unsigned char>(width >> 16),
+      static_cast<unsigned char>(width >> 8),
+      static_cast<unsigned char>(width),
+      static_cast<unsigned char>(height >> 24),
+      static_cast<unsigned char>(height >> 16),
+      static_cast<unsigned char>(height >> 8),
+      static_cast<unsigned char>(height),
+      16, // Bit depth
+      colorTypes[channels],
+      0, // Deflate
+      0, // Adaptive filtering
+      0  // No interlace
+  };
+  writeChunk("IHDR", ihdr, sizeof(ihdr));
+  writeChunk("IDAT", compressed, static_cast<unsigned int>(compressedLength));
+  writeChunk("IEND", nullptr, 0);
+
+  free(compressed);
+  return fclose(file) == 0;
+}
+
+/**
+ * @brief Saves the image and frees its pixel buffer, its last consumer.
+ *
+ * What saveImage would convert into a separate buffer before encoding an
+ * 8-bit format (narrowing 16-bit or float samples, compositing alpha over
+ * black for JPEG) is done in the pixel buffer itself, since both only
+ * shrink the pixels, so encoding needs no second image-sized buffer.
+ *
+ * @param outputPath The file path where the image will be saved.
+ * @return bool Whether the file was written.
+ */
+bool Image::saveAndRelease(const string &outputPath) {
+  const bool keepsDepth =
+      hasExtension(outputPath, ".hdr") ||
+      (hasExtension(outputPath, ".png") && depth == DEPTH_16);
+  if (data && !keepsDepth) {
+    const size_t pixels = static_cast<size_t>(width) * height;
+    if (depth != DEPTH_8) {
+      convertToU8(data, depth, pixels, channels, data);
+      depth = DEPTH_8;
+    }
+    if (hasAlpha() && !hasExtension(outputPath, ".png")) {
+      flattenAlpha(data, pixels, channels, data);
+      channels--;
+    }
+  }
+  const bool written = saveImage(outputPath);
+  releaseData();
+  return written;
+}
+
+/**
+ * @brief Saves the image data to the specified file path.
+ *
+ * The format follows the extension:
+ * - `.hdr`: Radiance HDR with float samples (8 and 16-bit images are
+ *   converted to linear light).
+ * - `.png`: 16-bit PNG for 16-bit images, 8-bit PNG otherwise. Alpha is kept.
+ * - anything else: JPG. Since JPEG has no alpha, gray+alpha and RGBA images
+ *   are first composited over black (the same colour used for the borders
+ *   uncovered by a rotation). Encoded by writeJpegPixels, which follows
+ *   stbi_write_jpg's tables and rules with a SIMD colour conversion and
+ *   integer DCT.
+ *
+ * Deeper samples are converted to 8 bits only when the target format needs
+ * it. If the data is invalid, an error message is displayed.
+ *
+ * @param outputPath The file path where the image will be saved.
+ * @return bool Whether the file was written.
+ */
+bool Image::saveImage(const string &outputPath) {
+  if (!data) {
+    cerr << "[ERROR] No hay datos de imagen disponibles para guardar\n";
+    return false;
+  }
+
+  const size_t pixels = static_cast<size_t>(width) * height;
+  int written = 0;
+  string error;
+
+  if (hasExtension(outputPath, ".hdr")) {
+    if (depth == DEPTH_FLOAT) {
+      written = stbi_write_hdr(outputPath.c_str(), width, height, channels,
+                               reinterpret_cast<const float *>(data));
+    } else {
+      vector<float> linear = convertToFloat(data, depth, pixels, channels);
+      written = stbi_write_hdr(outputPath.c_str(), width, height, channels,
+                               linear.data());
+    }
+  } else if (hasExtension(outputPath, ".png") && depth == DEPTH_16) {
+    written = writePng16(outputPath.c_str(), width, height, channels,
+                         reinterpret_cast<const unsigned short *>(data));
+  } else {
+    // 8-bit formats: convert deeper samples once, then encode
+    vector<unsigned char> converted;
+    const unsigned char *pixels8 = data;
+    if (depth != DEPTH_8) {
+      converted.resize(pixels * channels);
+      convertToU8(data, depth, pixels, channels, converted.data());
+      pixels8 = converted.data();
+    }
+
+    if (hasExtension(outputPath, ".png")) {
+      written = stbi_write_png(outputPath.c_str(), width, height, channels,
+                               pixels8, width * channels);
+    } else if (hasAlpha()) {
+      // Flatten alpha over black so the encoder only sees colour channels
+      const int colorChannels = channels - 1;
+      vector<unsigned char> flattened(pixels * colorChannels);
+      flattenAlpha(pixels8, pixels, channels, flattened.data());
+      written = writeJpegPixels(outputPath, flattened.data(), width, height,
+                                colorChannels, 100, error);
+    } else {
+      written = writeJpegPixels(outputPath, pixels8, width, height, channels,
+                                100, error);
+    }
+  }
+
+  if (written) {
+    cout << "[INFO] Imagen guardada correctamente en " << outputPath << "\n";
+  } else {
+    cerr << "[ERROR] Error al guardar la imagen " << error << "\n";
+  }
+  return written != 0;
+}
+
+/**
+ * @brief Destructor for the Image class.
+ *
+ * Frees the allocated image data memory to avoid memory leaks.
+ */
+Image::~Image() { releaseData(); }
+
+/**
+ * @brief Frees the pixel buffer, to the buddy pool or to stb's allocator.
+ */
+void Image::releaseData() {
+  if (data) {
+    if (useBuddySystem && buddyManager != nullptr &&
+        buddyManager->isManaged(data)) {
+      buddyManager->deallocate(data);
+    } else {
+      stbi_image_free(data);
+    }
+    data = nullptr;
+  }
 }
\ No newline at end of file
@@ -3,37 +3,165 @@
 
 #include "stb_image.h"
 #include "stb_image_write.h"
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
 
 using namespace std;
 
+// Sample type of the pixel buffer; the value is the size of one sample.
+enum SampleDepth {
+  DEPTH_AUTO = 0,  // Decode at the file's native depth
+  DEPTH_8 = 1,     // unsigned char samples (stbi_load)
+  DEPTH_16 = 2,    // unsigned short samples (stbi_load_16)
+  DEPTH_FLOAT = 4, // linear float samples (stbi_loadf)
+};
+
+// Resampling filter used by transformImage.
+enum Interpolation {
+  INTERP_NEAREST,  // Nearest neighbour
+  INTERP_BILINEAR, // Bilinear blend of the four neighbours
+};
+
+// Output canvas policy for transformImage.
+enum CanvasMode {
+  CANVAS_EXPAND,   // Full bounding box of the rotated image
+  CANVAS_ORIGINAL, // Same frame as the (scaled) source, centred
+  CANVAS_INNER,    // Largest axis-aligned rectangle with no border pixels
+};
+
+// Internal pixel layout used as the source of the warp kernels.
+enum PixelLayout {
+  LAYOUT_ROWS,  // Row-major, as decoded
+  LAYOUT_TILED, // Square tiles, each row-major
+};
+
+// Mirror applied before the rotation.
+enum FlipMode {
+  FLIP_NONE,
+  FLIP_HORIZONTAL, // Left-right
+  FLIP_VERTICAL,   // Top-bottom
+};
+
+// Source region, in pixels, kept before any other transform.
+struct CropRect {
+  int x = 0, y = 0;
+  int width = 0, height = 0; // 0 keeps the whole image
+};
+
+// Options that control how transformImage decodes, resamples and encodes.
+struct TransformOptions {
+  int desiredChannels = 0; // Channels requested at decode, 0 keeps the file's
+  SampleDepth depth = DEPTH_8; // Sample depth requested at decode
+  Interpolation interpolation = INTERP_NEAREST;
+  bool linearLight = false; // Blend 8-bit sRGB samples in linear light
+  CanvasMode canvas = CANVAS_EXPAND;
+  PixelLayout layout = LAYOUT_ROWS;
+  int tileSize = 16; // Tile side in pixels (rounded up to a power of two)
+  FlipMode flip = FLIP_NONE;
+  bool allowLossless = true; // JPEG right angles/flips in the DCT domain
+  CropRect crop;
+  bool planarYCbCr = false; // Warp JPEG Y/Cb/Cr planes without RGB conversion
+  int threads = 0; // JPEG decode threads, 0 uses every core
+  bool streaming = false; // Scale JPEG to JPEG row by row (scale-only jobs)
+  bool paddedRgb = false; // Warp 8-bit RGB as 4-byte RGBX pixels
+  bool autoOrient = true; // Apply the JPEG's EXIF orientation first
+};
+
+// Computes the output size of a rotation + scale under a canvas policy.
+void computeCanvasSize(int width, int height, float scaleFactor, int angle,
+                       CanvasMode mode, int &canvasWidth, int &canvasHeight);
+
+// Whether a path ends in the extension (".png", ".hdr", ...), which picks
+// the output format.
+bool hasExtension(const string &path, const char *extension);
+
+// Output path of one generateLadder level: "_<size>" before the extension.
+string ladderPath(const string &outputPath, int size);
+
+// Installs, for the calling thread, a function the warp kernels call between
+// tiles (bands of rows, or rows of blocks), where a scheduler may run more
+// urgent work before the rest of the image. nullptr removes it.
+void setTileYield(const function<void()> *yield);
+
+// A fast nearest-neighbour render of a transform at reduced resolution,
+// delivered before the full-quality result. The pixels are only valid
+// during the callback.
+struct PreviewImage {
+  const unsigned char *pixels;
+  int width, height, channels;
+  SampleDepth depth;
+  double elapsedMs; // Since the transform started
+};
+
+// Installs, for the calling thread, a callback that receives a preview of
+// every transform, at most maxSide pixels on its longest side, before the
+// full render. Paths that never decode the pixels build it from the JPEG's
+// DC coefficients. nullptr removes it.
+void setTransformPreview(const function<void(const PreviewImage &)> *preview,
+                         int maxSide);
+
 class Image {
 public:
   Image();  // Constructor
   ~Image(); // Destructor
 
-  void image(const char *); // Load an image
-  void extractChannels();   // Extract RGB channels
+  void image(const char *, int desiredChannels = 0,
+             SampleDepth requestedDepth = DEPTH_8,
+             int threads = 1); // Load an image
+  void extractChannels(); // Extract gray/RGB and alpha channels
   void rotateImage(int angle);
-  void scaleImage(float scaleFactor);
-  void transformImage(const string &inputPath, const string &outputPath,
+  void scaleImage(float scaleFactor, bool linearLight = false);
+  bool cropImage(const CropRect &crop);
+  bool transformImage(const string &inputPath, const string &outputPath,
                       int angle, float scaleFactor, bool buddySystem,
-                      bool showOutput);
-  void saveImage(const string &outputPath); // Save image
+                      bool showOutput,
+                      const TransformOptions &options = TransformOptions());
+  bool generateLadder(const string &inputPath, const string &outputPath,
+                      const vector<int> &sizes, bool buddySystem,
+                      bool showOutput,
+                      const TransformOptions &options =
+                          TransformOptions()); // Cascaded thumbnails
+  bool saveImage(const string &outputPath); // Save image
 
   int getWidth() const { return width; }
   int getHeight() const { return height; }
   int getChannels() const { return channels; }
+  SampleDepth getDepth() const { return depth; }
+  size_t getBytesPerPixel() const {
+    return static_cast<size_t>(channels) * depth;
+  }
+  bool hasAlpha() const { return channels == 2 || channels == 4; }
+  double getLastWarpMs() const { return lastWarpMs; } // Kernel time only
 
 private:
+  void reportLoaded(int fileChannels);
+  void releaseData(); // Free the pixel buffer now
+  void applyOrientation(int orientation); // Turn the pixels upright
+  bool saveAndRelease(const string &outputPath); // Last use of the pixels
+  bool loadJpegRegion(const string &path, const CropRect &crop,
+                      int desiredChannels, SampleDepth requestedDepth);
+  bool transformJpegLossless(const string &inputPath,
+                             const string &outputPath, int angle,
+                             float scaleFactor, bool showOutput,
+                             const TransformOptions &options);
+  bool transformJpegPlanar(const string &inputPath, const string &outputPath,
+                           int angle, float scaleFactor, bool showOutput,
+                           const TransformOptions &options);
+  bool scaleJpegStreaming(const string &inputPath, const string &outputPath,
+                          int angle, float scaleFactor, bool showOutput,
+                          const TransformOptions &options);
+
   vector<vector<int>> canalRojo;
   vector<vector<int>> canalVerde;
   vector<vector<int>> canalAzul;
+  vector<vector<int>> canalAlfa;
   int width, height, channels;
+  SampleDepth depth;
   unsigned char *data;
   bool useBuddySystem;
+  double lastWarpMs;
 };
 
 #endif // IMAGEN_H
@@ -0,0 +1,278 @@
+#include "job.h"
+#include "jpeg_codec.h"
+#include "metrics.h"
+#include "tuning.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+/**
+ * @brief Applies a job flag that takes no value; see parseJobFlag.
+ */
+static bool parseSwitchFlag(const char *flag, JobRequest &job) {
+  TransformOptions &options = job.options;
+  if (strcmp(flag, "-buddy") == 0) {
+    job.buddySystem = true;
+  } else if (strcmp(flag, "-lineal") == 0) {
+    options.linearLight = true;
+  } else if (strcmp(flag, "-ycbcr") == 0) {
+    options.planarYCbCr = true;
+  } else if (strcmp(flag, "-recodificar") == 0) {
+    options.allowLossless = false;
+  } else if (strcmp(flag, "-flujo") == 0) {
+    options.streaming = true;
+  } else if (strcmp(flag, "-rgbx") == 0) {
+    options.paddedRgb = true;
+    job.tuneKernel = false;
+  } else if (strcmp(flag, "-ignorar-exif") == 0) {
+    options.autoOrient = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Applies a job flag that takes a value; see parseJobFlag.
+ */
+static bool parseValueFlag(const char *flag, const char *value,
+                           JobRequest &job) {
+  TransformOptions &options = job.options;
+  if (strcmp(flag, "-angulo") == 0) {
+    job.angle = stoi(value);
+  } else if (strcmp(flag, "-escalar") == 0) {
+    job.scaleFactor = stof(value);
+  } else if (strcmp(flag, "-entrada") == 0) {
+    job.inputPath = value;
+  } else if (strcmp(flag, "-salida") == 0) {
+    job.outputPath = value;
+  } else if (strcmp(flag, "-canales") == 0) {
+    options.desiredChannels = stoi(value);
+  } else if (strcmp(flag, "-profundidad") == 0) {
+    if (strcmp(value, "16") == 0) {
+      options.depth = DEPTH_16;
+    } else if (strcmp(value, "float") == 0) {
+      options.depth = DEPTH_FLOAT;
+    } else if (strcmp(value, "auto") == 0) {
+      options.depth = DEPTH_AUTO;
+    } else {
+      options.depth = DEPTH_8;
+    }
+  } else if (strcmp(flag, "-interpolacion") == 0) {
+    options.interpolation =
+        strcmp(value, "bilineal") == 0 ? INTERP_BILINEAR : INTERP_NEAREST;
+  } else if (strcmp(flag, "-lienzo") == 0) {
+    if (strcmp(value, "original") == 0) {
+      options.canvas = CANVAS_ORIGINAL;
+    } else if (strcmp(value, "interior") == 0) {
+      options.canvas = CANVAS_INNER;
+    } else {
+      options.canvas = CANVAS_EXPAND;
+    }
+  } else if (strcmp(flag, "-teselas") == 0) {
+    options.layout = LAYOUT_TILED;
+    options.tileSize = stoi(value);
+    job.tuneKernel = false;
+  } else if (strcmp(flag, "-voltear") == 0) {
+    options.flip = strcmp(value, "v") == 0 ? FLIP_VERTICAL : FLIP_HORIZONTAL;
+  } else if (strcmp(flag, "-recortar") == 0) {
+    CropRect &crop = options.crop;
+    if (sscanf(value, "%d,%d,%d,%d", &crop.x, &crop.y, &crop.width,
+               &crop.height) != 4) {
+      cerr << "Recorte inválido, use x,y,ancho,alto" << endl;
+      crop = CropRect();
+    }
+  } else if (strcmp(flag, "-hilos") == 0) {
+    options.threads = stoi(value);
+    job.tuneThreads = false;
+  } else if (strcmp(flag, "-prioridad") == 0) {
+    job.priority = stoi(value);
+  } else if (strcmp(flag, "-plazo") == 0) {
+    job.deadline = stod(value);
+  } else if (strcmp(flag, "-vista-previa") == 0) {
+    job.previewPath = value;
+  } else if (strcmp(flag, "-lado-previa") == 0) {
+    job.previewSide = stoi(value);
+  } else if (strcmp(flag, "-escalera") == 0) {
+    stringstream sizes(value);
+    string size;
+    job.ladder.clear();
+    while (getline(sizes, size, ',')) {
+      job.ladder.push_back(stoi(size));
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Applies one job flag, shared by the command line and the lines of
+ * a batch manifest.
+ *
+ * Flags that take a value read it from args[i + 1], and i is advanced past
+ * it. A value flag at the end of the list is not recognised, like an
+ * unknown flag.
+ *
+ * @param args The arguments, without the program name.
+ * @param i Index of the flag; left on the last argument it used.
+ * @param job The job updated by the flag.
+ * @return bool Whether args[i] was a job flag.
+ */
+bool parseJobFlag(const vector<string> &args, size_t &i, JobRequest &job) {
+  if (parseSwitchFlag(args[i].c_str(), job)) {
+    return true;
+  }
+  if (i + 1 < args.size() &&
+      parseValueFlag(args[i].c_str(), args[i + 1].c_str(), job)) {
+    i++;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Splits one manifest line into arguments.
+ *
+ * Arguments are separated by blanks; double quotes keep blanks inside an
+ * argument (paths with spaces) and are removed.
+ *
+ * @param line The manifest line.
+ * @param args Receives the arguments.
+ * @return bool False if a quote is left open.
+ */
+bool splitJobLine(const string &line, vector<string> &args) {
+  args.clear();
+  string current;
+  bool quoted = false, inArgument = false;
+  for (char c : line) {
+    if (c == '"') {
+      quoted = !quoted;
+      inArgument = true;
+    } else if (!quoted && (c == ' ' || c == '\t' || c == '\r')) {
+      if (inArgument) {
+        args.push_back(current);
+        current.clear();
+        inArgument = false;
+      }
+    } else {
+      current += c;
+      inArgument = true;
+    }
+  }
+  if (inArgument) {
+    args.push_back(current);
+  }
+  return !quoted;
+}
+
+/**
+ * @brief Describes everything that decides a job's result: the input path,
+ * the geometry, the transform options and the ladder sizes. The output
+ * path, the buddy pool, the batch priority and deadline, and the settings
+ * that only change how the same pixels are computed (decode threads,
+ * source layout and tile size, RGBX packing) are left out.
+ *
+ * @param job The job to describe.
+ * @return string One line per group of settings.
+ */
+string describeJob(const JobRequest &job) {
+  const TransformOptions &options = job.options;
+  ostringstream text;
+  text << setprecision(9) << job.inputPath << "\n"
+       << job.angle << " " << job.scaleFactor << "\n"
+       << options.desiredChannels << " " << options.depth << " "
+       << options.interpolation << " " << options.linearLight << " "
+       << options.canvas << " " << options.flip << " "
+       << options.allowLossless << "\n"
+       << options.crop.x << " " << options.crop.y << " " << options.crop.width
+       << " " << options.crop.height << "\n"
+       << options.planarYCbCr << " " << options.streaming << " "
+       << options.autoOrient << "\n";
+  for (int size : job.ladder) {
+    text << size << " ";
+  }
+  return text.str();
+}
+
+/**
+ * @brief Writes a preview image, as JPEG or, for ".png" paths, PNG.
+ *
+ * JPEG previews go through the built-in encoder, which takes gray or RGB,
+ * so an alpha channel is dropped first.
+ *
+ * @return bool False for previews deeper than 8 bits, which the preview
+ * file does not support.
+ */
+static bool writePreview(const string &path, const PreviewImage &preview) {
+  if (preview.depth != DEPTH_8) {
+    return false;
+  }
+  if (hasExtension(path, ".png")) {
+    return stbi_write_png(path.c_str(), preview.width, preview.height,
+                          preview.channels, preview.pixels,
+                          preview.width * preview.channels) != 0;
+  }
+  const int colour = preview.channels <= 2 ? 1 : 3;
+  const unsigned char *pixels = preview.pixels;
+  vector<unsigned char> opaque;
+  if (colour != preview.channels) {
+    const size_t count = static_cast<size_t>(preview.width) * preview.height;
+    opaque.resize(count * colour);
+    for (size_t i = 0; i < count; ++i) {
+      memcpy(&opaque[i * colour], &preview.pixels[i * preview.channels],
+             colour);
+    }
+    pixels = opaque.data();
+  }
+  string error;
+  return writeJpegPixels(path, pixels, preview.width, preview.height, colour,
+                         90, error);
+}
+
+/**
+ * @brief Runs a job: a thumbnail ladder when it has sizes, otherwise a
+ * single transform. Settings the job left open come from the process's
+ * tuning profile.
+ *
+ * @param job The job to run.
+ * @param showOutput Whether to print the processing report.
+ * @return bool Whether every output file was written.
+ */
+bool runJob(const JobRequest &job, bool showOutput) {
+  auto start = chrono::steady_clock::now();
+  TransformOptions options = job.options;
+  applyTuningProfile(options, job.tuneKernel, job.tuneThreads);
+  // Set for every job, so a job nested by preemption does not inherit it
+  const function<void(const PreviewImage &)> preview =
+      [&job, showOutput](const PreviewImage &image) {
+        if (!writePreview(job.previewPath, image)) {
+          cerr << "[ERROR] No se pudo escribir la vista previa "
+               << job.previewPath << "\n";
+        } else if (showOutput) {
+          cout << "[INFO] Vista previa guardada en " << job.previewPath
+               << "\n";
+        }
+      };
+  setTransformPreview(job.previewPath.empty() ? nullptr : &preview,
+                      job.previewSide);
+  Image img;
+  const bool written =
+      job.ladder.empty()
+          ? img.transformImage(job.inputPath, job.outputPath, job.angle,
+                               job.scaleFactor, job.buddySystem, showOutput,
+                               options)
+          : img.generateLadder(job.inputPath, job.outputPath, job.ladder,
+                               job.buddySystem, showOutput, options);
+  setTransformPreview(nullptr, 0);
+  metricsRecord(STAGE_JOB, chrono::duration<double, milli>(
+                               chrono::steady_clock::now() - start)
+                               .count());
+  metricsAdd(written ? COUNTER_JOBS : COUNTER_FAILURES);
+  return written;
+}
@@ -0,0 +1,41 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "image.h"
+#include <string>
+#include <vector>
+
+// One transform request: the command line, or one line of a batch manifest.
+struct JobRequest {
+  std::string inputPath = "./test/fish.jpg";
+  std::string outputPath = "./output/output.jpg";
+  int angle = 0;
+  float scaleFactor = 1.0f;
+  bool buddySystem = false;
+  TransformOptions options;
+  std::vector<int> ladder; // Thumbnail sizes; empty runs a single transform
+  int priority = 0;        // Batch order: higher runs first
+  double deadline = 0;     // Batch deadline in seconds, 0 for none
+  bool tuneKernel = true;  // Layout and packing from the tuning profile
+  bool tuneThreads = true; // Decode threads from the tuning profile
+  std::string previewPath; // Fast preview written before the output
+  int previewSide = 256;   // Longest side of the preview
+};
+
+// Applies the job flag at args[i] (and its value, advancing i past it).
+// Returns false when args[i] is not a job flag.
+bool parseJobFlag(const std::vector<std::string> &args, size_t &i,
+                  JobRequest &job);
+
+// Splits a manifest line into arguments at blanks; "..." keeps blanks.
+bool splitJobLine(const std::string &line, std::vector<std::string> &args);
+
+// Canonical text of the settings that decide the result (not the output
+// path, the scheduling flags or the layout, packing and thread settings),
+// so two jobs with the same text compute the same result.
+std::string describeJob(const JobRequest &job);
+
+// Runs the transform or ladder described by the job.
+bool runJob(const JobRequest &job, bool showOutput);
+
+#endif // JOB_H
@@ -0,0 +1,2877 @@
+#include "jpeg_codec.h"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Zig-zag position -> natural (row-major) index within an 8x8 block
+static const int zigzagToNatural[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// Number of bits peeked at once by the fast Huffman lookup
+static const int HUFFMAN_LOOKUP_BITS = 9;
+
+/**
+ * @brief Canonical Huffman table used for decoding.
+ *
+ * Codes up to HUFFMAN_LOOKUP_BITS long are resolved with a single table
+ * lookup; longer codes fall back to the canonical max-code search.
+ */
+struct HuffmanDecodeTable {
+  bool present = false;
+  unsigned char counts[17] = {}; // Codes per length, 1-16
+  unsigned char symbols[256] = {};
+  int maxCode[18] = {};
+  int valueOffset[17] = {};
+  unsigned short lookup[1 << HUFFMAN_LOOKUP_BITS] = {}; // (length << 8) | sym
+
+  void build() {
+    memset(lookup, 0, sizeof(lookup));
+    int code = 0, k = 0;
+    for (int length = 1; length <= 16; length++) {
+      valueOffset[length] = k - code;
+      for (int i = 0; i < counts[length]; i++, code++, k++) {
+        if (length <= HUFFMAN_LOOKUP_BITS) {
+          int shift = HUFFMAN_LOOKUP_BITS - length;
+          for (int fill = 0; fill < (1 << shift); fill++) {
+            lookup[(code << shift) | fill] =
+                static_cast<unsigned short>((length << 8) | symbols[k]);
+          }
+        }
+      }
+      maxCode[length] = counts[length] ? code - 1 : -1;
+      code <<= 1;
+    }
+    maxCode[17] = INT_MAX;
+    present = true;
+  }
+};
+
+/**
+ * @brief Reads entropy-coded bits, removing 0xFF00 byte stuffing.
+ *
+ * Reading stops at the first marker; from then on zero bits are returned,
+ * so a truncated segment never reads past its end.
+ */
+struct BitReader {
+  const unsigned char *data;
+  size_t size;
+  size_t pos;
+  unsigned int buffer = 0;
+  int bits = 0;
+  bool markerHit = false;
+
+  BitReader(const unsigned char *bytes, size_t length, size_t start)
+      : data(bytes), size(length), pos(start) {}
+
+  void fill() {
+    while (bits <= 24) {
+      unsigned int byte = 0;
+      if (!markerHit && pos < size) {
+        byte = data[pos];
+        if (byte == 0xFF) {
+          unsigned int next = pos + 1 < size ? data[pos + 1] : 0xD9;
+          if (next == 0x00) {
+            pos += 2;
+          } else {
+            markerHit = true;
+            byte = 0;
+          }
+        } else {
+          pos++;
+        }
+      }
+      buffer |= byte << (24 - bits);
+      bits += 8;
+    }
+  }
+
+  int peek(int count) {
+    if (bits < count) {
+      fill();
+    }
+    return static_cast<int>(buffer >> (32 - count));
+  }
+
+  void skip(int count) {
+    buffer <<= count;
+    bits -= count;
+  }
+
+  int get(int count) {
+    if (count == 0) {
+      return 0;
+    }
+    int value = peek(count);
+    skip(count);
+    return value;
+  }
+
+  // Discards the padding bits and steps over the RSTn marker
+  void restart() {
+    buffer = 0;
+    bits = 0;
+    if (!markerHit) {
+      while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 &&
+                                 data[pos + 1] <= 0xD7)) {
+        pos++;
+      }
+    }
+    pos += 2;
+    markerHit = false;
+  }
+
+  // Position of the marker that ends the entropy-coded segment
+  size_t markerPosition() const {
+    size_t p = pos;
+    while (p + 1 < size &&
+           !(data[p] == 0xFF && data[p + 1] != 0x00 &&
+             (data[p + 1] < 0xD0 || data[p + 1] > 0xD7))) {
+      p++;
+    }
+    return p;
+  }
+};
+
+/**
+ * @brief Decodes one Huffman symbol, or returns -1 for an invalid code.
+ */
+static int decodeSymbol(BitReader &reader, const HuffmanDecodeTable &table) {
+  int entry = table.lookup[reader.peek(HUFFMAN_LOOKUP_BITS)];
+  if (entry != 0) {
+    reader.skip(entry >> 8);
+    return entry & 0xFF;
+  }
+
+  int code = reader.get(HUFFMAN_LOOKUP_BITS);
+  for (int length = HUFFMAN_LOOKUP_BITS + 1; length <= 16; length++) {
+    code = (code << 1) | reader.get(1);
+    if (code <= table.maxCode[length]) {
+      return table.symbols[table.valueOffset[length] + code];
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Sign-extends a received magnitude category value (F.2.2.1).
+ */
+static inline int extendValue(int value, int size) {
+  return value < (1 << (size - 1)) ? value - (1 << size) + 1 : value;
+}
+
+/**
+ * @brief Decodes one 8x8 block into natural order.
+ *
+ * @return bool False when the entropy-coded data is corrupt.
+ */
+static bool decodeBlock(BitReader &reader, const HuffmanDecodeTable &dc,
+                        const HuffmanDecodeTable &ac, int &predictor,
+                        short *block) {
+  int size = decodeSymbol(reader, dc);
+  if (size < 0 || size > 11) {
+    return false;
+  }
+  predictor += size ? extendValue(reader.get(size), size) : 0;
+  block[0] = static_cast<short>(predictor);
+
+  for (int k = 1; k < 64;) {
+    int symbol = decodeSymbol(reader, ac);
+    if (symbol < 0) {
+      return false;
+    }
+    int run = symbol >> 4;
+    size = symbol & 15;
+    if (size == 0) {
+      if (run != 15) {
+        break; // End of block
+      }
+      k += 16;
+      continue;
+    }
+    k += run;
+    if (k > 63) {
+      return false;
+    }
+    block[zigzagToNatural[k]] =
+        static_cast<short>(extendValue(reader.get(size), size));
+    k++;
+  }
+  return true;
+}
+
+/**
+ * @brief Samples per row and rows of a component at the frame size.
+ *
+ * @param jpeg The frame (size and maximum sampling factors).
+ * @param component The component.
+ * @param width Receives ceil(frame width * h / maxH).
+ * @param height Receives ceil(frame height * v / maxV).
+ */
+void jpegComponentSize(const JpegCoefficients &jpeg,
+                       const JpegComponent &component, int &width,
+                       int &height) {
+  width = (jpeg.width * component.h + jpeg.maxH - 1) / jpeg.maxH;
+  height = (jpeg.height * component.v + jpeg.maxV - 1) / jpeg.maxV;
+}
+
+/**
+ * @brief Derives MCU and block counts from the frame size and sampling.
+ *
+ * Single-component frames are never interleaved, so their blocks are laid
+ * out without MCU padding and their sampling factors are normalised to 1.
+ */
+static void layoutComponents(JpegCoefficients &jpeg) {
+  const bool single = jpeg.components.size() == 1;
+  jpeg.maxH = jpeg.maxV = 1;
+  for (auto &component : jpeg.components) {
+    if (single) {
+      component.h = component.v = 1;
+    }
+    jpeg.maxH = max(jpeg.maxH, component.h);
+    jpeg.maxV = max(jpeg.maxV, component.v);
+  }
+
+  jpeg.mcusWide = (jpeg.width + 8 * jpeg.maxH - 1) / (8 * jpeg.maxH);
+  jpeg.mcusHigh = (jpeg.height + 8 * jpeg.maxV - 1) / (8 * jpeg.maxV);
+
+  for (auto &component : jpeg.components) {
+    int samplesWide = 0, samplesHigh = 0;
+    jpegComponentSize(jpeg, component, samplesWide, samplesHigh);
+    component.blocksWide = (samplesWide + 7) / 8;
+    component.blocksHigh = (samplesHigh + 7) / 8;
+    component.paddedWide =
+        single ? component.blocksWide : jpeg.mcusWide * component.h;
+    component.paddedHigh =
+        single ? component.blocksHigh : jpeg.mcusHigh * component.v;
+  }
+}
+
+/**
+ * @brief Runs `work(begin, end)` over [0, count) in contiguous chunks, one
+ * per thread.
+ *
+ * @param count Number of work items.
+ * @param threads Worker threads; 1 runs on the calling thread.
+ * @param work Callback receiving a half-open item range.
+ */
+template <typename Work>
+static void parallelFor(int count, int threads, Work work) {
+  threads = max(1, min(threads, count));
+  if (threads == 1) {
+    work(0, count);
+    return;
+  }
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++) {
+    const int begin = static_cast<int>(static_cast<long>(count) * t / threads);
+    const int end =
+        static_cast<int>(static_cast<long>(count) * (t + 1) / threads);
+    workers.emplace_back([begin, end, &work]() { work(begin, end); });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+/**
+ * @brief Entropy decoder for one baseline scan.
+ *
+ * MCUs are numbered in scan order; a non-interleaved scan has one block per
+ * MCU over the component's real blocks. Any run of MCUs that starts at a
+ * restart boundary can be decoded on its own, which is what the parallel
+ * mode relies on.
+ */
+struct ScanDecoder {
+  const vector<unsigned char> &file;
+  JpegCoefficients &jpeg;
+  const vector<int> &scanComponents;
+  const vector<const HuffmanDecodeTable *> &dcTables;
+  const vector<const HuffmanDecodeTable *> &acTables;
+  int firstMcuRow; // MCU row stored in block row 0 (streaming holds one)
+
+  long mcuCount() const {
+    if (scanComponents.size() == 1) {
+      const JpegComponent &component = jpeg.components[scanComponents[0]];
+      return static_cast<long>(component.blocksWide) * component.blocksHigh;
+    }
+    return static_cast<long>(jpeg.mcusWide) * jpeg.mcusHigh;
+  }
+
+  bool decodeMcu(BitReader &reader, vector<int> &predictors, long mcu) {
+    if (scanComponents.size() == 1) {
+      JpegComponent &component = jpeg.components[scanComponents[0]];
+      return decodeBlock(reader, *dcTables[0], *acTables[0], predictors[0],
+                         component.block(mcu % component.blocksWide,
+                                         mcu / component.blocksWide -
+                                             firstMcuRow));
+    }
+    const int mx = mcu % jpeg.mcusWide;
+    const int my = mcu / jpeg.mcusWide - firstMcuRow;
+    for (size_t s = 0; s < scanComponents.size(); s++) {
+      JpegComponent &component = jpeg.components[scanComponents[s]];
+      for (int y = 0; y < component.v; y++) {
+        for (int x = 0; x < component.h; x++) {
+          short *block =
+              component.block(mx * component.h + x, my * component.v + y);
+          if (!decodeBlock(reader, *dcTables[s], *acTables[s], predictors[s],
+                           block)) {
+            return false;
+          }
+        }
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Decodes MCUs [first, last) from the byte at `start`.
+   *
+   * @param end If given, receives the position of the marker that ends the
+   * scan (found by a byte scan, so only worth it for the last range).
+   * @return bool False on corrupt data.
+   */
+  bool decodeRange(size_t start, long first, long last,
+                   size_t *end = nullptr) {
+    BitReader reader(file.data(), file.size(), start);
+    vector<int> predictors(scanComponents.size(), 0);
+    for (long mcu = first; mcu < last; mcu++) {
+      if (jpeg.restartInterval > 0 && mcu > first &&
+          mcu % jpeg.restartInterval == 0) {
+        reader.restart();
+        fill(predictors.begin(), predictors.end(), 0);
+      }
+      if (!decodeMcu(reader, predictors, mcu)) {
+        return false;
+      }
+    }
+    if (end) {
+      *end = reader.markerPosition();
+    }
+    return true;
+  }
+};
+
+/**
+ * @brief Finds where each restart interval's data starts.
+ *
+ * @param starts Receives the start of every interval, the first being
+ * `start`.
+ * @return size_t Position of the marker that ends the scan.
+ */
+static size_t findRestartSegments(const vector<unsigned char> &file,
+                                  size_t start, vector<size_t> &starts) {
+  starts.assign(1, start);
+  const unsigned char *data = file.data();
+  size_t pos = start;
+  while (pos + 1 < file.size()) {
+    const void *next = memchr(data + pos, 0xFF, file.size() - pos - 1);
+    if (!next) {
+      return file.size();
+    }
+    pos = static_cast<const unsigned char *>(next) - data;
+    const unsigned char marker = data[pos + 1];
+    if (marker == 0x00) {
+      pos += 2; // Stuffed data byte
+    } else if (marker == 0xFF) {
+      pos++; // Fill byte
+    } else if (marker >= 0xD0 && marker <= 0xD7) {
+      pos += 2;
+      starts.push_back(pos);
+    } else {
+      return pos;
+    }
+  }
+  return file.size();
+}
+
+/**
+ * @brief Decodes the entropy-coded data of one baseline scan.
+ *
+ * With restart markers and more than one thread, the intervals are located
+ * with a byte scan first and then decoded concurrently, each thread taking
+ * a contiguous run of intervals (every interval starts with zeroed DC
+ * predictors, so they are independent). Otherwise, or if the marker count
+ * does not match the MCU count, the scan is decoded sequentially.
+ *
+ * @return size_t Position of the marker that follows the scan, or 0 on
+ * corrupt data.
+ */
+static size_t decodeScan(const vector<unsigned char> &file, size_t start,
+                         JpegCoefficients &jpeg,
+                         const vector<int> &scanComponents,
+                         const vector<const HuffmanDecodeTable *> &dcTables,
+                         const vector<const HuffmanDecodeTable *> &acTables,
+                         int threads) {
+  ScanDecoder decoder = {file, jpeg, scanComponents, dcTables, acTables, 0};
+  const long mcus = decoder.mcuCount();
+  const long interval = jpeg.restartInterval;
+
+  if (threads > 1 && interval > 0 && mcus > interval) {
+    vector<size_t> starts;
+    size_t end = findRestartSegments(file, start, starts);
+    const long segments = (mcus + interval - 1) / interval;
+    if (static_cast<long>(starts.size()) == segments) {
+      atomic<bool> failed(false);
+      parallelFor(static_cast<int>(segments), threads,
+                  [&](int first, int last) {
+        for (int s = first; s < last && !failed; s++) {
+          if (!decoder.decodeRange(starts[s], s * interval,
+                                   min(mcus, (s + 1) * interval))) {
+            failed = true;
+          }
+        }
+      });
+      return failed ? 0 : end;
+    }
+  }
+
+  size_t end = 0;
+  return decoder.decodeRange(start, 0, mcus, &end) ? end : 0;
+}
+
+/**
+ * @brief Checks the first two bytes of a file for the JPEG SOI marker.
+ *
+ * @param path The file to inspect.
+ * @return bool True for JPEG files.
+ */
+bool isJpegFile(const string &path) {
+  ifstream in(path, ios::binary);
+  unsigned char soi[2] = {0, 0};
+  in.read(reinterpret_cast<char *>(soi), 2);
+  return in && soi[0] == 0xFF && soi[1] == 0xD8;
+}
+
+/**
+ * @brief Walks the segments of a baseline JPEG held in memory.
+ *
+ * Only sequential Huffman files are supported (SOF0/SOF1, 8-bit samples),
+ * which is what cameras and stb_image_write produce. Progressive and
+ * arithmetic-coded files are rejected so the caller can fall back to the
+ * pixel path. APPn and COM segments are kept verbatim for the writer.
+ *
+ * @param file The whole file.
+ * @param jpeg Receives the frame, tables and segments.
+ * @param allocate Whether to allocate every component's blocks.
+ * @param error Receives a reason when the file cannot be used.
+ * @param visitScan Called for every scan as `(start, components, dc, ac)`;
+ * returns the position of the marker after the scan, 0 on corrupt data,
+ * or the file size to stop parsing.
+ * @return bool True on success.
+ */
+template <typename ScanVisitor>
+static bool parseJpeg(const vector<unsigned char> &file,
+                      JpegCoefficients &jpeg, bool allocate, string &error,
+                      ScanVisitor visitScan) {
+  if (file.size() < 4 || file[0] != 0xFF || file[1] != 0xD8) {
+    error = "no es un archivo JPEG";
+    return false;
+  }
+
+  jpeg = JpegCoefficients();
+  HuffmanDecodeTable dcTables[4], acTables[4];
+  bool frameSeen = false, scanSeen = false;
+  size_t pos = 2;
+
+  while (pos + 4 <= file.size()) {
+    if (file[pos] != 0xFF) {
+      error = "marcador JPEG inválido";
+      return false;
+    }
+    unsigned char marker = file[pos + 1];
+    if (marker == 0xFF) {
+      pos++; // Fill byte
+      continue;
+    }
+    pos += 2;
+    if (marker == 0xD9) {
+      break; // EOI
+    }
+    if (marker >= 0xD0 && marker <= 0xD7) {
+      continue; // Stray restart marker
+    }
+
+    size_t length = (file[pos] << 8) | file[pos + 1];
+    if (length < 2 || pos + length > file.size()) {
+      error = "segmento JPEG truncado";
+      return false;
+    }
+    const unsigned char *segment = &file[pos + 2];
+    const size_t segmentLength = length - 2;
+
+    if ((marker >= 0xE0 && marker <= 0xEF) || marker == 0xFE) {
+      // APPn / COM: carried over to the output unchanged
+      jpeg.extraSegments.emplace_back(file.begin() + pos - 2,
+                                      file.begin() + pos + length);
+    } else if (marker == 0xDB) {
+      for (size_t p = 0; p < segmentLength;) {
+        int precision = segment[p] >> 4;
+        int table = segment[p] & 15;
+        p++;
+        if (table > 3 || p + (precision ? 128 : 64) > segmentLength) {
+          error = "tabla de cuantización inválida";
+          return false;
+        }
+        for (int k = 0; k < 64; k++) {
+          unsigned short value = precision
+                                     ? (segment[p + 2 * k] << 8) |
+                                           segment[p + 2 * k + 1]
+                                     : segment[p + k];
+          jpeg.quantTables[table][zigzagToNatural[k]] = value;
+        }
+        jpeg.quantTablePresent[table] = true;
+        p += precision ? 128 : 64;
+      }
+    } else if (marker == 0xC4) {
+      for (size_t p = 0; p < segmentLength;) {
+        int tableClass = segment[p] >> 4;
+        int table = segment[p] & 15;
+        if (table > 3 || tableClass > 1 || p + 17 > segmentLength) {
+          error = "tabla Huffman inválida";
+          return false;
+        }
+        HuffmanDecodeTable &target =
+            tableClass ? acTables[table] : dcTables[table];
+        // More codes of a length than it has room for would overrun the
+        // lookup table
+        int total = 0, code = 0;
+        bool overfull = false;
+        for (int i = 1; i <= 16; i++) {
+          target.counts[i] = segment[p + i];
+          total += segment[p + i];
+          code += segment[p + i];
+          overfull = overfull || code > (1 << i);
+          code <<= 1;
+        }
+        p += 17;
+        if (total > 256 || overfull || p + total > segmentLength) {
+          error = "tabla Huffman inválida";
+          return false;
+        }
+        memcpy(target.symbols, segment + p, total);
+        target.build();
+        p += total;
+      }
+    } else if (marker == 0xDD) {
+      if (segmentLength < 2) {
+        error = "segmento JPEG truncado";
+        return false;
+      }
+      jpeg.restartInterval = (segment[0] << 8) | segment[1];
+    } else if (marker == 0xC0 || marker == 0xC1) {
+      if (segmentLength < 6) {
+        error = "segmento JPEG truncado";
+        return false;
+      }
+      if (segment[0] != 8) {
+        error = "solo se admiten muestras de 8 bits";
+        return false;
+      }
+      jpeg.height = (segment[1] << 8) | segment[2];
+      jpeg.width = (segment[3] << 8) | segment[4];
+      int count = segment[5];
+      if (jpeg.width == 0 || jpeg.height == 0 || count < 1 || count > 4 ||
+          segmentLength < 6 + 3 * static_cast<size_t>(count)) {
+        error = "cabecera de imagen no soportada";
+        return false;
+      }
+      for (int c = 0; c < count; c++) {
+        JpegComponent component;
+        component.id = segment[6 + 3 * c];
+        component.h = max(1, segment[7 + 3 * c] >> 4);
+        component.v = max(1, segment[7 + 3 * c] & 15);
+        component.quantTable = segment[8 + 3 * c] & 3;
+        jpeg.components.push_back(component);
+      }
+      layoutComponents(jpeg);
+      for (auto &component : jpeg.components) {
+        if (!allocate) {
+          break;
+        }
+        component.coefficients.assign(
+            static_cast<size_t>(component.paddedWide) * component.paddedHigh *
+                64,
+            0);
+      }
+      frameSeen = true;
+    } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 &&
+               marker != 0xC8 && marker != 0xCC) {
+      error = "JPEG progresivo o con codificación aritmética";
+      return false;
+    } else if (marker == 0xDA) {
+      if (!frameSeen) {
+        error = "escaneo antes de la cabecera de imagen";
+        return false;
+      }
+      int count = segmentLength > 0 ? segment[0] : 0;
+      if (segmentLength < 1 + 2 * static_cast<size_t>(count) + 3) {
+        error = "segmento JPEG truncado";
+        return false;
+      }
+      vector<int> scanComponents;
+      vector<const HuffmanDecodeTable *> dc, ac;
+      for (int s = 0; s < count; s++) {
+        int id = segment[1 + 2 * s];
+        int selectors = segment[2 + 2 * s];
+        int index = -1;
+        for (size_t c = 0; c < jpeg.components.size(); c++) {
+          if (jpeg.components[c].id == id) {
+            index = static_cast<int>(c);
+          }
+        }
+        const HuffmanDecodeTable &dcTable = dcTables[(selectors >> 4) & 3];
+        const HuffmanDecodeTable &acTable = acTables[selectors & 3];
+        if (index < 0 || !dcTable.present || !acTable.present) {
+          error = "escaneo con componente o tabla desconocida";
+          return false;
+        }
+        scanComponents.push_back(index);
+        dc.push_back(&dcTable);
+        ac.push_back(&acTable);
+      }
+      const unsigned char *spectral = segment + 1 + 2 * count;
+      if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) {
+        error = "escaneo no secuencial";
+        return false;
+      }
+
+      size_t next = visitScan(pos + length, scanComponents, dc, ac);
+      if (next == 0) {
+        error = "datos de entropía corruptos";
+        return false;
+      }
+      scanSeen = true;
+      pos = next;
+      continue;
+    }
+    pos += length;
+  }
+
+  if (!frameSeen || !scanSeen) {
+    error = "JPEG sin imagen";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Entropy-decodes a baseline JPEG into quantised DCT blocks.
+ *
+ * @param path The JPEG file to read.
+ * @param jpeg Receives the coefficients and tables.
+ * @param error Receives a reason when the file cannot be used.
+ * @param threads Threads for scans with restart markers.
+ * @return bool True on success.
+ */
+bool readJpegCoefficients(const string &path, JpegCoefficients &jpeg,
+                          string &error, int threads) {
+  ifstream in(path, ios::binary);
+  vector<unsigned char> file((istreambuf_iterator<char>(in)),
+                             istreambuf_iterator<char>());
+  return parseJpeg(
+      file, jpeg, true, error,
+      [&](size_t start, const vector<int> &scanComponents,
+          const vector<const HuffmanDecodeTable *> &dc,
+          const vector<const HuffmanDecodeTable *> &ac) {
+        return decodeScan(file, start, jpeg, scanComponents, dc, ac, threads);
+      });
+}
+
+/**
+ * @brief Huffman code assignment used for encoding.
+ */
+struct HuffmanEncodeTable {
+  unsigned char counts[17] = {};
+  unsigned char symbols[256] = {};
+  int symbolCount = 0;
+  unsigned short code[256] = {};
+  unsigned char length[256] = {};
+};
+
+/**
+ * @brief Assigns canonical codes from a table's counts and symbols.
+ */
+static void assignHuffmanCodes(HuffmanEncodeTable &table) {
+  int code = 0, k = 0;
+  for (int size = 1; size <= 16; size++) {
+    for (int i = 0; i < table.counts[size]; i++, k++, code++) {
+      table.code[table.symbols[k]] = static_cast<unsigned short>(code);
+      table.length[table.symbols[k]] = static_cast<unsigned char>(size);
+    }
+    code <<= 1;
+  }
+}
+
+/**
+ * @brief Builds an optimal length-limited Huffman table (ITU T.81 K.2).
+ *
+ * A reserved pseudo-symbol guarantees that no code consists only of 1-bits,
+ * and code lengths above 16 are folded back as the standard describes.
+ *
+ * @param frequencies Symbol counts gathered from the data to encode.
+ * @param table Receives the counts, symbols and code assignments.
+ */
+static void buildOptimalTable(const long frequencies[256],
+                              HuffmanEncodeTable &table) {
+  long freq[257];
+  int codeSize[257] = {};
+  int others[257];
+  unsigned char bits[33] = {};
+
+  bool any = false;
+  for (int i = 0; i < 256; i++) {
+    freq[i] = frequencies[i];
+    any = any || freq[i] > 0;
+  }
+  if (!any) {
+    freq[0] = 1; // Tables must contain at least one real code
+  }
+  freq[256] = 1;
+  fill(others, others + 257, -1);
+
+  for (;;) {
+    int c1 = -1, c2 = -1;
+    long v = LONG_MAX;
+    for (int i = 0; i <= 256; i++) {
+      if (freq[i] && freq[i] <= v) {
+        v = freq[i];
+        c1 = i;
+      }
+    }
+    v = LONG_MAX;
+    for (int i = 0; i <= 256; i++) {
+      if (freq[i] && freq[i] <= v && i != c1) {
+        v = freq[i];
+        c2 = i;
+      }
+    }
+    if (c2 < 0) {
+      break;
+    }
+
+    freq[c1] += freq[c2];
+    freq[c2] = 0;
+    codeSize[c1]++;
+    while (others[c1] >= 0) {
+      c1 = others[c1];
+      codeSize[c1]++;
+    }
+    others[c1] = c2;
+    codeSize[c2]++;
+    while (others[c2] >= 0) {
+      c2 = others[c2];
+      codeSize[c2]++;
+    }
+  }
+
+  for (int i = 0; i <= 256; i++) {
+    if (codeSize[i]) {
+      bits[min(codeSize[i], 32)]++;
+    }
+  }
+
+  for (int i = 32; i > 16; i--) {
+    while (bits[i] > 0) {
+      int j = i - 2;
+      while (bits[j] == 0) {
+        j--;
+      }
+      bits[i] -= 2;
+      bits[i - 1]++;
+      bits[j + 1] += 2;
+      bits[j]--;
+    }
+  }
+  int longest = 16;
+  while (bits[longest] == 0) {
+    longest--;
+  }
+  bits[longest]--; // Drop the reserved pseudo-symbol
+
+  memcpy(table.counts, bits, 17);
+  table.counts[0] = 0;
+  table.symbolCount = 0;
+  for (int size = 1; size <= 32; size++) {
+    for (int symbol = 0; symbol < 256; symbol++) {
+      if (codeSize[symbol] == size) {
+        table.symbols[table.symbolCount++] =
+            static_cast<unsigned char>(symbol);
+      }
+    }
+  }
+
+  assignHuffmanCodes(table);
+}
+
+/**
+ * @brief Writes entropy-coded bits with 0xFF byte stuffing.
+ *
+ * Bits collect in a 64-bit accumulator and leave it 32 at a time; a word
+ * without any 0xFF byte (the common case) is appended in one go, and only
+ * words containing one take the byte-by-byte stuffing path.
+ */
+struct BitWriter {
+  vector<unsigned char> &out;
+  uint64_t buffer = 0;
+  int bits = 0;
+
+  explicit BitWriter(vector<unsigned char> &bytes) : out(bytes) {}
+
+  void put(unsigned int value, int count) {
+    buffer = (buffer << count) | (value & ((1u << count) - 1));
+    bits += count;
+    if (bits >= 32) {
+      bits -= 32;
+      uint32_t word = static_cast<uint32_t>(buffer >> bits);
+      uint32_t inverted = ~word;
+      if (((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0) {
+        const unsigned char bytes[4] = {
+            static_cast<unsigned char>(word >> 24),
+            static_cast<unsigned char>(word >> 16),
+            static_cast<unsigned char>(word >> 8),
+            static_cast<unsigned char>(word)};
+        out.insert(out.end(), bytes, bytes + 4);
+      } else {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+          putByte(static_cast<unsigned char>(word >> shift));
+        }
+      }
+    }
+  }
+
+  void putByte(unsigned char byte) {
+    out.push_back(byte);
+    if (byte == 0xFF) {
+      out.push_back(0x00);
+    }
+  }
+
+  // Pads the last byte with 1-bits, as required before a marker
+  void flush() {
+    if (bits % 8 != 0) {
+      put(0x7F, 8 - bits % 8);
+    }
+    while (bits >= 8) {
+      bits -= 8;
+      putByte(static_cast<unsigned char>(buffer >> bits));
+    }
+  }
+};
+
+/**
+ * @brief Number of bits needed for the magnitude of a coefficient.
+ */
+static inline int magnitudeBits(int value) {
+  value = abs(value);
+#if defined(__GNUC__)
+  return value ? 32 - __builtin_clz(static_cast<unsigned int>(value)) : 0;
+#else
+  int bits = 0;
+  while (value) {
+    bits++;
+    value >>= 1;
+  }
+  return bits;
+#endif
+}
+
+/**
+ * @brief Counts the Huffman symbols one block will emit.
+ */
+static void countBlock(const short *block, int &predictor, long *dcFreq,
+                       long *acFreq) {
+  int diff = block[0] - predictor;
+  predictor = block[0];
+  dcFreq[magnitudeBits(diff)]++;
+
+  int run = 0;
+  for (int k = 1; k < 64; k++) {
+    int value = block[zigzagToNatural[k]];
+    if (value == 0) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      acFreq[0xF0]++;
+      run -= 16;
+    }
+    acFreq[(run << 4) | magnitudeBits(value)]++;
+    run = 0;
+  }
+  if (run > 0) {
+    acFreq[0x00]++;
+  }
+}
+
+/**
+ * @brief Huffman-codes one block in baseline order.
+ */
+static void encodeBlock(BitWriter &writer, const short *block, int &predictor,
+                        const HuffmanEncodeTable &dc,
+                        const HuffmanEncodeTable &ac) {
+  int diff = block[0] - predictor;
+  predictor = block[0];
+  int size = magnitudeBits(diff);
+  writer.put(dc.code[size], dc.length[size]);
+  if (size) {
+    writer.put(diff < 0 ? diff - 1 : diff, size);
+  }
+
+  int run = 0;
+  for (int k = 1; k < 64; k++) {
+    int value = block[zigzagToNatural[k]];
+    if (value == 0) {
+      run++;
+      continue;
+    }
+    while (run > 15) {
+      writer.put(ac.code[0xF0], ac.length[0xF0]);
+      run -= 16;
+    }
+    size = magnitudeBits(value);
+    int symbol = (run << 4) | size;
+    writer.put(ac.code[symbol], ac.length[symbol]);
+    writer.put(value < 0 ? value - 1 : value, size);
+    run = 0;
+  }
+  if (run > 0) {
+    writer.put(ac.code[0x00], ac.length[0x00]);
+  }
+}
+
+/**
+ * @brief Visits every block in the order of a single baseline scan.
+ *
+ * `visit(componentIndex, block)` is called per block and `restart()` before
+ * every MCU that starts a new restart interval.
+ */
+template <typename Visit, typename Restart>
+static void forEachScanBlock(const JpegCoefficients &jpeg, Visit visit,
+                             Restart restart) {
+  long mcu = 0;
+  auto beginMcu = [&]() {
+    if (jpeg.restartInterval > 0 && mcu > 0 &&
+        mcu % jpeg.restartInterval == 0) {
+      restart(mcu / jpeg.restartInterval - 1);
+    }
+    mcu++;
+  };
+
+  if (jpeg.components.size() == 1) {
+    const JpegComponent &component = jpeg.components[0];
+    for (int by = 0; by < component.blocksHigh; by++) {
+      for (int bx = 0; bx < component.blocksWide; bx++) {
+        beginMcu();
+        visit(0, component.block(bx, by));
+      }
+    }
+    return;
+  }
+
+  for (int my = 0; my < jpeg.mcusHigh; my++) {
+    for (int mx = 0; mx < jpeg.mcusWide; mx++) {
+      beginMcu();
+      for (size_t c = 0; c < jpeg.components.size(); c++) {
+        const JpegComponent &component = jpeg.components[c];
+        for (int y = 0; y < component.v; y++) {
+          for (int x = 0; x < component.h; x++) {
+            visit(static_cast<int>(c), component.block(mx * component.h + x,
+                                                       my * component.v + y));
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief Appends a marker segment (marker, length, payload).
+ */
+static void appendSegment(vector<unsigned char> &out, unsigned char marker,
+                          const vector<unsigned char> &payload) {
+  size_t length = payload.size() + 2;
+  out.push_back(0xFF);
+  out.push_back(marker);
+  out.push_back(static_cast<unsigned char>(length >> 8));
+  out.push_back(static_cast<unsigned char>(length & 0xFF));
+  out.insert(out.end(), payload.begin(), payload.end());
+}
+
+/**
+ * @brief Appends everything from SOI up to and including the SOS header.
+ *
+ * Writes the extra segments, the quantisation tables (16-bit entries only
+ * when needed, which also selects an extended-sequential SOF1), the frame
+ * header, the Huffman tables, the restart interval and a single
+ * interleaved scan header. Component 0 uses tables 0 and the others share
+ * tables 1.
+ */
+static void appendFrameHeaders(const JpegCoefficients &jpeg,
+                               const HuffmanEncodeTable dcTables[2],
+                               const HuffmanEncodeTable acTables[2],
+                               vector<unsigned char> &out) {
+  out.assign({0xFF, 0xD8});
+  for (const auto &segment : jpeg.extraSegments) {
+    out.insert(out.end(), segment.begin(), segment.end());
+  }
+
+  bool extended = false;
+  for (int t = 0; t < 4; t++) {
+    if (!jpeg.quantTablePresent[t]) {
+      continue;
+    }
+    bool wide = false;
+    for (int k = 0; k < 64; k++) {
+      wide = wide || jpeg.quantTables[t][k] > 255;
+    }
+    extended = extended || wide;
+    vector<unsigned char> payload = {
+        static_cast<unsigned char>((wide ? 0x10 : 0x00) | t)};
+    for (int k = 0; k < 64; k++) {
+      unsigned short value = jpeg.quantTables[t][zigzagToNatural[k]];
+      if (wide) {
+        payload.push_back(static_cast<unsigned char>(value >> 8));
+      }
+      payload.push_back(static_cast<unsigned char>(value & 0xFF));
+    }
+    appendSegment(out, 0xDB, payload);
+  }
+
+  // 16-bit quantisation tables are only legal in extended sequential frames
+  vector<unsigned char> frame = {
+      8,
+      static_cast<unsigned char>(jpeg.height >> 8),
+      static_cast<unsigned char>(jpeg.height & 0xFF),
+      static_cast<unsigned char>(jpeg.width >> 8),
+      static_cast<unsigned char>(jpeg.width & 0xFF),
+      static_cast<unsigned char>(jpeg.components.size())};
+  for (const auto &component : jpeg.components) {
+    frame.push_back(static_cast<unsigned char>(component.id));
+    frame.push_back(
+        static_cast<unsigned char>((component.h << 4) | component.v));
+    frame.push_back(static_cast<unsigned char>(component.quantTable));
+  }
+  appendSegment(out, extended ? 0xC1 : 0xC0, frame);
+
+  const int tableCount = jpeg.components.size() > 1 ? 2 : 1;
+  for (int t = 0; t < tableCount; t++) {
+    for (int tableClass = 0; tableClass < 2; tableClass++) {
+      const HuffmanEncodeTable &table =
+          tableClass ? acTables[t] : dcTables[t];
+      vector<unsigned char> payload = {
+          static_cast<unsigned char>((tableClass << 4) | t)};
+      payload.insert(payload.end(), table.counts + 1, table.counts + 17);
+      payload.insert(payload.end(), table.symbols,
+                     table.symbols + table.symbolCount);
+      appendSegment(out, 0xC4, payload);
+    }
+  }
+
+  if (jpeg.restartInterval > 0) {
+    appendSegment(out, 0xDD,
+                  {static_cast<unsigned char>(jpeg.restartInterval >> 8),
+                   static_cast<unsigned char>(jpeg.restartInterval & 0xFF)});
+  }
+
+  vector<unsigned char> scan = {
+      static_cast<unsigned char>(jpeg.components.size())};
+  for (size_t c = 0; c < jpeg.components.size(); c++) {
+    int t = c == 0 ? 0 : 1;
+    scan.push_back(static_cast<unsigned char>(jpeg.components[c].id));
+    scan.push_back(static_cast<unsigned char>((t << 4) | t));
+  }
+  scan.insert(scan.end(), {0, 63, 0});
+  appendSegment(out, 0xDA, scan);
+}
+
+/**
+ * @brief Entropy-codes DCT blocks into an in-memory baseline JPEG.
+ *
+ * Huffman tables are optimised for the data in a first pass (the blocks may
+ * have been rearranged, so the source file's tables are not guaranteed to
+ * contain every symbol). Luma uses table 0 and chroma shares table 1. The
+ * restart interval of the source is preserved.
+ *
+ * @param jpeg The coefficients, tables and extra segments to write.
+ * @param out Receives the complete file, SOI to EOI.
+ */
+void encodeJpegCoefficients(const JpegCoefficients &jpeg,
+                            vector<unsigned char> &out) {
+  auto tableFor = [](int component) { return component == 0 ? 0 : 1; };
+  const int tableCount = jpeg.components.size() > 1 ? 2 : 1;
+
+  // Pass 1: symbol statistics
+  long dcFreq[2][256] = {}, acFreq[2][256] = {};
+  vector<int> predictors(jpeg.components.size(), 0);
+  forEachScanBlock(
+      jpeg,
+      [&](int c, const short *block) {
+        countBlock(block, predictors[c], dcFreq[tableFor(c)],
+                   acFreq[tableFor(c)]);
+      },
+      [&](long) { fill(predictors.begin(), predictors.end(), 0); });
+
+  HuffmanEncodeTable dcTables[2], acTables[2];
+  for (int t = 0; t < tableCount; t++) {
+    buildOptimalTable(dcFreq[t], dcTables[t]);
+    buildOptimalTable(acFreq[t], acTables[t]);
+  }
+
+  appendFrameHeaders(jpeg, dcTables, acTables, out);
+
+  // Pass 2: entropy-coded data
+  BitWriter writer(out);
+  fill(predictors.begin(), predictors.end(), 0);
+  forEachScanBlock(
+      jpeg,
+      [&](int c, const short *block) {
+        encodeBlock(writer, block, predictors[c], dcTables[tableFor(c)],
+                    acTables[tableFor(c)]);
+      },
+      [&](long interval) {
+        writer.flush();
+        out.push_back(0xFF);
+        out.push_back(static_cast<unsigned char>(0xD0 + (interval & 7)));
+        fill(predictors.begin(), predictors.end(), 0);
+      });
+  writer.flush();
+  out.push_back(0xFF);
+  out.push_back(0xD9);
+}
+
+/**
+ * @brief Saves a finished file in one write.
+ */
+static bool saveBytes(const string &path, const vector<unsigned char> &out,
+                      string &error) {
+  ofstream file(path, ios::binary);
+  file.write(reinterpret_cast<const char *>(out.data()), out.size());
+  if (!file) {
+    error = "no se pudo escribir " + path;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Entropy-codes DCT blocks into a baseline JPEG file.
+ *
+ * @param path The file to write.
+ * @param jpeg The coefficients, tables and extra segments to write.
+ * @param error Receives a reason on failure.
+ * @return bool True on success.
+ */
+bool writeJpegCoefficients(const string &path, const JpegCoefficients &jpeg,
+                           string &error) {
+  vector<unsigned char> out;
+  encodeJpegCoefficients(jpeg, out);
+  return saveBytes(path, out, error);
+}
+
+/**
+ * @brief Whether a transform swaps the horizontal and vertical axes.
+ */
+static bool transposesAxes(JpegTransform transform) {
+  return transform == JPEG_TRANSPOSE || transform == JPEG_TRANSVERSE ||
+         transform == JPEG_ROT_90 || transform == JPEG_ROT_270;
+}
+
+/**
+ * @brief Checks that a transform only moves whole MCUs.
+ *
+ * Mirroring an axis moves the partial MCU at its far edge to the near edge,
+ * which cannot be expressed with whole blocks. Such files are left to the
+ * pixel path instead of being trimmed, so the output size always matches.
+ *
+ * @param jpeg The decoded coefficients.
+ * @param transform The requested transform.
+ * @return bool True when the transform is exact.
+ */
+bool isLosslessTransformPossible(const JpegCoefficients &jpeg,
+                                 JpegTransform transform) {
+  bool mirrorsX = transform == JPEG_FLIP_H || transform == JPEG_ROT_180 ||
+                  transform == JPEG_ROT_270 || transform == JPEG_TRANSVERSE;
+  bool mirrorsY = transform == JPEG_FLIP_V || transform == JPEG_ROT_180 ||
+                  transform == JPEG_ROT_90 || transform == JPEG_TRANSVERSE;
+  return (!mirrorsX || jpeg.width % (8 * jpeg.maxH) == 0) &&
+         (!mirrorsY || jpeg.height % (8 * jpeg.maxV) == 0);
+}
+
+/**
+ * @brief Rearranges DCT blocks for a right-angle rotation or flip.
+ *
+ * Each output block is taken from the mirrored/transposed block position.
+ * Inside a block, transposing swaps the coefficient indices, and mirroring
+ * an axis negates the coefficients with an odd frequency along it (the
+ * basis functions with odd frequency are antisymmetric). Quantisation tables
+ * and sampling factors are transposed along with the blocks. Blocks in the
+ * MCU padding take the DC of the nearest real block.
+ *
+ * @param jpeg The coefficients to transform in place.
+ * @param transform The transform to apply.
+ */
+void transformJpegCoefficients(JpegCoefficients &jpeg,
+                               JpegTransform transform) {
+  if (transform == JPEG_NONE) {
+    return;
+  }
+  const bool transposes = transposesAxes(transform);
+
+  vector<JpegComponent> sources;
+  sources.swap(jpeg.components);
+
+  if (transposes) {
+    swap(jpeg.width, jpeg.height);
+    for (int t = 0; t < 4; t++) {
+      for (int v = 0; v < 8; v++) {
+        for (int u = v + 1; u < 8; u++) {
+          swap(jpeg.quantTables[t][v * 8 + u], jpeg.quantTables[t][u * 8 + v]);
+        }
+      }
+    }
+  }
+
+  for (const auto &source : sources) {
+    JpegComponent component;
+    component.id = source.id;
+    component.quantTable = source.quantTable;
+    component.h = transposes ? source.v : source.h;
+    component.v = transposes ? source.h : source.v;
+    jpeg.components.push_back(component);
+  }
+  layoutComponents(jpeg);
+
+  for (size_t c = 0; c < sources.size(); c++) {
+    const JpegComponent &in = sources[c];
+    JpegComponent &out = jpeg.components[c];
+    out.coefficients.assign(
+        static_cast<size_t>(out.paddedWide) * out.paddedHigh * 64, 0);
+    const int lastX = in.blocksWide - 1, lastY = in.blocksHigh - 1;
+
+    for (int oy = 0; oy < out.paddedHigh; oy++) {
+      for (int ox = 0; ox < out.paddedWide; ox++) {
+        int rx = min(ox, out.blocksWide - 1);
+        int ry = min(oy, out.blocksHigh - 1);
+        int sx = rx, sy = ry;
+        switch (transform) {
+        case JPEG_FLIP_H:
+          sx = lastX - rx;
+          break;
+        case JPEG_FLIP_V:
+          sy = lastY - ry;
+          break;
+        case JPEG_TRANSPOSE:
+          sx = ry;
+          sy = rx;
+          break;
+        case JPEG_TRANSVERSE:
+          sx = lastX - ry;
+          sy = lastY - rx;
+          break;
+        case JPEG_ROT_90:
+          sx = ry;
+          sy = lastY - rx;
+          break;
+        case JPEG_ROT_180:
+          sx = lastX - rx;
+          sy = lastY - ry;
+          break;
+        case JPEG_ROT_270:
+          sx = lastX - ry;
+          sy = rx;
+          break;
+        default:
+          break;
+        }
+
+        const short *src = in.block(sx, sy);
+        short *dst = out.block(ox, oy);
+        if (rx != ox || ry != oy) {
+          dst[0] = src[0]; // Padding block: flat, nearest real DC
+          continue;
+        }
+
+        for (int v = 0; v < 8; v++) {
+          for (int u = 0; u < 8; u++) {
+            int value = transposes ? src[u * 8 + v] : src[v * 8 + u];
+            bool negate = false;
+            switch (transform) {
+            case JPEG_FLIP_H:
+              negate = u & 1;
+              break;
+            case JPEG_FLIP_V:
+              negate = v & 1;
+              break;
+            case JPEG_TRANSVERSE:
+            case JPEG_ROT_180:
+              negate = (u + v) & 1;
+              break;
+            case JPEG_ROT_90:
+              negate = u & 1;
+              break;
+            case JPEG_ROT_270:
+              negate = v & 1;
+              break;
+            default:
+              break;
+            }
+            dst[v * 8 + u] = static_cast<short>(negate ? -value : value);
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief Keeps only the blocks covering an MCU-aligned region.
+ *
+ * The region's origin must be a multiple of the MCU size; its far edges may
+ * fall anywhere, the last partial MCU is kept whole and the frame size hides
+ * the rest, as in the original file. No block is decoded, so the region is
+ * bit-exact with the source.
+ *
+ * @param jpeg The coefficients to crop in place.
+ * @param x Left edge in pixels, a multiple of 8 * maxH.
+ * @param y Top edge in pixels, a multiple of 8 * maxV.
+ * @param cropWidth Region width in pixels.
+ * @param cropHeight Region height in pixels.
+ */
+void cropJpegCoefficients(JpegCoefficients &jpeg, int x, int y, int cropWidth,
+                          int cropHeight) {
+  const int mcuX = x / (8 * jpeg.maxH), mcuY = y / (8 * jpeg.maxV);
+
+  vector<JpegComponent> sources;
+  sources.swap(jpeg.components);
+  jpeg.width = cropWidth;
+  jpeg.height = cropHeight;
+  for (const auto &source : sources) {
+    JpegComponent component;
+    component.id = source.id;
+    component.quantTable = source.quantTable;
+    component.h = source.h;
+    component.v = source.v;
+    jpeg.components.push_back(component);
+  }
+  layoutComponents(jpeg);
+
+  for (size_t c = 0; c < sources.size(); c++) {
+    const JpegComponent &in = sources[c];
+    JpegComponent &out = jpeg.components[c];
+    out.coefficients.assign(
+        static_cast<size_t>(out.paddedWide) * out.paddedHigh * 64, 0);
+    const int offsetX = mcuX * in.h, offsetY = mcuY * in.v;
+
+    for (int oy = 0; oy < out.paddedHigh; oy++) {
+      const int sy = min(offsetY + oy, in.paddedHigh - 1);
+      for (int ox = 0; ox < out.paddedWide; ox++) {
+        const int sx = min(offsetX + ox, in.paddedWide - 1);
+        memcpy(out.block(ox, oy), in.block(sx, sy), 64 * sizeof(short));
+      }
+    }
+  }
+}
+
+/**
+ * @brief DCT basis: dctBasis[x][u] = C(u) / 2 * cos((2x + 1) u pi / 16).
+ *
+ * With this normalisation the 2-D transform is orthonormal, so the same
+ * table serves the forward and the inverse DCT.
+ */
+static const struct DctBasis {
+  float table[8][8];
+  DctBasis() {
+    for (int x = 0; x < 8; x++) {
+      for (int u = 0; u < 8; u++) {
+        float scale = u == 0 ? sqrt(0.125f) : 0.5f;
+        table[x][u] = scale * cos((2 * x + 1) * u * M_PI / 16);
+      }
+    }
+  }
+} dctBasis;
+
+/**
+ * @brief Dequantises and inverse-DCTs one block.
+ *
+ * Separable: rows first, skipping rows whose coefficients are all zero
+ * (most of them, after quantisation). Results are clamped to the 8-bit
+ * range the encoder started from, centred on 0.
+ */
+static void inverseDctBlock(const short *block, const unsigned short *quant,
+                            float out[64]) {
+  float rows[64];
+  for (int v = 0; v < 8; v++) {
+    const short *row = block + v * 8;
+    bool empty = true;
+    for (int u = 0; u < 8 && empty; u++) {
+      empty = row[u] == 0;
+    }
+    for (int x = 0; x < 8; x++) {
+      float sum = 0;
+      if (!empty) {
+        for (int u = 0; u < 8; u++) {
+          sum += dctBasis.table[x][u] * row[u] * quant[v * 8 + u];
+        }
+      }
+      rows[v * 8 + x] = sum;
+    }
+  }
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      float sum = 0;
+      for (int v = 0; v < 8; v++) {
+        sum += dctBasis.table[y][v] * rows[v * 8 + x];
+      }
+      out[y * 8 + x] = sum < -128 ? -128 : (sum > 127 ? 127 : sum);
+    }
+  }
+}
+
+/**
+ * @brief Forward-DCTs and quantises one block of level-shifted samples.
+ */
+static void forwardDctBlock(const float in[64], const unsigned short *quant,
+                            short *block) {
+  float rows[64];
+  for (int y = 0; y < 8; y++) {
+    for (int u = 0; u < 8; u++) {
+      float sum = 0;
+      for (int x = 0; x < 8; x++) {
+        sum += dctBasis.table[x][u] * in[y * 8 + x];
+      }
+      rows[y * 8 + u] = sum;
+    }
+  }
+  for (int v = 0; v < 8; v++) {
+    for (int u = 0; u < 8; u++) {
+      float sum = 0;
+      for (int y = 0; y < 8; y++) {
+        sum += dctBasis.table[y][v] * rows[y * 8 + u];
+      }
+      // Baseline AC coefficients are limited to 10 bits of magnitude
+      long value = lround(sum / quant[v * 8 + u]);
+      block[v * 8 + u] = static_cast<short>(max(-1023L, min(1023L, value)));
+    }
+  }
+}
+
+/**
+ * @brief Inverse-DCTs every component into a plane at its native
+ * subsampling.
+ *
+ * No upsampling and no colour conversion take place: a 4:2:0 file gives a
+ * full-size Y plane and quarter-size Cb/Cr planes. Component 0 (luma, or
+ * gray) gets the usual +128 level shift back; the chroma planes stay
+ * centred on 0, so a zero written outside the source by a warp is neutral
+ * grey rather than a colour cast.
+ *
+ * @param jpeg The decoded coefficients.
+ * @param planes Receives one plane per component.
+ */
+void decodeJpegPlanes(const JpegCoefficients &jpeg,
+                      vector<JpegPlane> &planes) {
+  planes.assign(jpeg.components.size(), JpegPlane());
+  float pixels[64];
+
+  for (size_t c = 0; c < jpeg.components.size(); c++) {
+    const JpegComponent &component = jpeg.components[c];
+    JpegPlane &plane = planes[c];
+    jpegComponentSize(jpeg, component, plane.width, plane.height);
+    plane.offset = c == 0 ? 128.0f : 0.0f;
+    plane.samples.assign(static_cast<size_t>(plane.width) * plane.height, 0);
+    const unsigned short *quant = jpeg.quantTables[component.quantTable];
+
+    for (int by = 0; by < component.blocksHigh; by++) {
+      for (int bx = 0; bx < component.blocksWide; bx++) {
+        inverseDctBlock(component.block(bx, by), quant, pixels);
+        const int rows = min(8, plane.height - by * 8);
+        const int cols = min(8, plane.width - bx * 8);
+        for (int y = 0; y < rows; y++) {
+          float *out = &plane.samples[static_cast<size_t>(by * 8 + y) *
+                                          plane.width +
+                                      bx * 8];
+          for (int x = 0; x < cols; x++) {
+            out[x] = pixels[y * 8 + x] + plane.offset;
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief Forward-DCTs and quantises planes into the blocks of a frame.
+ *
+ * `jpeg` must already describe the output: size, components (sampling
+ * factors and quantisation table indices) and the tables themselves. Each
+ * plane must have its component's size at that frame size. Samples past
+ * the plane's edge, in partial and padding blocks, repeat the last row and
+ * column, which keeps those blocks cheap to code.
+ *
+ * @param planes One plane per component.
+ * @param jpeg The frame whose coefficients are filled in.
+ */
+void encodeJpegPlanes(const vector<JpegPlane> &planes,
+                      JpegCoefficients &jpeg) {
+  layoutComponents(jpeg);
+  float pixels[64];
+
+  for (size_t c = 0; c < jpeg.components.size(); c++) {
+    JpegComponent &component = jpeg.components[c];
+    const JpegPlane &plane = planes[c];
+    const unsigned short *quant = jpeg.quantTables[component.quantTable];
+    component.coefficients.assign(
+        static_cast<size_t>(component.paddedWide) * component.paddedHigh * 64,
+        0);
+
+    for (int by = 0; by < component.paddedHigh; by++) {
+      for (int bx = 0; bx < component.paddedWide; bx++) {
+        for (int y = 0; y < 8; y++) {
+          const int sy = min(by * 8 + y, plane.height - 1);
+          const float *row =
+              &plane.samples[static_cast<size_t>(sy) * plane.width];
+          for (int x = 0; x < 8; x++) {
+            pixels[y * 8 + x] =
+                row[min(bx * 8 + x, plane.width - 1)] - plane.offset;
+          }
+        }
+        forwardDctBlock(pixels, quant, component.block(bx, by));
+      }
+    }
+  }
+}
+
+// Annex K tables, natural order (the ones stb_image_write and libjpeg use)
+static const unsigned char standardLumaQuant[64] = {
+    16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+static const unsigned char standardChromaQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+// Huffman code counts per length (1-16) followed by the symbols
+static const unsigned char standardLumaDcCounts[16] = {0, 1, 5, 1, 1, 1, 1, 1,
+                                                       1, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char standardChromaDcCounts[16] = {
+    0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const unsigned char standardDcSymbols[12] = {0, 1, 2, 3, 4,  5,
+                                                    6, 7, 8, 9, 10, 11};
+static const unsigned char standardLumaAcCounts[16] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const unsigned char standardLumaAcSymbols[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06,
+    0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+    0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72,
+    0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+    0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75,
+    0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3,
+    0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9,
+    0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+static const unsigned char standardChromaAcCounts[16] = {
+    0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const unsigned char standardChromaAcSymbols[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+    0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+    0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1,
+    0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+    0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74,
+    0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a,
+    0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4,
+    0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+/**
+ * @brief Fills an encode table from Annex K counts and symbols.
+ */
+static void loadStandardTable(const unsigned char counts[16],
+                              const unsigned char *symbols,
+                              HuffmanEncodeTable &table) {
+  table.counts[0] = 0;
+  table.symbolCount = 0;
+  for (int i = 0; i < 16; i++) {
+    table.counts[i + 1] = counts[i];
+    table.symbolCount += counts[i];
+  }
+  memcpy(table.symbols, symbols, table.symbolCount);
+  assignHuffmanCodes(table);
+}
+
+// Fixed-point RGB -> YCbCr weights (BT.601 full range, scaled by 2^15)
+static const int YCC_SHIFT = 15;
+static const short Y_R = 9798, Y_G = 19235, Y_B = 3736;
+static const short CB_R = -5529, CB_G = -10855, CB_B = 16384;
+static const short CR_R = 16384, CR_G = -13720, CR_B = -2664;
+
+#ifdef __SSE2__
+/**
+ * @brief Packs two 16-bit weights for `_mm_madd_epi16`; `low` multiplies
+ * the even lanes and `high` the odd ones.
+ */
+static inline __m128i weightPair(int low, int high) {
+  return _mm_set1_epi32(static_cast<int>(
+      (static_cast<unsigned int>(high) << 16) | (low & 0xFFFF)));
+}
+#endif
+
+/**
+ * @brief Converts one row to level-shifted Y, Cb and Cr samples.
+ *
+ * Outputs are centred on 0 (Y - 128, Cb - 128, Cr - 128), which is what the
+ * forward DCT expects. The row is extended to `paddedWidth` by repeating
+ * its last pixel. Gray rows (`channels` 1) only produce Y. On SSE2 targets
+ * eight pixels are converted per step with 16-bit multiply-adds.
+ */
+static void convertRowToYCbCr(const unsigned char *row, int width,
+                              int paddedWidth, int channels, short *y,
+                              short *cb, short *cr) {
+  int x = 0;
+  if (channels == 1) {
+    for (; x < width; x++) {
+      y[x] = static_cast<short>(row[x] - 128);
+    }
+  } else {
+#ifdef __SSE2__
+    // Pairs (R, G) and (B, 128) per pixel; the constant lane carries the
+    // level shift of Y and the rounding of every channel
+    const __m128i yRG = weightPair(Y_R, Y_G);
+    const __m128i yB = weightPair(Y_B, -32768);
+    const __m128i cbRG = weightPair(CB_R, CB_G);
+    const __m128i cbB = weightPair(CB_B, 0);
+    const __m128i crRG = weightPair(CR_R, CR_G);
+    const __m128i crB = weightPair(CR_B, 0);
+    const __m128i rounding = _mm_set1_epi32(1 << (YCC_SHIFT - 1));
+    const __m128i shift = _mm_set1_epi16(128);
+
+    auto combine = [&](__m128i rgLo, __m128i rgHi, __m128i bLo, __m128i bHi,
+                       __m128i weightsRG, __m128i weightsB) {
+      __m128i lo = _mm_add_epi32(_mm_madd_epi16(rgLo, weightsRG),
+                                 _mm_madd_epi16(bLo, weightsB));
+      __m128i hi = _mm_add_epi32(_mm_madd_epi16(rgHi, weightsRG),
+                                 _mm_madd_epi16(bHi, weightsB));
+      lo = _mm_srai_epi32(_mm_add_epi32(lo, rounding), YCC_SHIFT);
+      hi = _mm_srai_epi32(_mm_add_epi32(hi, rounding), YCC_SHIFT);
+      return _mm_packs_epi32(lo, hi);
+    };
+
+    for (; x + 8 <= width; x += 8) {
+      const unsigned char *p = row + x * 3;
+      __m128i r = _mm_setr_epi16(p[0], p[3], p[6], p[9], p[12], p[15], p[18],
+                                 p[21]);
+      __m128i g = _mm_setr_epi16(p[1], p[4], p[7], p[10], p[13], p[16],
+                                 p[19], p[22]);
+      __m128i b = _mm_setr_epi16(p[2], p[5], p[8], p[11], p[14], p[17],
+                                 p[20], p[23]);
+      __m128i rgLo = _mm_unpacklo_epi16(r, g), rgHi = _mm_unpackhi_epi16(r, g);
+      __m128i bLo = _mm_unpacklo_epi16(b, shift);
+      __m128i bHi = _mm_unpackhi_epi16(b, shift);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(y + x),
+                       combine(rgLo, rgHi, bLo, bHi, yRG, yB));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(cb + x),
+                       combine(rgLo, rgHi, bLo, bHi, cbRG, cbB));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(cr + x),
+                       combine(rgLo, rgHi, bLo, bHi, crRG, crB));
+    }
+#endif
+    const int half = 1 << (YCC_SHIFT - 1);
+    for (; x < width; x++) {
+      const int r = row[x * 3], g = row[x * 3 + 1], b = row[x * 3 + 2];
+      y[x] = static_cast<short>(
+          ((Y_R * r + Y_G * g + Y_B * b + half) >> YCC_SHIFT) - 128);
+      cb[x] = static_cast<short>((CB_R * r + CB_G * g + CB_B * b + half) >>
+                                 YCC_SHIFT);
+      cr[x] = static_cast<short>((CR_R * r + CR_G * g + CR_B * b + half) >>
+                                 YCC_SHIFT);
+    }
+  }
+
+  for (; x < paddedWidth; x++) {
+    y[x] = y[width - 1];
+    if (channels != 1) {
+      cb[x] = cb[width - 1];
+      cr[x] = cr[width - 1];
+    }
+  }
+}
+
+/**
+ * @brief Averages 2x2 neighbourhoods of two full-resolution chroma rows.
+ */
+static void downsampleChromaRows(const short *top, const short *bottom,
+                                 int width, short *out) {
+  int x = 0;
+#ifdef __SSE2__
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i two = _mm_set1_epi32(2);
+  for (; x + 8 <= width; x += 8) {
+    __m128i sums[2];
+    for (int half = 0; half < 2; half++) {
+      const int offset = 2 * x + 8 * half;
+      __m128i a = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(top + offset));
+      __m128i b = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(bottom + offset));
+      __m128i pairs =
+          _mm_add_epi32(_mm_madd_epi16(a, ones), _mm_madd_epi16(b, ones));
+      sums[half] = _mm_srai_epi32(_mm_add_epi32(pairs, two), 2);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x),
+                     _mm_packs_epi32(sums[0], sums[1]));
+  }
+#endif
+  for (; x < width; x++) {
+    out[x] = static_cast<short>(
+        (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >>
+        2);
+  }
+}
+
+/**
+ * @brief Quantisation table prepared for the forward DCT.
+ *
+ * The SIMD DCT leaves its results scaled by 2^15 and transposed, so the
+ * reciprocals are stored the same way and quantisation is one multiply.
+ */
+struct QuantReciprocals {
+  const unsigned short *table; // Natural order
+  float transposed[64];        // 1 / (q[v][u] * 2^15), indexed [u][v]
+
+  explicit QuantReciprocals(const unsigned short *quant) : table(quant) {
+    for (int v = 0; v < 8; v++) {
+      for (int u = 0; u < 8; u++) {
+        transposed[u * 8 + v] = 1.0f / (quant[v * 8 + u] * 32768.0f);
+      }
+    }
+  }
+};
+
+#ifdef __SSE2__
+/**
+ * @brief Transposes an 8x8 matrix of 16-bit values held in eight registers.
+ */
+static inline void transpose8x8(__m128i r[8]) {
+  __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+  __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+  __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+  __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+  __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/**
+ * @brief DCT basis in 2^13 fixed point, as (basis[k][i], basis[k][i + 1])
+ * pairs for `_mm_madd_epi16`.
+ */
+static const struct FixedDctPairs {
+  __m128i pairs[8][4];
+  FixedDctPairs() {
+    for (int k = 0; k < 8; k++) {
+      for (int p = 0; p < 4; p++) {
+        int even = static_cast<int>(lround(dctBasis.table[2 * p][k] * 8192));
+        int odd = static_cast<int>(lround(dctBasis.table[2 * p + 1][k] * 8192));
+        pairs[k][p] = weightPair(even, odd);
+      }
+    }
+  }
+} fixedDctPairs;
+
+/**
+ * @brief One 1-D DCT pass down the columns of eight 16-bit rows.
+ *
+ * `lo[k]` and `hi[k]` receive, as 32-bit sums, output row k for columns 0-3
+ * and 4-7. Four multiply-adds per half produce a whole output row.
+ */
+static inline void dctColumns(const __m128i in[8], __m128i lo[8],
+                              __m128i hi[8]) {
+  __m128i pairsLo[4], pairsHi[4];
+  for (int p = 0; p < 4; p++) {
+    pairsLo[p] = _mm_unpacklo_epi16(in[2 * p], in[2 * p + 1]);
+    pairsHi[p] = _mm_unpackhi_epi16(in[2 * p], in[2 * p + 1]);
+  }
+  for (int k = 0; k < 8; k++) {
+    __m128i sumLo = _mm_madd_epi16(pairsLo[0], fixedDctPairs.pairs[k][0]);
+    __m128i sumHi = _mm_madd_epi16(pairsHi[0], fixedDctPairs.pairs[k][0]);
+    for (int p = 1; p < 4; p++) {
+      sumLo = _mm_add_epi32(
+          sumLo, _mm_madd_epi16(pairsLo[p], fixedDctPairs.pairs[k][p]));
+      sumHi = _mm_add_epi32(
+          sumHi, _mm_madd_epi16(pairsHi[p], fixedDctPairs.pairs[k][p]));
+    }
+    lo[k] = sumLo;
+    hi[k] = sumHi;
+  }
+}
+#endif
+
+/**
+ * @brief Forward-DCTs and quantises one 8x8 block of level-shifted samples.
+ *
+ * The SSE2 path is an integer matrix DCT: a column pass with 2^13 weights
+ * (kept with two extra fraction bits), a transpose, a second column pass,
+ * and quantisation by a float reciprocal with round-to-nearest. Other
+ * targets use the float DCT.
+ *
+ * @param samples Top-left sample of the block.
+ * @param stride Samples per row of the strip.
+ * @param quant Quantisation table of the component.
+ * @param block Receives the coefficients, natural order.
+ */
+static void forwardDctQuantize(const short *samples, int stride,
+                               const QuantReciprocals &quant, short *block) {
+#ifdef __SSE2__
+  __m128i rows[8], lo[8], hi[8];
+  for (int y = 0; y < 8; y++) {
+    rows[y] = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(samples + y * stride));
+  }
+
+  // Vertical pass: 13 + 0 fraction bits in, keep 2
+  dctColumns(rows, lo, hi);
+  const __m128i round = _mm_set1_epi32(1 << 10);
+  for (int v = 0; v < 8; v++) {
+    rows[v] = _mm_packs_epi32(
+        _mm_srai_epi32(_mm_add_epi32(lo[v], round), 11),
+        _mm_srai_epi32(_mm_add_epi32(hi[v], round), 11));
+  }
+
+  // Horizontal pass on the transpose: row u holds F[0..7][u] at 2^15 scale
+  transpose8x8(rows);
+  dctColumns(rows, lo, hi);
+  const __m128i limit = _mm_set1_epi16(1023);
+  const __m128i negativeLimit = _mm_set1_epi16(-1023);
+  for (int u = 0; u < 8; u++) {
+    const float *reciprocal = quant.transposed + u * 8;
+    __m128i qLo = _mm_cvtps_epi32(
+        _mm_mul_ps(_mm_cvtepi32_ps(lo[u]), _mm_loadu_ps(reciprocal)));
+    __m128i qHi = _mm_cvtps_epi32(
+        _mm_mul_ps(_mm_cvtepi32_ps(hi[u]), _mm_loadu_ps(reciprocal + 4)));
+    rows[u] = _mm_max_epi16(_mm_min_epi16(_mm_packs_epi32(qLo, qHi), limit),
+                            negativeLimit);
+  }
+  transpose8x8(rows);
+  for (int v = 0; v < 8; v++) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(block + v * 8), rows[v]);
+  }
+#else
+  float pixels[64];
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      pixels[y * 8 + x] = samples[y * stride + x];
+    }
+  }
+  forwardDctBlock(pixels, quant.table, block);
+#endif
+}
+
+/**
+ * @brief Encodes 8-bit gray or RGB pixels as a baseline JPEG.
+ *
+ * Drop-in replacement for `stbi_write_jpg` with the same quality scale,
+ * quantisation tables, Huffman tables and subsampling rule (4:2:0 up to
+ * quality 90, 4:4:4 above), so outputs are interchangeable. The image is
+ * processed one MCU row at a time: rows are converted to YCbCr into a small
+ * strip (SIMD), chroma is averaged down when subsampling, and each block
+ * goes through the integer DCT and straight into the bit writer, whose
+ * bytes are written out after every MCU row. Memory is a few strips of
+ * 16-bit samples, whatever the image height.
+ *
+ * @param path The file to write.
+ * @param width Image width.
+ * @param height Image height.
+ * @param channels 1 (gray) or 3 (RGB).
+ * @param quality 1-100, as in stb_image_write.
+ * @param nextRow Returns row `y` (interleaved 8-bit samples); rows are
+ * asked for once each, top to bottom.
+ * @param error Receives a reason on failure.
+ * @return bool True on success.
+ */
+bool writeJpegRows(const string &path, int width, int height, int channels,
+                   int quality,
+                   const function<const unsigned char *(int)> &nextRow,
+                   string &error) {
+  if (width <= 0 || height <= 0 || width > 65535 ||
+      height > 65535 || (channels != 1 && channels != 3)) {
+    error = "imagen no codificable como JPEG";
+    return false;
+  }
+
+  const bool subsample = channels == 3 && quality <= 90;
+  quality = max(1, min(100, quality));
+  const int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+  JpegCoefficients frame;
+  frame.width = width;
+  frame.height = height;
+  for (int k = 0; k < 64; k++) {
+    frame.quantTables[0][k] = static_cast<unsigned short>(
+        max(1, min(255, (standardLumaQuant[k] * scale + 50) / 100)));
+    frame.quantTables[1][k] = static_cast<unsigned short>(
+        max(1, min(255, (standardChromaQuant[k] * scale + 50) / 100)));
+  }
+  frame.quantTablePresent[0] = true;
+  frame.quantTablePresent[1] = channels == 3;
+  for (int c = 0; c < channels; c++) {
+    JpegComponent component;
+    component.id = c + 1;
+    component.h = component.v = (c == 0 && subsample) ? 2 : 1;
+    component.quantTable = c == 0 ? 0 : 1;
+    frame.components.push_back(component);
+  }
+  layoutComponents(frame);
+  frame.extraSegments.push_back({0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F',
+                                 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00,
+                                 0x01, 0x00, 0x00});
+
+  HuffmanEncodeTable dcTables[2], acTables[2];
+  loadStandardTable(standardLumaDcCounts, standardDcSymbols, dcTables[0]);
+  loadStandardTable(standardLumaAcCounts, standardLumaAcSymbols, acTables[0]);
+  loadStandardTable(standardChromaDcCounts, standardDcSymbols, dcTables[1]);
+  loadStandardTable(standardChromaAcCounts, standardChromaAcSymbols,
+                    acTables[1]);
+
+  ofstream file(path, ios::binary);
+  vector<unsigned char> out;
+  appendFrameHeaders(frame, dcTables, acTables, out);
+
+  const int mcuWidth = 8 * frame.maxH, mcuHeight = 8 * frame.maxV;
+  const int paddedWidth = frame.mcusWide * mcuWidth;
+  const int chromaWidth = paddedWidth / frame.maxH;
+  vector<short> luma(static_cast<size_t>(paddedWidth) * mcuHeight);
+  vector<short> cb, cr, cbSmall, crSmall;
+  if (channels == 3) {
+    cb.resize(luma.size());
+    cr.resize(luma.size());
+    if (subsample) {
+      cbSmall.resize(static_cast<size_t>(chromaWidth) * 8);
+      crSmall.resize(cbSmall.size());
+    }
+  }
+  const QuantReciprocals lumaQuant(frame.quantTables[0]);
+  const QuantReciprocals chromaQuant(frame.quantTables[1]);
+
+  BitWriter writer(out);
+  int predictors[3] = {0, 0, 0};
+  short block[64];
+
+  for (int my = 0; my < frame.mcusHigh; my++) {
+    for (int r = 0; r < mcuHeight; r++) {
+      const size_t offset = static_cast<size_t>(r) * paddedWidth;
+      if (my * mcuHeight + r >= height) {
+        // Padding rows repeat the last image row
+        const size_t previous = offset - paddedWidth;
+        copy_n(&luma[previous], paddedWidth, &luma[offset]);
+        if (channels == 3) {
+          copy_n(&cb[previous], paddedWidth, &cb[offset]);
+          copy_n(&cr[previous], paddedWidth, &cr[offset]);
+        }
+        continue;
+      }
+      const unsigned char *row = nextRow(my * mcuHeight + r);
+      if (!row) {
+        error = "fila de origen no disponible";
+        return false;
+      }
+      convertRowToYCbCr(row, width, paddedWidth, channels, &luma[offset],
+                        channels == 3 ? &cb[offset] : nullptr,
+                        channels == 3 ? &cr[offset] : nullptr);
+    }
+    const short *cbRows = cb.data(), *crRows = cr.data();
+    if (subsample) {
+      for (int r = 0; r < 8; r++) {
+        const size_t top = static_cast<size_t>(2 * r) * paddedWidth;
+        downsampleChromaRows(&cb[top], &cb[top + paddedWidth], chromaWidth,
+                             &cbSmall[static_cast<size_t>(r) * chromaWidth]);
+        downsampleChromaRows(&cr[top], &cr[top + paddedWidth], chromaWidth,
+                             &crSmall[static_cast<size_t>(r) * chromaWidth]);
+      }
+      cbRows = cbSmall.data();
+      crRows = crSmall.data();
+    }
+
+    for (int mx = 0; mx < frame.mcusWide; mx++) {
+      for (int v = 0; v < frame.maxV; v++) {
+        for (int h = 0; h < frame.maxH; h++) {
+          forwardDctQuantize(&luma[static_cast<size_t>(v) * 8 * paddedWidth +
+                                   mx * mcuWidth + h * 8],
+                             paddedWidth, lumaQuant, block);
+          encodeBlock(writer, block, predictors[0], dcTables[0],
+                      acTables[0]);
+        }
+      }
+      if (channels == 3) {
+        forwardDctQuantize(cbRows + mx * 8, chromaWidth, chromaQuant, block);
+        encodeBlock(writer, block, predictors[1], dcTables[1], acTables[1]);
+        forwardDctQuantize(crRows + mx * 8, chromaWidth, chromaQuant, block);
+        encodeBlock(writer, block, predictors[2], dcTables[1], acTables[1]);
+      }
+    }
+    // Whole bytes so far go to the file; the bit writer keeps the rest
+    file.write(reinterpret_cast<const char *>(out.data()), out.size());
+    out.clear();
+  }
+  writer.flush();
+  out.push_back(0xFF);
+  out.push_back(0xD9);
+  file.write(reinterpret_cast<const char *>(out.data()), out.size());
+  if (!file) {
+    error = "no se pudo escribir " + path;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Encodes a whole 8-bit gray or RGB image (see writeJpegRows).
+ */
+bool writeJpegPixels(const string &path, const unsigned char *pixels,
+                     int width, int height, int channels, int quality,
+                     string &error) {
+  if (!pixels) {
+    error = "imagen no codificable como JPEG";
+    return false;
+  }
+  const size_t stride = static_cast<size_t>(width) * channels;
+  return writeJpegRows(path, width, height, channels, quality,
+                       [&](int y) { return pixels + y * stride; }, error);
+}
+
+/**
+ * @brief Checks the frame headers for a non-zero restart interval.
+ *
+ * Only the segments before the first scan are read, so this is cheap
+ * enough to call before choosing a decoder.
+ */
+bool jpegUsesRestartMarkers(const string &path) {
+  ifstream in(path, ios::binary);
+  unsigned char marker[2] = {0, 0};
+  in.read(reinterpret_cast<char *>(marker), 2);
+  if (!in || marker[0] != 0xFF || marker[1] != 0xD8) {
+    return false;
+  }
+  while (in.read(reinterpret_cast<char *>(marker), 2)) {
+    if (marker[0] != 0xFF || marker[1] == 0xDA || marker[1] == 0xD9) {
+      return false;
+    }
+    unsigned char length[2];
+    if (!in.read(reinterpret_cast<char *>(length), 2)) {
+      return false;
+    }
+    const int size = (length[0] << 8) | length[1];
+    if (marker[1] == 0xDD) {
+      unsigned char interval[2];
+      return in.read(reinterpret_cast<char *>(interval), 2) &&
+             ((interval[0] << 8) | interval[1]) != 0;
+    }
+    in.seekg(size - 2, ios::cur);
+  }
+  return false;
+}
+
+/**
+ * @brief Finds the orientation value inside an APP1 Exif segment.
+ *
+ * Follows the TIFF header to the first IFD and looks for tag 0x0112, a
+ * single SHORT stored in the first two bytes of the entry's value field.
+ *
+ * @param segment Whole segment, from the 0xFF marker byte on.
+ * @param size Segment size in bytes.
+ * @param bigEndian Receives the TIFF byte order.
+ * @return size_t Offset of the 16-bit value within the segment, or 0 when
+ * the segment carries no orientation.
+ */
+static size_t exifOrientationOffset(const unsigned char *segment, size_t size,
+                                    bool &bigEndian) {
+  static const unsigned char exif[6] = {'E', 'x', 'i', 'f', 0, 0};
+  const size_t tiff = 10; // Marker, length and "Exif\0\0"
+  if (size < tiff + 8 || segment[1] != 0xE1 ||
+      memcmp(segment + 4, exif, sizeof(exif)) != 0) {
+    return 0;
+  }
+  const unsigned char *header = segment + tiff;
+  if (header[0] == 'M' && header[1] == 'M') {
+    bigEndian = true;
+  } else if (header[0] == 'I' && header[1] == 'I') {
+    bigEndian = false;
+  } else {
+    return 0;
+  }
+  auto read16 = [&](size_t offset) -> unsigned {
+    const unsigned char *p = segment + offset;
+    return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+  };
+  auto read32 = [&](size_t offset) -> size_t {
+    return bigEndian ? (static_cast<size_t>(read16(offset)) << 16) |
+                           read16(offset + 2)
+                     : (static_cast<size_t>(read16(offset + 2)) << 16) |
+                           read16(offset);
+  };
+
+  const size_t ifd = tiff + read32(tiff + 4);
+  if (ifd + 2 > size) {
+    return 0;
+  }
+  const unsigned entries = read16(ifd);
+  for (unsigned e = 0; e < entries; e++) {
+    const size_t entry = ifd + 2 + 12 * static_cast<size_t>(e);
+    if (entry + 12 > size) {
+      return 0;
+    }
+    if (read16(entry) == 0x0112) {
+      return read16(entry + 2) == 3 && read32(entry + 4) == 1 ? entry + 8
+                                                              : 0;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Reads the EXIF orientation (1-8) from a JPEG's header segments.
+ *
+ * Only the segments before the first scan are read. Files without an Exif
+ * segment, or with an out-of-range value, report 1 (as stored).
+ */
+int readJpegOrientation(const string &path) {
+  ifstream in(path, ios::binary);
+  unsigned char marker[2] = {0, 0};
+  in.read(reinterpret_cast<char *>(marker), 2);
+  if (!in || marker[0] != 0xFF || marker[1] != 0xD8) {
+    return 1;
+  }
+  while (in.read(reinterpret_cast<char *>(marker), 2)) {
+    if (marker[0] != 0xFF || marker[1] == 0xDA || marker[1] == 0xD9) {
+      return 1;
+    }
+    unsigned char length[2];
+    if (!in.read(reinterpret_cast<char *>(length), 2)) {
+      return 1;
+    }
+    const int size = (length[0] << 8) | length[1];
+    if (marker[1] != 0xE1 || size < 2) {
+      in.seekg(size - 2, ios::cur);
+      continue;
+    }
+    vector<unsigned char> segment(size + 2);
+    segment[0] = marker[0];
+    segment[1] = marker[1];
+    segment[2] = length[0];
+    segment[3] = length[1];
+    if (!in.read(reinterpret_cast<char *>(&segment[4]), size - 2)) {
+      return 1;
+    }
+    bool bigEndian = false;
+    const size_t offset =
+        exifOrientationOffset(segment.data(), segment.size(), bigEndian);
+    if (offset != 0) {
+      const int value = bigEndian ? (segment[offset] << 8) |
+                                        segment[offset + 1]
+                                  : (segment[offset + 1] << 8) |
+                                        segment[offset];
+      return value >= 1 && value <= 8 ? value : 1;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Rewrites the orientation of a carried Exif segment as 1, for
+ * outputs whose pixels already have the orientation applied.
+ */
+void resetJpegOrientation(JpegCoefficients &jpeg) {
+  for (auto &segment : jpeg.extraSegments) {
+    bool bigEndian = false;
+    const size_t offset =
+        exifOrientationOffset(segment.data(), segment.size(), bigEndian);
+    if (offset != 0) {
+      segment[offset] = bigEndian ? 0 : 1;
+      segment[offset + 1] = bigEndian ? 1 : 0;
+    }
+  }
+}
+
+/**
+ * @brief One 8-point pass of the integer inverse DCT (libjpeg's "islow").
+ *
+ * Loeffler-Ligtenberg-Moschytz factorisation with 13-bit constants: 12
+ * multiplies per pass instead of 64.
+ *
+ * @param in Eight inputs, `step` apart.
+ * @param out Eight outputs, `step` apart, descaled by `shift` bits.
+ */
+static inline void inverseDct8(const int *in, int step, int *out, int shift) {
+  const int bias = 1 << (shift - 1);
+
+  // Even part
+  int z1 = (in[2 * step] + in[6 * step]) * 4433;
+  const int even2 = z1 - in[6 * step] * 15137;
+  const int even3 = z1 + in[2 * step] * 6270;
+  const int even0 = (in[0] + in[4 * step]) * 8192;
+  const int even1 = (in[0] - in[4 * step]) * 8192;
+  const int t10 = even0 + even3, t13 = even0 - even3;
+  const int t11 = even1 + even2, t12 = even1 - even2;
+
+  // Odd part
+  int t0 = in[7 * step], t1 = in[5 * step];
+  int t2 = in[3 * step], t3 = in[1 * step];
+  z1 = t0 + t3;
+  int z2 = t1 + t2, z3 = t0 + t2, z4 = t1 + t3;
+  const int z5 = (z3 + z4) * 9633;
+  t0 *= 2446;
+  t1 *= 16819;
+  t2 *= 25172;
+  t3 *= 12299;
+  z1 *= -7373;
+  z2 *= -20995;
+  z3 = z3 * -16069 + z5;
+  z4 = z4 * -3196 + z5;
+  t0 += z1 + z3;
+  t1 += z2 + z4;
+  t2 += z2 + z3;
+  t3 += z1 + z4;
+
+  out[0] = (t10 + t3 + bias) >> shift;
+  out[7 * step] = (t10 - t3 + bias) >> shift;
+  out[1 * step] = (t11 + t2 + bias) >> shift;
+  out[6 * step] = (t11 - t2 + bias) >> shift;
+  out[2 * step] = (t12 + t1 + bias) >> shift;
+  out[5 * step] = (t12 - t1 + bias) >> shift;
+  out[3 * step] = (t13 + t0 + bias) >> shift;
+  out[4 * step] = (t13 - t0 + bias) >> shift;
+}
+
+/**
+ * @brief Dequantises and inverse-DCTs one block straight to 8-bit samples.
+ *
+ * Fixed-point counterpart of inverseDctBlock for the pixel decoder. Columns
+ * go first, keeping two extra bits; a column whose AC terms are all zero
+ * is just its DC value.
+ *
+ * @param out Top-left sample of the block, rows `stride` apart.
+ */
+static void inverseDctBlockFixed(const short *block,
+                                 const unsigned short *quant,
+                                 unsigned char *out, int stride) {
+  int input[64], columns[64], row[8];
+  for (int i = 0; i < 64; i++) {
+    input[i] = block[i] * quant[i];
+  }
+  for (int x = 0; x < 8; x++) {
+    const int *in = input + x;
+    if ((in[8] | in[16] | in[24] | in[32] | in[40] | in[48] | in[56]) == 0) {
+      for (int y = 0; y < 8; y++) {
+        columns[y * 8 + x] = in[0] * 4;
+      }
+    } else {
+      inverseDct8(in, 8, columns + x, 11);
+    }
+  }
+  for (int y = 0; y < 8; y++) {
+    inverseDct8(columns + y * 8, 1, row, 18);
+    for (int x = 0; x < 8; x++) {
+      out[y * stride + x] =
+          static_cast<unsigned char>(max(0, min(255, row[x] + 128)));
+    }
+  }
+}
+
+/**
+ * @brief Per-column interpolation for upsampling one chroma component.
+ *
+ * Sample centres are aligned as in the JPEG/JFIF convention, so a 2x
+ * factor gives the 3/4-1/4 weights of libjpeg's "fancy" upsampling.
+ */
+struct UpsampleAxis {
+  vector<int> first, second, weight; // Weights in 1/256
+
+  UpsampleAxis(int outSize, int inSize, int factor, int maxFactor) {
+    first.resize(outSize);
+    second.resize(outSize);
+    weight.resize(outSize);
+    for (int i = 0; i < outSize; i++) {
+      float position =
+          (i + 0.5f) * static_cast<float>(factor) / maxFactor - 0.5f;
+      position = max(0.0f, position);
+      const int index = min(static_cast<int>(position), inSize - 1);
+      first[i] = index;
+      second[i] = min(index + 1, inSize - 1);
+      weight[i] = static_cast<int>(lround((position - index) * 256));
+    }
+  }
+};
+
+/**
+ * @brief Whether the pixel decoders can handle the frame's colour space.
+ *
+ * Gray and YCbCr only: an Adobe APP14 segment with transform 0 marks RGB
+ * coded components, and four components mean CMYK.
+ */
+static bool hasSupportedColourSpace(const JpegCoefficients &jpeg) {
+  const size_t count = jpeg.components.size();
+  for (const auto &segment : jpeg.extraSegments) {
+    if (segment.size() > 15 && segment[1] == 0xEE &&
+        memcmp(&segment[4], "Adobe", 5) == 0 && segment[15] == 0) {
+      return false;
+    }
+  }
+  return count == 1 || count == 3;
+}
+
+/**
+ * @brief Inverse-DCTs one row of blocks to 8 rows of 8-bit samples.
+ *
+ * @param blockRow Row of blocks in the component's coefficient storage.
+ * @param out First of the 8 sample rows, `stride` apart.
+ */
+static void inverseDctBlockRow(const JpegCoefficients &jpeg,
+                               const JpegComponent &component, int blockRow,
+                               unsigned char *out, int stride) {
+  const unsigned short *quant = jpeg.quantTables[component.quantTable];
+  for (int bx = 0; bx < component.blocksWide; bx++) {
+    inverseDctBlockFixed(component.block(bx, blockRow), quant, out + bx * 8,
+                         stride);
+  }
+}
+
+/**
+ * @brief Chroma upsampling and YCbCr to RGB conversion of output rows.
+ *
+ * Chroma is blended down the column at its own width first, then across.
+ * Conversions to other channel counts follow stb_image (gray is
+ * replicated, alpha is opaque; an RGB file asked for gray keeps the luma).
+ * Holds scratch rows, so each thread needs its own copy.
+ */
+struct JpegRowConverter {
+  int width, count, channels;
+  bool colour;
+  vector<UpsampleAxis> columns, rows; // Per chroma component
+  vector<int> blended, chroma[2];
+
+  JpegRowConverter(const JpegCoefficients &jpeg, int outChannels)
+      : width(jpeg.width), count(static_cast<int>(jpeg.components.size())),
+        channels(outChannels), colour(count == 3 && outChannels >= 3) {
+    for (int c = 1; c < count; c++) {
+      int planeWidth = 0, planeHeight = 0;
+      jpegComponentSize(jpeg, jpeg.components[c], planeWidth, planeHeight);
+      columns.emplace_back(jpeg.width, planeWidth, jpeg.components[c].h,
+                           jpeg.maxH);
+      rows.emplace_back(jpeg.height, planeHeight, jpeg.components[c].v,
+                        jpeg.maxV);
+    }
+  }
+
+  /**
+   * @brief Converts output row `y`.
+   *
+   * @param planeRow Returns row `r` of component `c` as `planeRow(c, r)`.
+   * @param out Receives `width * channels` samples.
+   */
+  template <typename PlaneRow>
+  void convert(int y, PlaneRow planeRow, unsigned char *out) {
+    const unsigned char *luma = planeRow(0, y);
+    for (int c = 1; colour && c < count; c++) {
+      const UpsampleAxis &across = columns[c - 1];
+      const UpsampleAxis &down = rows[c - 1];
+      const unsigned char *top = planeRow(c, down.first[y]);
+      const unsigned char *bottom = planeRow(c, down.second[y]);
+      const int wy = down.weight[y];
+      // Columns are monotonic, so the last one bounds the samples read
+      const int used = width > 0 ? across.second[width - 1] + 1 : 0;
+      blended.resize(used);
+      for (int x = 0; x < used; x++) {
+        blended[x] = top[x] * (256 - wy) + bottom[x] * wy;
+      }
+      chroma[c - 1].resize(width);
+      int *upsampled = chroma[c - 1].data();
+      for (int x = 0; x < width; x++) {
+        const int wx = across.weight[x];
+        upsampled[x] = ((blended[across.first[x]] * (256 - wx) +
+                         blended[across.second[x]] * wx + 32768) >>
+                        16) -
+                       128;
+      }
+    }
+
+    if (colour) {
+      const int *cbRow = chroma[0].data(), *crRow = chroma[1].data();
+      for (int x = 0; x < width; x++, out += channels) {
+        // JFIF YCbCr to RGB in 16.16 fixed point
+        const int cb = cbRow[x], cr = crRow[x];
+        const int fixed = (luma[x] << 16) + 32768;
+        const int r = (fixed + 91881 * cr) >> 16;
+        const int g = (fixed - 22554 * cb - 46802 * cr) >> 16;
+        const int b = (fixed + 116130 * cb) >> 16;
+        out[0] = static_cast<unsigned char>(max(0, min(255, r)));
+        out[1] = static_cast<unsigned char>(max(0, min(255, g)));
+        out[2] = static_cast<unsigned char>(max(0, min(255, b)));
+        if (channels == 4) {
+          out[3] = 255;
+        }
+      }
+    } else {
+      for (int x = 0; x < width; x++, out += channels) {
+        for (int c = 0; c < min(channels, 3); c++) {
+          out[c] = luma[x];
+        }
+        if (channels == 2 || channels == 4) {
+          out[channels - 1] = 255;
+        }
+      }
+    }
+  }
+};
+
+/**
+ * @brief Decodes a baseline JPEG to 8-bit pixels using several threads.
+ *
+ * The entropy decode is split at restart markers (see decodeScan), the
+ * inverse DCT is split by block rows of each component and the chroma
+ * upsampling plus YCbCr to RGB conversion by output rows. Gray and YCbCr
+ * files only; Adobe RGB-coded and CMYK files are refused so the caller can
+ * use stb_image instead.
+ *
+ * @param path The JPEG file.
+ * @param desiredChannels Channel count to decode to, or 0 for the file's.
+ * @param threads Worker threads.
+ * @param pixels Receives a malloc'ed buffer, freed like stbi_load's.
+ * @param width Receives the image width.
+ * @param height Receives the image height.
+ * @param fileChannels Receives the file's channel count.
+ * @param error Receives a reason when the file cannot be used.
+ * @return bool True on success.
+ */
+bool decodeJpegPixels(const string &path, int desiredChannels, int threads,
+                      unsigned char *&pixels, int &width, int &height,
+                      int &fileChannels, string &error) {
+  JpegCoefficients jpeg;
+  if (!readJpegCoefficients(path, jpeg, error, threads)) {
+    return false;
+  }
+  if (!hasSupportedColourSpace(jpeg)) {
+    error = "espacio de color no soportado";
+    return false;
+  }
+  const int count = static_cast<int>(jpeg.components.size());
+
+  // Inverse DCT of every component into 8-bit planes of whole blocks
+  vector<vector<unsigned char>> planes(count);
+  vector<int> strides(count);
+  for (int c = 0; c < count; c++) {
+    const JpegComponent &component = jpeg.components[c];
+    strides[c] = component.blocksWide * 8;
+    planes[c].resize(static_cast<size_t>(strides[c]) * component.blocksHigh *
+                     8);
+    unsigned char *plane = planes[c].data();
+    const int stride = strides[c];
+    parallelFor(component.blocksHigh, threads, [&](int first, int last) {
+      for (int by = first; by < last; by++) {
+        inverseDctBlockRow(jpeg, component, by,
+                           plane + static_cast<size_t>(by) * 8 * stride,
+                           stride);
+      }
+    });
+  }
+
+  width = jpeg.width;
+  height = jpeg.height;
+  fileChannels = count;
+  const int channels = desiredChannels != 0 ? desiredChannels : count;
+  pixels = static_cast<unsigned char *>(
+      malloc(static_cast<size_t>(width) * height * channels));
+  if (!pixels) {
+    error = "memoria insuficiente";
+    return false;
+  }
+
+  const JpegRowConverter converter(jpeg, channels);
+  auto planeRow = [&](int c, int row) {
+    return &planes[c][static_cast<size_t>(row) * strides[c]];
+  };
+  unsigned char *const output = pixels;
+  parallelFor(height, threads, [&](int first, int last) {
+    JpegRowConverter rowConverter = converter;
+    for (int y = first; y < last; y++) {
+      rowConverter.convert(
+          y, planeRow, output + static_cast<size_t>(y) * width * channels);
+    }
+  });
+  return true;
+}
+
+/**
+ * @brief Frame of the image the DC coefficients hold: one sample per block,
+ * so 1/8 of the size (rounded up) with the same sampling factors.
+ */
+static JpegCoefficients dcFrame(const JpegCoefficients &jpeg) {
+  JpegCoefficients frame;
+  frame.width = (jpeg.width + 7) / 8;
+  frame.height = (jpeg.height + 7) / 8;
+  frame.maxH = jpeg.maxH;
+  frame.maxV = jpeg.maxV;
+  for (const auto &component : jpeg.components) {
+    JpegComponent described;
+    described.h = component.h;
+    described.v = component.v;
+    frame.components.push_back(described);
+  }
+  return frame;
+}
+
+/**
+ * @brief Mean sample of a block, from its quantised DC coefficient.
+ */
+static unsigned char dcSample(const JpegCoefficients &jpeg,
+                              const JpegComponent &component, short dc) {
+  const long mean =
+      lround(dc * jpeg.quantTables[component.quantTable][0] / 8.0) + 128;
+  return static_cast<unsigned char>(max(0L, min(255L, mean)));
+}
+
+/**
+ * @brief Upsamples and colour-converts DC planes (one sample per block,
+ * `blocksWide` per row) like the rows of a full decode.
+ */
+static void convertDcPlanes(const JpegCoefficients &jpeg,
+                            const vector<vector<unsigned char>> &planes,
+                            int channels, vector<unsigned char> &pixels,
+                            int &width, int &height) {
+  const JpegCoefficients frame = dcFrame(jpeg);
+  width = frame.width;
+  height = frame.height;
+  pixels.resize(static_cast<size_t>(width) * height * channels);
+  JpegRowConverter converter(frame, channels);
+  for (int y = 0; y < height; y++) {
+    converter.convert(
+        y,
+        [&](int c, int row) {
+          return &planes[c][static_cast<size_t>(row) *
+                            jpeg.components[c].blocksWide];
+        },
+        &pixels[static_cast<size_t>(y) * width * channels]);
+  }
+}
+
+/**
+ * @brief Builds the image the DC coefficients of a decoded JPEG hold, at
+ * 1/8 of its size, without any inverse DCT.
+ *
+ * @param jpeg Coefficients from readJpegCoefficients.
+ * @param desiredChannels Channel count to convert to, or 0 for the file's.
+ * @param pixels Receives the 8-bit pixels.
+ * @param width Receives the width, the frame's divided by 8 and rounded up.
+ * @param height Receives the height, likewise.
+ * @param channels Receives the channel count.
+ * @return bool False for colour spaces other than gray and YCbCr.
+ */
+bool decodeJpegDcImage(const JpegCoefficients &jpeg, int desiredChannels,
+                       vector<unsigned char> &pixels, int &width,
+                       int &height, int &channels) {
+  if (!hasSupportedColourSpace(jpeg) || desiredChannels < 0 ||
+      desiredChannels > 4) {
+    return false;
+  }
+  vector<vector<unsigned char>> planes;
+  for (const auto &component : jpeg.components) {
+    planes.emplace_back(static_cast<size_t>(component.blocksWide) *
+                        component.blocksHigh);
+    unsigned char *plane = planes.back().data();
+    for (int by = 0; by < component.blocksHigh; by++) {
+      for (int bx = 0; bx < component.blocksWide; bx++) {
+        *plane++ = dcSample(jpeg, component, component.block(bx, by)[0]);
+      }
+    }
+  }
+  channels = desiredChannels != 0 ? desiredChannels
+                                  : static_cast<int>(planes.size());
+  convertDcPlanes(jpeg, planes, channels, pixels, width, height);
+  return true;
+}
+
+/**
+ * @brief Decoder state of a JpegRowReader.
+ *
+ * The components' coefficient storage holds a single MCU row. Each
+ * component's samples live in a ring of three MCU rows: the row being
+ * converted, the one above (chroma upsampling reaches one sample back) and
+ * the one below (and one sample forward).
+ */
+struct JpegRowReader::State {
+  vector<unsigned char> file;
+  JpegCoefficients jpeg;
+  HuffmanDecodeTable dcTables[4], acTables[4];
+  vector<int> scanComponents;
+  vector<const HuffmanDecodeTable *> dc, ac;
+  size_t scanStart = 0;
+  BitReader reader{nullptr, 0, 0};
+  vector<int> predictors;
+  int mcuRowsDone = 0;
+  vector<vector<unsigned char>> rings;
+  vector<int> strides, ringRows, rowsDone;
+  unique_ptr<JpegRowConverter> converter;
+  int channels = 0, nextRow = 0;
+  vector<unsigned char> row;
+
+  // Entropy-decodes the next MCU row into the coefficient storage
+  bool decodeMcuCoefficients() {
+    // decodeBlock only writes the coefficients that are coded
+    for (auto &component : jpeg.components) {
+      fill(component.coefficients.begin(), component.coefficients.end(), 0);
+    }
+    ScanDecoder decoder = {file, jpeg, scanComponents, dc, ac, mcuRowsDone};
+    const long first = static_cast<long>(mcuRowsDone) * jpeg.mcusWide;
+    for (long mcu = first; mcu < first + jpeg.mcusWide; mcu++) {
+      if (jpeg.restartInterval > 0 && mcu > 0 &&
+          mcu % jpeg.restartInterval == 0) {
+        reader.restart();
+        fill(predictors.begin(), predictors.end(), 0);
+      }
+      if (!decoder.decodeMcu(reader, predictors, mcu)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Entropy-decodes and inverse-DCTs the next MCU row into the rings
+  bool decodeMcuRow() {
+    if (!decodeMcuCoefficients()) {
+      return false;
+    }
+    for (size_t c = 0; c < jpeg.components.size(); c++) {
+      const JpegComponent &component = jpeg.components[c];
+      const int blockRows = jpeg.components.size() == 1 ? 1 : component.v;
+      for (int v = 0; v < blockRows; v++) {
+        const int blockRow = mcuRowsDone * blockRows + v;
+        if (blockRow >= component.blocksHigh) {
+          break;
+        }
+        const int ringRow = (blockRow * 8) % ringRows[c];
+        inverseDctBlockRow(jpeg, component, v,
+                           &rings[c][static_cast<size_t>(ringRow) * strides[c]],
+                           strides[c]);
+        rowsDone[c] = blockRow * 8 + 8;
+      }
+    }
+    mcuRowsDone++;
+    return true;
+  }
+};
+
+JpegRowReader::JpegRowReader() {}
+
+JpegRowReader::~JpegRowReader() {}
+
+/**
+ * @brief Parses the headers and prepares to decode rows.
+ *
+ * Needs a single interleaved scan (or a gray file) in a gray or YCbCr
+ * colour space; other files return false so the caller can decode them
+ * whole. The compressed file is held in memory; decoded samples are not.
+ *
+ * @param path The JPEG file.
+ * @param desiredChannels Channel count to decode to, or 0 for the file's.
+ * @param error Receives a reason when the file cannot be streamed.
+ * @return bool True on success.
+ */
+bool JpegRowReader::open(const string &path, int desiredChannels,
+                         string &error) {
+  state.reset(new State());
+  State &st = *state;
+  ifstream in(path, ios::binary);
+  st.file.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+
+  bool scanFound = false;
+  const bool parsed = parseJpeg(
+      st.file, st.jpeg, false, error,
+      [&](size_t start, const vector<int> &scanComponents,
+          const vector<const HuffmanDecodeTable *> &dc,
+          const vector<const HuffmanDecodeTable *> &ac) {
+        st.scanStart = start;
+        st.scanComponents = scanComponents;
+        for (size_t s = 0; s < scanComponents.size(); s++) {
+          st.dcTables[s] = *dc[s];
+          st.acTables[s] = *ac[s];
+          st.dc.push_back(&st.dcTables[s]);
+          st.ac.push_back(&st.acTables[s]);
+        }
+        scanFound = true;
+        return st.file.size();
+      });
+  if (!parsed || !scanFound) {
+    state.reset();
+    return false;
+  }
+  JpegCoefficients &jpeg = st.jpeg;
+  if (st.scanComponents.size() != jpeg.components.size() ||
+      !hasSupportedColourSpace(jpeg) || desiredChannels < 0 ||
+      desiredChannels > 4) {
+    error = jpeg.components.size() > 1 &&
+                    st.scanComponents.size() != jpeg.components.size()
+                ? "escaneos no entrelazados"
+                : "espacio de color no soportado";
+    state.reset();
+    return false;
+  }
+
+  const size_t count = jpeg.components.size();
+  st.rings.resize(count);
+  st.strides.resize(count);
+  st.ringRows.resize(count);
+  st.rowsDone.assign(count, 0);
+  for (size_t c = 0; c < count; c++) {
+    JpegComponent &component = jpeg.components[c];
+    const int blockRows = count == 1 ? 1 : component.v;
+    component.coefficients.assign(
+        static_cast<size_t>(component.paddedWide) * blockRows * 64, 0);
+    st.strides[c] = component.blocksWide * 8;
+    st.ringRows[c] = 3 * 8 * blockRows;
+    st.rings[c].resize(static_cast<size_t>(st.strides[c]) * st.ringRows[c]);
+  }
+  st.reader = BitReader(st.file.data(), st.file.size(), st.scanStart);
+  st.predictors.assign(count, 0);
+  st.channels = desiredChannels != 0 ? desiredChannels
+                                     : static_cast<int>(count);
+  st.converter.reset(new JpegRowConverter(jpeg, st.channels));
+  st.row.resize(static_cast<size_t>(jpeg.width) * st.channels);
+  return true;
+}
+
+/**
+ * @brief Decodes the rest of the scan keeping only each block's DC
+ * coefficient, into the image they hold at 1/8 of the size (see
+ * decodeJpegDcImage). Entropy decoding only: no inverse DCT, and the
+ * memory is one sample per block. The reader has no rows left after it.
+ *
+ * @return bool False on corrupt data or when rows were already read.
+ */
+bool JpegRowReader::readDcImage(vector<unsigned char> &pixels, int &width,
+                                int &height) {
+  if (!state || state->mcuRowsDone > 0) {
+    return false;
+  }
+  State &st = *state;
+  const JpegCoefficients &jpeg = st.jpeg;
+  const size_t count = jpeg.components.size();
+  vector<vector<unsigned char>> planes(count);
+  for (size_t c = 0; c < count; c++) {
+    planes[c].resize(static_cast<size_t>(jpeg.components[c].blocksWide) *
+                     jpeg.components[c].blocksHigh);
+  }
+  for (; st.mcuRowsDone < jpeg.mcusHigh; st.mcuRowsDone++) {
+    if (!st.decodeMcuCoefficients()) {
+      state.reset();
+      return false;
+    }
+    for (size_t c = 0; c < count; c++) {
+      const JpegComponent &component = jpeg.components[c];
+      const int blockRows = count == 1 ? 1 : component.v;
+      for (int v = 0; v < blockRows; v++) {
+        const int blockRow = st.mcuRowsDone * blockRows + v;
+        if (blockRow >= component.blocksHigh) {
+          break;
+        }
+        unsigned char *plane =
+            &planes[c][static_cast<size_t>(blockRow) * component.blocksWide];
+        for (int bx = 0; bx < component.blocksWide; bx++) {
+          plane[bx] = dcSample(jpeg, component, component.block(bx, v)[0]);
+        }
+      }
+    }
+  }
+  convertDcPlanes(jpeg, planes, st.channels, pixels, width, height);
+  st.nextRow = jpeg.height;
+  return true;
+}
+
+int JpegRowReader::width() const { return state ? state->jpeg.width : 0; }
+
+int JpegRowReader::height() const { return state ? state->jpeg.height : 0; }
+
+int JpegRowReader::channels() const { return state ? state->channels : 0; }
+
+int JpegRowReader::fileChannels() const {
+  return state ? static_cast<int>(state->jpeg.components.size()) : 0;
+}
+
+/**
+ * @brief Decodes the next pixel row.
+ *
+ * MCU rows are decoded until every sample the row's chroma upsampling
+ * reads is available.
+ *
+ * @return const unsigned char* The row, valid until the next call, or
+ * nullptr past the last row or on corrupt data.
+ */
+const unsigned char *JpegRowReader::readRow() {
+  if (!state || state->nextRow >= state->jpeg.height) {
+    return nullptr;
+  }
+  State &st = *state;
+  const int y = st.nextRow;
+  for (size_t c = 0; c < st.jpeg.components.size(); c++) {
+    const int needed = c == 0 ? y : st.converter->rows[c - 1].second[y];
+    while (st.rowsDone[c] <= needed) {
+      if (st.mcuRowsDone >= st.jpeg.mcusHigh || !st.decodeMcuRow()) {
+        state.reset();
+        return nullptr;
+      }
+    }
+  }
+  st.converter->convert(
+      y,
+      [&st](int c, int row) {
+        return &st.rings[c][static_cast<size_t>(row % st.ringRows[c]) *
+                            st.strides[c]];
+      },
+      st.row.data());
+  st.nextRow++;
+  return st.row.data();
+}
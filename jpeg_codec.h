@@ -0,0 +1,160 @@
+#ifndef JPEG_CODEC_H
+#define JPEG_CODEC_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One colour component of a baseline JPEG, kept as quantised DCT blocks.
+struct JpegComponent {
+  int id = 0;         // Component identifier from the frame header
+  int h = 1, v = 1;   // Sampling factors
+  int quantTable = 0; // Index of the quantisation table
+  int blocksWide = 0; // Blocks covering the component's samples
+  int blocksHigh = 0;
+  int paddedWide = 0; // Blocks stored per row (whole MCUs)
+  int paddedHigh = 0;
+  std::vector<short> coefficients; // 64 per block, natural (row-major) order
+
+  short *block(int bx, int by) {
+    return &coefficients[(static_cast<size_t>(by) * paddedWide + bx) * 64];
+  }
+  const short *block(int bx, int by) const {
+    return &coefficients[(static_cast<size_t>(by) * paddedWide + bx) * 64];
+  }
+};
+
+// A whole baseline JPEG in the DCT domain, plus the segments to carry over.
+struct JpegCoefficients {
+  int width = 0, height = 0;
+  int maxH = 1, maxV = 1;
+  int mcusWide = 0, mcusHigh = 0;
+  int restartInterval = 0;                // MCUs between restart markers
+  unsigned short quantTables[4][64] = {}; // Natural order
+  bool quantTablePresent[4] = {};
+  std::vector<JpegComponent> components;
+  std::vector<std::vector<unsigned char>> extraSegments; // APPn/COM, verbatim
+};
+
+// One decoded component at its own (possibly subsampled) resolution.
+struct JpegPlane {
+  int width = 0, height = 0; // Samples covering the image
+  float offset = 0;          // Added after the IDCT, removed before the FDCT
+  std::vector<float> samples; // Row-major, width * height
+};
+
+// Right-angle rotations and flips that are exact in the DCT domain.
+enum JpegTransform {
+  JPEG_NONE,
+  JPEG_FLIP_H,     // Mirror left-right
+  JPEG_FLIP_V,     // Mirror top-bottom
+  JPEG_TRANSPOSE,  // Mirror across the main diagonal
+  JPEG_TRANSVERSE, // Mirror across the anti-diagonal
+  JPEG_ROT_90,     // Clockwise
+  JPEG_ROT_180,
+  JPEG_ROT_270,
+};
+
+// Returns true if the file starts with a JPEG SOI marker.
+bool isJpegFile(const std::string &path);
+
+// Entropy-decodes a baseline (sequential Huffman) JPEG into DCT blocks.
+// Scans with restart markers are split across `threads` threads.
+bool readJpegCoefficients(const std::string &path, JpegCoefficients &jpeg,
+                          std::string &error, int threads = 1);
+
+// Fewest threads with which Image::image uses decodeJpegPixels rather than
+// stb_image.
+const int MIN_DECODE_THREADS = 3;
+
+// Whether the file's frame headers set a non-zero restart interval.
+bool jpegUsesRestartMarkers(const std::string &path);
+
+// EXIF orientation of the file (1-8), 1 when it has none.
+int readJpegOrientation(const std::string &path);
+
+// Sets the orientation tag of the carried Exif segment, if any, to 1.
+void resetJpegOrientation(JpegCoefficients &jpeg);
+
+// Decodes a gray or YCbCr baseline JPEG to 8-bit pixels on several threads.
+// `pixels` is malloc'ed, like stbi_load's result.
+bool decodeJpegPixels(const std::string &path, int desiredChannels,
+                      int threads, unsigned char *&pixels, int &width,
+                      int &height, int &fileChannels, std::string &error);
+
+// Entropy-codes DCT blocks into an in-memory baseline JPEG.
+void encodeJpegCoefficients(const JpegCoefficients &jpeg,
+                            std::vector<unsigned char> &out);
+
+// Entropy-codes DCT blocks into a baseline JPEG with optimised Huffman tables.
+bool writeJpegCoefficients(const std::string &path,
+                           const JpegCoefficients &jpeg, std::string &error);
+
+// Encodes 8-bit gray or RGB rows pulled from `nextRow(y)`, top to bottom,
+// writing each MCU row out as soon as it is coded.
+bool writeJpegRows(const std::string &path, int width, int height,
+                   int channels, int quality,
+                   const std::function<const unsigned char *(int)> &nextRow,
+                   std::string &error);
+
+// Encodes 8-bit gray or RGB pixels; same tables and rules as stbi_write_jpg.
+bool writeJpegPixels(const std::string &path, const unsigned char *pixels,
+                     int width, int height, int channels, int quality,
+                     std::string &error);
+
+// Whether the transform keeps every block whole (no partial edge MCUs move).
+bool isLosslessTransformPossible(const JpegCoefficients &jpeg,
+                                 JpegTransform transform);
+
+// Rearranges the DCT blocks (and quantisation tables) for the transform.
+void transformJpegCoefficients(JpegCoefficients &jpeg,
+                               JpegTransform transform);
+
+// Keeps the blocks of a region whose origin is a multiple of the MCU size.
+void cropJpegCoefficients(JpegCoefficients &jpeg, int x, int y, int cropWidth,
+                          int cropHeight);
+
+// Inverse-DCTs every component into a plane at its native subsampling.
+void decodeJpegPlanes(const JpegCoefficients &jpeg,
+                      std::vector<JpegPlane> &planes);
+
+// Forward-DCTs and quantises planes into the blocks of a prepared frame.
+void encodeJpegPlanes(const std::vector<JpegPlane> &planes,
+                      JpegCoefficients &jpeg);
+
+// The image held by the blocks' DC coefficients, 1/8 of the frame size
+// rounded up, as 8-bit pixels. Gray and YCbCr files only.
+bool decodeJpegDcImage(const JpegCoefficients &jpeg, int desiredChannels,
+                       std::vector<unsigned char> &pixels, int &width,
+                       int &height, int &channels);
+
+// Samples per row and rows of a component at the frame size.
+void jpegComponentSize(const JpegCoefficients &jpeg,
+                       const JpegComponent &component, int &width,
+                       int &height);
+
+// Decodes a gray or YCbCr baseline JPEG one 8-bit pixel row at a time,
+// holding three MCU rows of samples instead of the whole image.
+class JpegRowReader {
+public:
+  JpegRowReader();
+  ~JpegRowReader();
+
+  bool open(const std::string &path, int desiredChannels, std::string &error);
+  const unsigned char *readRow(); // Next row, nullptr at the end or on error
+  // Instead of the rows: the 1/8 image of the DC coefficients
+  bool readDcImage(std::vector<unsigned char> &pixels, int &width,
+                   int &height);
+
+  int width() const;
+  int height() const;
+  int channels() const;
+  int fileChannels() const;
+
+private:
+  struct State;
+  std::unique_ptr<State> state;
+};
+
+#endif // JPEG_CODEC_H
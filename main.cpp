@@ -1,10 +1,18 @@
+#include "batch.h"
 #include "buddy_memory.h"
-#include "image.h"
+#include "cost_model.h"
+#include "job.h"
+#include "metrics.h"
+#include "tuning.h"
+#include <chrono>
 #include <cstdlib> // For std::stoi() and std::system()
-#include <cstring> // For strcmp
+#include <iomanip>
 #include <iostream>
 #include <locale>
+#include <memory>
 #include <sstream> // For std::ostringstream
+#include <string>
+#include <sys/resource.h>
 #include <vector>
 
 extern BuddyMemoryManager *buddyManager;
@@ -24,45 +32,200 @@ extern BuddyMemoryManager *buddyManager;
  *        - "-entrada <path>": Specifies the input image file path.
  *        - "-salida <path>": Specifies the output image file path.
  *        - "-buddy": Enables the buddy system for processing.
+ *        - "-canales <n>": Decodes to n channels (1 gray, 2 gray+alpha,
+ *          3 RGB, 4 RGBA) instead of the file's own layout.
+ *        - "-profundidad <8|16|float|auto>": Sample depth used for decoding
+ *          and processing; "auto" keeps the file's native depth.
+ *        - "-interpolacion <vecino|bilineal>": Resampling filter.
+ *        - "-lineal": Blends 8-bit sRGB samples in linear light.
+ *        - "-lienzo <expandir|original|interior>": Output canvas policy.
+ *        - "-teselas <n>": Warps from a tiled copy of the source with n x n
+ *          pixel tiles.
+ *        - "-voltear <h|v>": Mirrors the source horizontally or vertically
+ *          before rotating.
+ *        - "-recortar <x,y,ancho,alto>": Keeps only that source region
+ *          before rotating and scaling.
+ *        - "-ycbcr": Warps JPEGs as native Y/Cb/Cr planes and encodes them
+ *          directly, without RGB conversion.
+ *        - "-recodificar": Always decodes to pixels, even for JPEG right
+ *          angles and flips that could be done without loss.
+ *        - "-hilos <n>": Threads for decoding JPEGs with restart markers
+ *          (0, the default, uses every core).
+ *        - "-flujo": Scales JPEG to JPEG row by row, without holding the
+ *          whole image in memory.
+ *        - "-rgbx": Warps 8-bit RGB images as padded 4-byte pixels.
+ *        - "-escalera <a,b,...>": Writes one thumbnail per size (longest
+ *          side), each downscaled from the next larger one, instead of a
+ *          single transform.
+ *        - "-ignorar-exif": Keeps the stored pixel orientation instead of
+ *          applying the JPEG's EXIF orientation tag.
+ *        - "-vista-previa <archivo>": Writes a fast nearest-neighbour
+ *          preview of the transform as soon as the source is decoded,
+ *          before the full-quality output.
+ *        - "-lado-previa <n>": Longest side of the preview (256 by
+ *          default).
+ *        - "-lote <manifiesto>": Runs the manifest's jobs (one per line,
+ *          with the flags above) as a worker of a shared queue, instead of
+ *          a single transform.
+ *        - "-cola <dir>": Queue directory shared by the batch workers
+ *          ("<manifiesto>.cola" by default).
+ *        - "-nodo <id>": Worker name in the queue ("<host>-<pid>" by
+ *          default).
+ *        - "-concesion <s>": Seconds after which the claim of a worker that
+ *          stopped renewing it is taken over (300 by default).
+ *        - "-estado": Prints the progress of the batch and its nodes.
+ *        - "-metricas <archivo>": Exports counters and stage latency
+ *          histograms to the file (Prometheus text, or JSON for ".json").
+ *        - "-intervalo-metricas <s>": Seconds between exports (10 by
+ *          default).
+ *        - "-estimar": Predicts the job's time and peak memory with the
+ *          cost model, then reports the prediction error once it has run.
+ *        - "-modelo <archivo>": Cost model written by
+ *          "./Benchmark -calibrar" ("modelo_coste.txt" by default).
+ *        - "-perfil <archivo>": Tuning profile written by
+ *          "./Benchmark -autoajuste" ("perfil_ajuste.txt" by default); its
+ *          entry for this CPU sets the decode threads and warp kernel of
+ *          jobs without "-hilos", "-teselas" or "-rgbx".
+ *        - "-sin-perfil": Ignores the tuning profile.
  *
- * @return int Returns 0 upon successful execution.
+ * @return int Returns 0 upon successful execution, 1 when the job fails.
  */
 int main(int argc, char *argv[]) {
 
-  Image img;
-  int angle = 0;
-  float scaleFactor = 1.0f;
-  bool buddySystem = false;
-  std::string inputPath = "./test/fish.jpg";
-  std::string outputPath = "./output/output.jpg";
+  JobRequest job;
+  BatchConfig batch;
+  bool batchStatus = false;
+  std::string metricsPath;
+  int metricsInterval = 10;
+  bool estimate = false;
+  std::string modelPath = "modelo_coste.txt";
+  std::string profilePath = "perfil_ajuste.txt";
+  bool useProfile = true;
 
-  for (int i = 1; i < argc; ++i) {
-    if (strcmp(argv[i], "-angulo") == 0 && i + 1 < argc) {
-      angle = std::stoi(argv[i + 1]);
-    } else if (strcmp(argv[i], "-escalar") == 0 && i + 1 < argc) {
-      scaleFactor = std::stof(argv[i + 1]);
-    } else if (strcmp(argv[i], "-entrada") == 0 && i + 1 < argc) {
-      inputPath = argv[i + 1];
-    } else if (strcmp(argv[i], "-salida") == 0 && i + 1 < argc) {
-      outputPath = argv[i + 1];
-    } else if (strcmp(argv[i], "-buddy") == 0) {
-      buddySystem = true;
+  std::vector<std::string> args(argv + 1, argv + argc);
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (parseJobFlag(args, i, job)) {
+      continue;
+    }
+    if (args[i] == "-estado") {
+      batchStatus = true;
+    } else if (args[i] == "-estimar") {
+      estimate = true;
+    } else if (args[i] == "-sin-perfil") {
+      useProfile = false;
+    } else if (i + 1 < args.size()) {
+      if (args[i] == "-lote") {
+        batch.manifestPath = args[++i];
+      } else if (args[i] == "-cola") {
+        batch.queueDir = args[++i];
+      } else if (args[i] == "-nodo") {
+        batch.nodeId = args[++i];
+      } else if (args[i] == "-concesion") {
+        batch.leaseSeconds = std::stoi(args[++i]);
+      } else if (args[i] == "-metricas") {
+        metricsPath = args[++i];
+      } else if (args[i] == "-intervalo-metricas") {
+        metricsInterval = std::stoi(args[++i]);
+      } else if (args[i] == "-modelo") {
+        modelPath = args[++i];
+      } else if (args[i] == "-perfil") {
+        profilePath = args[++i];
+      }
+    }
+  }
+
+  // Threads and kernels tuned for this CPU by ./Benchmark -autoajuste
+  TuningProfile profile;
+  if (useProfile && loadTuningProfile(profilePath, profile)) {
+    setTuningProfile(profile);
+    std::cout << "[INFO] Perfil de ajuste: "
+              << (profile.threads > 0
+                      ? std::to_string(profile.threads) + " hilos"
+                      : std::string("hilos sin ajustar"))
+              << ", vecino " << formatKernelChoice(profile.nearest)
+              << ", bilineal " << formatKernelChoice(profile.bilinear)
+              << "\n";
+  }
+
+  // Exported in the background while the work runs, and once at the end
+  std::unique_ptr<MetricsExporter> metrics;
+  if (!metricsPath.empty()) {
+    metrics.reset(new MetricsExporter(metricsPath, metricsInterval));
+  }
+
+  // Batch mode: the jobs come from the manifest
+  if (!batch.manifestPath.empty() || batchStatus) {
+    int failed = 0;
+    if (batchStatus) {
+      printBatchStatus(batch);
+    } else {
+      failed = runBatchWorker(batch);
+    }
+    metrics.reset();
+    if (buddyManager != nullptr) {
+      delete buddyManager;
+      buddyManager = nullptr;
+    }
+    return failed == 0 ? 0 : 1;
+  }
+
+  // Cost model: the prediction comes from the header, before decoding
+  CostModel model;
+  CostQuery query;
+  CostEstimate predicted;
+  bool estimated = false;
+  if (estimate) {
+    if (!model.load(modelPath)) {
+      std::cout << "[INFO] Sin modelo de coste en " << modelPath
+                << ", se usan los coeficientes por defecto\n";
+    }
+    if (!job.ladder.empty()) {
+      std::cout << "[INFO] El modelo de coste no cubre las escaleras\n";
+    } else if (readCostQuery(job.inputPath, job.outputPath, job.angle,
+                             job.scaleFactor, job.options, query)) {
+      predicted = model.predict(query);
+      estimated = true;
+      std::cout << std::fixed << std::setprecision(1)
+                << "[INFO] Estimación: " << predicted.milliseconds
+                << " ms, " << predicted.peakMB << " MB de pico, salida "
+                << predicted.outputWidth << "x" << predicted.outputHeight
+                << (query.lossless ? " (sin pérdida)" : "") << "\n";
     }
   }
 
   // Apply transformations
-  img.transformImage(inputPath, outputPath, angle, scaleFactor, buddySystem,
-                     true);
+  auto start = std::chrono::steady_clock::now();
+  const bool written = runJob(job, true);
+  const double elapsed = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  metrics.reset();
+
+  if (estimated) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const double peakMB = usage.ru_maxrss / 1024.0;
+    std::cout << std::fixed << std::setprecision(1) << "[INFO] Real: "
+              << elapsed << " ms (" << std::showpos
+              << costErrorPercent(predicted.milliseconds, elapsed)
+              << "%), " << std::noshowpos << peakMB << " MB de pico ("
+              << std::showpos << costErrorPercent(predicted.peakMB, peakMB)
+              << "%)\n"
+              << std::noshowpos;
+  }
 
   if (buddyManager != nullptr) {
     delete buddyManager;
     buddyManager = nullptr;
   }
+  if (!written) {
+    return 1;
+  }
 
   // Construct the command with parameters
   std::ostringstream command;
-  command << "./Benchmark -entrada " << inputPath << " -angulo " << angle
-          << " -escalar " << scaleFactor;
+  command << "./Benchmark -entrada " << job.inputPath << " -angulo "
+          << job.angle << " -escalar " << job.scaleFactor;
 
   // Execute Benchmarks
   int result = std::system(command.str().c_str());
@@ -0,0 +1,285 @@
+#include "metrics.h"
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// Histogram bucket k holds latencies below 2^(k + 10) microseconds (about
+// 1 ms, 2 ms, 4 ms ... 16.8 s); the last bucket holds everything slower.
+static const int HISTOGRAM_BUCKETS = 16;
+
+static const char *STAGE_NAMES[STAGE_COUNT] = {"decode", "warp", "encode",
+                                               "job", "preview"};
+
+static const char *COUNTER_NAMES[COUNTER_COUNT] = {
+    "jobs_total",           "job_failures_total", "deadline_misses_total",
+    "coalesced_total",      "output_pixels_total", "path_lossless_total",
+    "path_planar_total",    "path_streaming_total", "path_pixels_total",
+    "pool_hits_total",      "pool_misses_total",  "pool_bytes_total",
+    "heap_bytes_total"};
+
+static const char *GAUGE_NAMES[GAUGE_COUNT] = {"queue_pending",
+                                               "queue_active"};
+
+// Every metric updated by one thread. Only the owner thread writes it, with
+// a relaxed load and store instead of a locked read-modify-write; readers
+// sum the slots of all threads with relaxed loads.
+struct MetricsSlot {
+  atomic<uint64_t> counters[COUNTER_COUNT];
+  atomic<uint64_t> buckets[STAGE_COUNT][HISTOGRAM_BUCKETS];
+  atomic<uint64_t> sumMicros[STAGE_COUNT];
+};
+
+// Slots are never freed, so readers can walk them at any time. A thread that
+// exits hands its slot, totals included, to the next thread that starts.
+static mutex slotsGuard;
+static vector<MetricsSlot *> allSlots;
+static vector<MetricsSlot *> freeSlots;
+static atomic<int64_t> gauges[GAUGE_COUNT];
+
+struct SlotOwner {
+  MetricsSlot *slot = nullptr;
+  ~SlotOwner() {
+    if (slot) {
+      lock_guard<mutex> lock(slotsGuard);
+      freeSlots.push_back(slot);
+    }
+  }
+};
+
+static thread_local SlotOwner slotOwner;
+
+static MetricsSlot &threadSlot() {
+  if (!slotOwner.slot) {
+    lock_guard<mutex> lock(slotsGuard);
+    if (!freeSlots.empty()) {
+      slotOwner.slot = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      slotOwner.slot = new MetricsSlot(); // Zeroed
+      allSlots.push_back(slotOwner.slot);
+    }
+  }
+  return *slotOwner.slot;
+}
+
+static inline void bump(atomic<uint64_t> &value, uint64_t amount) {
+  value.store(value.load(memory_order_relaxed) + amount,
+              memory_order_relaxed);
+}
+
+/**
+ * @brief Adds to a counter of the calling thread.
+ */
+void metricsAdd(MetricCounter counter, uint64_t amount) {
+  bump(threadSlot().counters[counter], amount);
+}
+
+/**
+ * @brief Records one latency sample of a stage.
+ *
+ * @param stage The stage measured.
+ * @param milliseconds Its duration.
+ */
+void metricsRecord(MetricStage stage, double milliseconds) {
+  const uint64_t micros =
+      milliseconds > 0 ? static_cast<uint64_t>(milliseconds * 1000.0) : 0;
+  int bucket = 0;
+  for (uint64_t scaled = micros >> 10;
+       scaled != 0 && bucket < HISTOGRAM_BUCKETS - 1; scaled >>= 1) {
+    bucket++;
+  }
+  MetricsSlot &slot = threadSlot();
+  bump(slot.buckets[stage][bucket], 1);
+  bump(slot.sumMicros[stage], micros);
+}
+
+/**
+ * @brief Sets a gauge.
+ */
+void metricsSet(MetricGauge gauge, int64_t value) {
+  gauges[gauge].store(value, memory_order_relaxed);
+}
+
+// Totals over every thread at one point in time.
+struct MetricsSnapshot {
+  uint64_t counters[COUNTER_COUNT] = {};
+  uint64_t buckets[STAGE_COUNT][HISTOGRAM_BUCKETS] = {};
+  uint64_t sumMicros[STAGE_COUNT] = {};
+  int64_t gauges[GAUGE_COUNT] = {};
+};
+
+static MetricsSnapshot takeSnapshot() {
+  MetricsSnapshot snapshot;
+  lock_guard<mutex> lock(slotsGuard);
+  for (const MetricsSlot *slot : allSlots) {
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+      snapshot.counters[c] += slot->counters[c].load(memory_order_relaxed);
+    }
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+      for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+        snapshot.buckets[s][b] +=
+            slot->buckets[s][b].load(memory_order_relaxed);
+      }
+      snapshot.sumMicros[s] += slot->sumMicros[s].load(memory_order_relaxed);
+    }
+  }
+  for (int g = 0; g < GAUGE_COUNT; ++g) {
+    snapshot.gauges[g] = gauges[g].load(memory_order_relaxed);
+  }
+  return snapshot;
+}
+
+// Upper bound of histogram bucket b, in seconds.
+static double bucketBound(int b) {
+  return static_cast<double>(1ULL << (b + 10)) / 1e6;
+}
+
+static void formatPrometheus(const MetricsSnapshot &snapshot,
+                             double megapixelsPerSecond, ostream &out) {
+  const string prefix = "image_transform_";
+  for (int c = 0; c < COUNTER_COUNT; ++c) {
+    out << "# TYPE " << prefix << COUNTER_NAMES[c] << " counter\n"
+        << prefix << COUNTER_NAMES[c] << " " << snapshot.counters[c] << "\n";
+  }
+  for (int g = 0; g < GAUGE_COUNT; ++g) {
+    out << "# TYPE " << prefix << GAUGE_NAMES[g] << " gauge\n"
+        << prefix << GAUGE_NAMES[g] << " " << snapshot.gauges[g] << "\n";
+  }
+  out << "# TYPE " << prefix << "megapixels_per_second gauge\n"
+      << prefix << "megapixels_per_second " << megapixelsPerSecond << "\n";
+
+  const string histogram = prefix + "stage_seconds";
+  out << "# TYPE " << histogram << " histogram\n";
+  for (int s = 0; s < STAGE_COUNT; ++s) {
+    uint64_t cumulative = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+      cumulative += snapshot.buckets[s][b];
+      out << histogram << "_bucket{stage=\"" << STAGE_NAMES[s] << "\",le=\"";
+      if (b == HISTOGRAM_BUCKETS - 1) {
+        out << "+Inf";
+      } else {
+        out << bucketBound(b);
+      }
+      out << "\"} " << cumulative << "\n";
+    }
+    out << histogram << "_sum{stage=\"" << STAGE_NAMES[s] << "\"} "
+        << snapshot.sumMicros[s] / 1e6 << "\n"
+        << histogram << "_count{stage=\"" << STAGE_NAMES[s] << "\"} "
+        << cumulative << "\n";
+  }
+}
+
+static void formatJson(const MetricsSnapshot &snapshot,
+                       double megapixelsPerSecond, ostream &out) {
+  out << "{\n  \"timestamp\": " << time(nullptr) << ",\n";
+  for (int c = 0; c < COUNTER_COUNT; ++c) {
+    out << "  \"" << COUNTER_NAMES[c] << "\": " << snapshot.counters[c]
+        << ",\n";
+  }
+  for (int g = 0; g < GAUGE_COUNT; ++g) {
+    out << "  \"" << GAUGE_NAMES[g] << "\": " << snapshot.gauges[g] << ",\n";
+  }
+  out << "  \"megapixels_per_second\": " << megapixelsPerSecond << ",\n";
+  out << "  \"stages\": {\n";
+  for (int s = 0; s < STAGE_COUNT; ++s) {
+    uint64_t count = 0;
+    out << "    \"" << STAGE_NAMES[s] << "\": {\"buckets\": [";
+    for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+      count += snapshot.buckets[s][b];
+      out << (b ? ", " : "") << snapshot.buckets[s][b];
+    }
+    out << "], \"count\": " << count
+        << ", \"sum_seconds\": " << snapshot.sumMicros[s] / 1e6 << "}"
+        << (s + 1 < STAGE_COUNT ? "," : "") << "\n";
+  }
+  out << "  }\n}\n";
+}
+
+/**
+ * @brief Writes a snapshot of every metric to a file.
+ *
+ * Prometheus output suits the node exporter's textfile collector; JSON
+ * lists the raw (non-cumulative) histogram buckets, whose upper bounds are
+ * 2^(k + 10) microseconds. The file is written under a temporary name and
+ * renamed, so a collector never reads half a file.
+ *
+ * @param path Output file; ".json" selects JSON.
+ * @param megapixelsPerSecond Output rate to report.
+ * @return bool Whether the file was written.
+ */
+bool writeMetrics(const string &path, double megapixelsPerSecond) {
+  const MetricsSnapshot snapshot = takeSnapshot();
+  ostringstream text;
+  const bool json =
+      path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+  if (json) {
+    formatJson(snapshot, megapixelsPerSecond, text);
+  } else {
+    formatPrometheus(snapshot, megapixelsPerSecond, text);
+  }
+
+  const string temporary = path + ".tmp";
+  {
+    ofstream file(temporary, ios::binary | ios::trunc);
+    file << text.str();
+    if (!file.flush()) {
+      remove(temporary.c_str());
+      return false;
+    }
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/**
+ * @brief Starts exporting the metrics to `path` every `intervalSeconds`.
+ */
+MetricsExporter::MetricsExporter(const string &path, int intervalSeconds)
+    : path(path), intervalSeconds(intervalSeconds < 1 ? 1 : intervalSeconds),
+      stopping(false), lastPixels(0),
+      lastExport(chrono::steady_clock::now()),
+      worker(&MetricsExporter::run, this) {}
+
+/**
+ * @brief Stops the exporter after a final export.
+ */
+MetricsExporter::~MetricsExporter() {
+  {
+    lock_guard<mutex> lock(guard);
+    stopping = true;
+  }
+  wake.notify_one();
+  worker.join();
+  exportNow();
+}
+
+void MetricsExporter::run() {
+  unique_lock<mutex> lock(guard);
+  while (!wake.wait_for(lock, chrono::seconds(intervalSeconds),
+                        [this]() { return stopping; })) {
+    exportNow();
+  }
+}
+
+/**
+ * @brief Exports the metrics, with the output rate since the last export.
+ */
+void MetricsExporter::exportNow() {
+  const uint64_t pixels = takeSnapshot().counters[COUNTER_OUTPUT_PIXELS];
+  const auto now = chrono::steady_clock::now();
+  const double seconds =
+      chrono::duration<double>(now - lastExport).count();
+  const double rate =
+      seconds > 0 ? (pixels - lastPixels) / 1e6 / seconds : 0.0;
+  lastPixels = pixels;
+  lastExport = now;
+  if (!writeMetrics(path, rate)) {
+    cerr << "[ERROR] No se pudieron escribir las métricas en " << path
+         << "\n";
+  }
+}
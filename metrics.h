@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Pipeline stages whose latency is kept as a histogram.
+enum MetricStage {
+  STAGE_DECODE,  // File to pixels
+  STAGE_WARP,    // Resampling kernels (or the whole fast path)
+  STAGE_ENCODE,  // Pixels to file
+  STAGE_JOB,     // A whole transform or ladder, as seen by its caller
+  STAGE_PREVIEW, // Transform start to preview delivery
+  STAGE_COUNT,
+};
+
+// Monotonic event counters.
+enum MetricCounter {
+  COUNTER_JOBS,            // Jobs that wrote their outputs
+  COUNTER_FAILURES,        // Jobs that did not
+  COUNTER_DEADLINE_MISSES, // Batch jobs finished after their deadline
+  COUNTER_COALESCED,       // Batch jobs served by an identical job's output
+  COUNTER_OUTPUT_PIXELS,   // Pixels written, over every output
+  COUNTER_PATH_LOSSLESS,   // Transforms done in the DCT domain
+  COUNTER_PATH_PLANAR,     // Transforms done on Y/Cb/Cr planes
+  COUNTER_PATH_STREAMING,  // Scales done row by row
+  COUNTER_PATH_PIXELS,     // Transforms decoded to pixels
+  COUNTER_POOL_HITS,       // Buffers served by the buddy pool
+  COUNTER_POOL_MISSES,     // Buddy requests that fell back to the heap
+  COUNTER_POOL_BYTES,      // Bytes served by the buddy pool
+  COUNTER_HEAP_BYTES,      // Bytes served by the heap
+  COUNTER_COUNT,
+};
+
+// Current values, each set by a single owner.
+enum MetricGauge {
+  GAUGE_QUEUE_PENDING, // Batch jobs without a marker, as last seen
+  GAUGE_QUEUE_ACTIVE,  // Batch jobs this worker is running
+  GAUGE_COUNT,
+};
+
+// Hot-path updates: lock-free, each thread writes only its own slot.
+void metricsAdd(MetricCounter counter, uint64_t amount = 1);
+void metricsRecord(MetricStage stage, double milliseconds);
+void metricsSet(MetricGauge gauge, int64_t value);
+
+// Writes every metric, as JSON if the path ends in ".json" and otherwise in
+// the Prometheus text format. The file is replaced atomically.
+bool writeMetrics(const std::string &path, double megapixelsPerSecond);
+
+// Writes the metrics every few seconds from a background thread, and once
+// more when destroyed.
+class MetricsExporter {
+public:
+  MetricsExporter(const std::string &path, int intervalSeconds);
+  ~MetricsExporter();
+
+private:
+  void run();
+  void exportNow();
+
+  std::string path;
+  int intervalSeconds;
+  bool stopping;
+  uint64_t lastPixels;
+  std::chrono::steady_clock::time_point lastExport;
+  std::mutex guard;
+  std::condition_variable wake;
+  std::thread worker; // Last, so it starts once the rest is initialised
+};
+
+#endif // METRICS_H
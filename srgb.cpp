@@ -0,0 +1,30 @@
+#include "srgb.h"
+#include <cmath>
+
+float srgbDecodeLut[256];
+unsigned char srgbEncodeLut[SRGB_ENCODE_SIZE];
+
+/**
+ * @brief Fills the sRGB lookup tables before main runs.
+ *
+ * Both tables are built once from the exact sRGB transfer functions, so the
+ * resampling kernels never call `pow` per pixel.
+ */
+static struct SrgbTablesInitializer {
+  SrgbTablesInitializer() {
+    for (int i = 0; i < 256; i++) {
+      double c = i / 255.0;
+      double linear =
+          c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+      srgbDecodeLut[i] = static_cast<float>(linear * 255.0);
+    }
+
+    for (int i = 0; i < SRGB_ENCODE_SIZE; i++) {
+      double linear = static_cast<double>(i) / (SRGB_ENCODE_SIZE - 1);
+      double c = linear <= 0.0031308
+                     ? linear * 12.92
+                     : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+      srgbEncodeLut[i] = static_cast<unsigned char>(c * 255.0 + 0.5);
+    }
+  }
+} srgbTablesInitializer;
@@ -0,0 +1,29 @@
+#ifndef SRGB_H
+#define SRGB_H
+
+// Number of entries in the linear-to-sRGB encode table. 12 bits of linear
+// precision are enough for every 8-bit sRGB value to survive a round trip.
+const int SRGB_ENCODE_SIZE = 4096;
+
+// sRGB sample (0-255) -> linear light, scaled to 0-255
+extern float srgbDecodeLut[256];
+
+// Linear light quantised to 12 bits -> sRGB sample (0-255)
+extern unsigned char srgbEncodeLut[SRGB_ENCODE_SIZE];
+
+// Decodes an 8-bit sRGB sample to linear light in the 0-255 range.
+inline float srgbToLinear(unsigned char value) { return srgbDecodeLut[value]; }
+
+// Encodes linear light in the 0-255 range back to an 8-bit sRGB sample.
+inline unsigned char linearToSrgb(float value) {
+  int index =
+      static_cast<int>(value * ((SRGB_ENCODE_SIZE - 1) / 255.0f) + 0.5f);
+  if (index < 0) {
+    index = 0;
+  } else if (index >= SRGB_ENCODE_SIZE) {
+    index = SRGB_ENCODE_SIZE - 1;
+  }
+  return srgbEncodeLut[index];
+}
+
+#endif // SRGB_H
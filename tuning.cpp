@@ -0,0 +1,170 @@
+#include "tuning.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// Profile of this process, set once at startup.
+static TuningProfile activeProfile;
+static bool haveProfile = false;
+
+/**
+ * @brief Reads the host's CPU model name.
+ *
+ * @return string The "model name" of the first processor in /proc/cpuinfo,
+ * or "desconocida" when there is none.
+ */
+string cpuModel() {
+  ifstream cpuinfo("/proc/cpuinfo");
+  string line;
+  while (getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      const size_t colon = line.find(':');
+      if (colon != string::npos && colon + 2 <= line.size()) {
+        return line.substr(colon + 2);
+      }
+    }
+  }
+  return "desconocida";
+}
+
+/**
+ * @brief Names a kernel variant as written in the profile file.
+ */
+string formatKernelChoice(const KernelChoice &choice) {
+  string text = choice.layout == LAYOUT_TILED
+                    ? "teselas-" + to_string(choice.tileSize)
+                    : "filas";
+  return choice.paddedRgb ? text + "+rgbx" : text;
+}
+
+static bool parseKernelChoice(const string &text, KernelChoice &choice) {
+  const size_t plus = text.find('+');
+  const string layout = text.substr(0, plus);
+  choice.paddedRgb = plus != string::npos && text.substr(plus) == "+rgbx";
+  if (layout == "filas") {
+    choice.layout = LAYOUT_ROWS;
+  } else if (layout.compare(0, 8, "teselas-") == 0) {
+    choice.layout = LAYOUT_TILED;
+    choice.tileSize = atoi(layout.c_str() + 8);
+  } else {
+    return false;
+  }
+  return choice.tileSize > 0;
+}
+
+/**
+ * @brief Parses one profile line, "<hilos> <vecino> <bilineal> <CPU>".
+ */
+static bool parseProfileLine(const string &line, TuningProfile &profile) {
+  istringstream fields(line);
+  string nearest, bilinear;
+  if (!(fields >> profile.threads >> nearest >> bilinear) ||
+      !parseKernelChoice(nearest, profile.nearest) ||
+      !parseKernelChoice(bilinear, profile.bilinear)) {
+    return false;
+  }
+  getline(fields >> ws, profile.cpu);
+  return !profile.cpu.empty();
+}
+
+/**
+ * @brief Looks up the host's CPU model in a profile file.
+ *
+ * @param path The profile file written by the auto-tuner.
+ * @param profile Receives the host's profile.
+ * @return bool Whether the file has a profile for the host.
+ */
+bool loadTuningProfile(const string &path, TuningProfile &profile) {
+  ifstream file(path);
+  const string cpu = cpuModel();
+  string line;
+  while (getline(file, line)) {
+    TuningProfile candidate;
+    if (line[0] != '#' && parseProfileLine(line, candidate) &&
+        candidate.cpu == cpu) {
+      profile = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Stores a profile, so that nodes of different CPU models can share
+ * one profile file.
+ *
+ * @param path The profile file; created if missing.
+ * @param profile The profile, whose cpu field is the key.
+ * @return bool Whether the file was written.
+ */
+bool saveTuningProfile(const string &path, const TuningProfile &profile) {
+  vector<string> kept;
+  {
+    ifstream file(path);
+    string line;
+    while (getline(file, line)) {
+      TuningProfile other;
+      if (line[0] != '#' && parseProfileLine(line, other) &&
+          other.cpu != profile.cpu) {
+        kept.push_back(line);
+      }
+    }
+  }
+  const string temporary = path + ".tmp";
+  {
+    ofstream file(temporary, ios::trunc);
+    file << "# Perfil de ajuste (Benchmark -autoajuste), una línea por CPU:\n"
+            "# <hilos> <núcleo vecino> <núcleo bilineal> <modelo de CPU>\n";
+    for (const string &line : kept) {
+      file << line << "\n";
+    }
+    file << profile.threads << " " << formatKernelChoice(profile.nearest)
+         << " " << formatKernelChoice(profile.bilinear) << " " << profile.cpu
+         << "\n";
+    if (!file.flush()) {
+      remove(temporary.c_str());
+      return false;
+    }
+  }
+  return rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/**
+ * @brief Installs the profile used by applyTuningProfile. Called once, at
+ * startup, before any job runs.
+ */
+void setTuningProfile(const TuningProfile &profile) {
+  activeProfile = profile;
+  haveProfile = true;
+}
+
+/**
+ * @brief Fills in the tuned settings of a job.
+ *
+ * @param options The job's options.
+ * @param kernel Whether the job left the layout and packing to the profile
+ * (no -teselas or -rgbx); the variant depends on the filter.
+ * @param threads Whether the job left the thread count to the profile (no
+ * -hilos).
+ */
+void applyTuningProfile(TransformOptions &options, bool kernel,
+                        bool threads) {
+  if (!haveProfile) {
+    return;
+  }
+  if (kernel) {
+    const KernelChoice &choice = options.interpolation == INTERP_BILINEAR
+                                     ? activeProfile.bilinear
+                                     : activeProfile.nearest;
+    options.layout = choice.layout;
+    options.tileSize = choice.tileSize;
+    options.paddedRgb = choice.paddedRgb;
+  }
+  if (threads && activeProfile.threads > 0) {
+    options.threads = activeProfile.threads;
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include "image.h"
+#include <string>
+
+// Warp kernel variant: source layout and pixel packing.
+struct KernelChoice {
+  PixelLayout layout = LAYOUT_ROWS;
+  int tileSize = 16;      // Tile side when tiled
+  bool paddedRgb = false; // 8-bit RGB warped as RGBX
+};
+
+// Fastest settings measured on one CPU model by the auto-tuner.
+struct TuningProfile {
+  std::string cpu;
+  int threads = 0;       // JPEG decode threads
+  KernelChoice nearest;  // For nearest-neighbour warps
+  KernelChoice bilinear; // For bilinear warps
+};
+
+// The host's CPU model, as named in /proc/cpuinfo.
+std::string cpuModel();
+
+// Reads the profile of the host's CPU model from a profile file, which
+// holds one line per CPU model.
+bool loadTuningProfile(const std::string &path, TuningProfile &profile);
+
+// Writes the profile, replacing the line of its CPU model and keeping the
+// others.
+bool saveTuningProfile(const std::string &path, const TuningProfile &profile);
+
+// Makes the profile apply to every job of the process.
+void setTuningProfile(const TuningProfile &profile);
+
+// Applies the process's profile, if any, to the kernel and thread settings
+// a job left at their defaults.
+void applyTuningProfile(TransformOptions &options, bool kernel, bool threads);
+
+// Text form of a kernel variant in the profile file: "filas" or
+// "teselas-<n>", with "+rgbx" when padded.
+std::string formatKernelChoice(const KernelChoice &choice);
+
+#endif // TUNING_H